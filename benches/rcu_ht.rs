@@ -0,0 +1,617 @@
+//! Benchmarks of urcu-ht, compared to the same workloads on `RwLock<HashMap>` and on lib urcu
+//! hashtable used directly (same as the C test application).
+//!
+//! Run with `cargo bench --features memb`. Lookups and writes are generated before measures
+//! with a fixed seed, so results of two runs (or two versions) can be compared.
+//!
+//! Environment variables:
+//! - `URCU_BENCH_LARGE=1` adds tables of 10M and 100M objects (many GB of memory).
+//! - `URCU_BENCH_THREADS=1,2,8` overrides reader counts (default: powers of two up to all cores).
+use std::collections::HashMap;
+use std::hash::{BuildHasher, Hash};
+use std::sync::{Barrier, RwLock};
+use std::time::{Duration, Instant};
+
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use urcu_ht::{DefaultFlavor, DefaultHashBuilder, RcuFlavor, RcuHt};
+
+/// Number of operations generated for each thread (replayed in loop).
+const OPS_PER_THREAD: usize = 1 << 16;
+
+/// Read-side critical sections between two quiescent states (qsbr flavor only).
+#[cfg(all(feature = "qsbr", not(feature = "memb")))]
+const QSBR_PERIOD: usize = 1024;
+
+/// splitmix64: small and reproducible.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e3779b97f4a7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d049bb133111eb);
+        z ^ (z >> 31)
+    }
+
+    /// Uniform in [0, 1).
+    fn next_f64(&mut self) -> f64 {
+        (self.next() >> 11) as f64 / (1u64 << 53) as f64
+    }
+}
+
+/// Zipfian distribution over [0, n) (Gray et al., "Quickly generating billion-record synthetic databases").
+struct Zipf {
+    n: f64,
+    theta: f64,
+    alpha: f64,
+    zetan: f64,
+    eta: f64,
+}
+
+/// Approximation of sum(1 / i^theta, i = 1..=n): exact for the first terms, integral for the tail.
+fn zeta(n: u64, theta: f64) -> f64 {
+    let exact = n.min(1 << 16);
+    let mut sum: f64 = (1..=exact).map(|i| (i as f64).powf(-theta)).sum();
+
+    if n > exact {
+        let (a, b) = (exact as f64 + 0.5, n as f64 + 0.5);
+        sum += (b.powf(1.0 - theta) - a.powf(1.0 - theta)) / (1.0 - theta);
+    }
+
+    sum
+}
+
+impl Zipf {
+    fn new(n: u64, theta: f64) -> Self {
+        let zetan = zeta(n, theta);
+        let zeta2 = zeta(2, theta);
+        let n = n as f64;
+
+        Zipf {
+            n,
+            theta,
+            alpha: 1.0 / (1.0 - theta),
+            zetan,
+            eta: (1.0 - (2.0 / n).powf(1.0 - theta)) / (1.0 - zeta2 / zetan),
+        }
+    }
+
+    fn sample(&self, rng: &mut Rng) -> u64 {
+        let u = rng.next_f64();
+        let uz = u * self.zetan;
+
+        if uz < 1.0 {
+            0
+        } else if uz < 1.0 + 0.5f64.powf(self.theta) {
+            1
+        } else {
+            ((self.n * (self.eta * u - self.eta + 1.0).powf(self.alpha)) as u64)
+                .min(self.n as u64 - 1)
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug)]
+enum KeyDist {
+    Uniform,
+    Zipf(f64),
+}
+
+/// Keys of the benchmarks: key `i` is present in tables for `i < size`.
+trait BenchKey: Hash + Eq + Clone + Send + Sync + 'static {
+    fn from_index(index: u64) -> Self;
+}
+
+impl BenchKey for u64 {
+    fn from_index(index: u64) -> Self {
+        index
+    }
+}
+
+impl BenchKey for String {
+    fn from_index(index: u64) -> Self {
+        format!("key-{:016x}", index)
+    }
+}
+
+#[derive(Clone, Copy, Debug)]
+struct Workload {
+    size: u64,
+    dist: KeyDist,
+    /// fraction of lookups for keys present in the table
+    hit_ratio: f64,
+    /// fraction of operations which are writes (replace an existing key)
+    write_ratio: f64,
+    threads: usize,
+}
+
+impl Workload {
+    fn read_only(size: u64, threads: usize) -> Self {
+        Workload {
+            size,
+            dist: KeyDist::Uniform,
+            hit_ratio: 1.0,
+            write_ratio: 0.0,
+            threads,
+        }
+    }
+}
+
+enum Op<K> {
+    Get(K),
+    Write(K),
+}
+
+/// Operations of each thread: every thread gets its own sequence.
+fn generate_ops<K: BenchKey>(workload: &Workload) -> Vec<Vec<Op<K>>> {
+    let zipf = match workload.dist {
+        KeyDist::Zipf(theta) => Some(Zipf::new(workload.size, theta)),
+        KeyDist::Uniform => None,
+    };
+
+    (0..workload.threads)
+        .map(|thread| {
+            let mut rng = Rng(0x5eed + thread as u64);
+
+            (0..OPS_PER_THREAD)
+                .map(|_| {
+                    let index = match &zipf {
+                        Some(zipf) => zipf.sample(&mut rng),
+                        None => rng.next() % workload.size,
+                    };
+
+                    if rng.next_f64() < workload.write_ratio {
+                        Op::Write(K::from_index(index))
+                    } else if rng.next_f64() < workload.hit_ratio {
+                        Op::Get(K::from_index(index))
+                    } else {
+                        // keys past the table size are never inserted
+                        Op::Get(K::from_index(workload.size + index))
+                    }
+                })
+                .collect()
+        })
+        .collect()
+}
+
+/// A hashtable implementation under test.
+trait Table<K: BenchKey>: Sync {
+    fn build(size: u64) -> Self;
+
+    /// Run `iters` operations of `ops` (in loop) from the current thread, returns hits.
+    fn run(&self, ops: &[Op<K>], iters: u64) -> u64;
+}
+
+impl<K: BenchKey> Table<K> for RcuHt<K, u64> {
+    fn build(size: u64) -> Self {
+        RcuHt::from_iter_with_capacity((0..size).map(|i| (K::from_index(i), i)), size as usize)
+            .expect("Cannot create hashtable")
+    }
+
+    #[allow(unused_mut)]
+    fn run(&self, ops: &[Op<K>], iters: u64) -> u64 {
+        let mut thread = self.thread();
+        let mut hits = 0;
+
+        for (_i, op) in ops.iter().cycle().take(iters as usize).enumerate() {
+            match op {
+                Op::Get(key) => {
+                    let rdlock = thread.rdlock();
+                    hits += rdlock.get(key).is_some() as u64;
+                }
+                Op::Write(key) => {
+                    let mut wrlock = thread.wrlock().unwrap();
+                    wrlock.insert_or_replace(key.clone(), 0);
+                }
+            }
+
+            #[cfg(all(feature = "qsbr", not(feature = "memb")))]
+            if _i % QSBR_PERIOD == 0 {
+                thread.quiescent_state();
+            }
+        }
+
+        hits
+    }
+}
+
+/// Reference using the standard library only, with the same hashing algorithm.
+struct RwLockHashMap<K>(RwLock<HashMap<K, u64, DefaultHashBuilder>>);
+
+impl<K: BenchKey> Table<K> for RwLockHashMap<K> {
+    fn build(size: u64) -> Self {
+        let mut map =
+            HashMap::with_capacity_and_hasher(size as usize, DefaultHashBuilder::default());
+        map.extend((0..size).map(|i| (K::from_index(i), i)));
+        RwLockHashMap(RwLock::new(map))
+    }
+
+    fn run(&self, ops: &[Op<K>], iters: u64) -> u64 {
+        let mut hits = 0;
+
+        for op in ops.iter().cycle().take(iters as usize) {
+            match op {
+                Op::Get(key) => hits += self.0.read().unwrap().get(key).is_some() as u64,
+                Op::Write(key) => {
+                    self.0.write().unwrap().insert(key.clone(), 0);
+                }
+            }
+        }
+
+        hits
+    }
+}
+
+/// Reference using lib urcu hashtable directly, like the C test application: u64 keys only.
+struct RawLfht {
+    ht: *mut urcu_sys::cds_lfht,
+    hash_builder: DefaultHashBuilder,
+}
+
+unsafe impl Sync for RawLfht {}
+
+#[repr(C)]
+struct RawNode {
+    node: urcu_sys::cds_lfht_node,
+    head: urcu_sys::rcu_head,
+    key: u64,
+    value: u64,
+}
+
+unsafe extern "C" fn raw_match(
+    node: *mut urcu_sys::cds_lfht_node,
+    key: *const std::ffi::c_void,
+) -> i32 {
+    ((*(node as *mut RawNode)).key == *(key as *const u64)) as i32
+}
+
+unsafe extern "C" fn raw_free(head: *mut urcu_sys::rcu_head) {
+    let offset = memoffset::offset_of!(RawNode, head);
+    drop(Box::from_raw((head as *mut u8).sub(offset) as *mut RawNode));
+}
+
+impl RawLfht {
+    fn hash(&self, key: &u64) -> u64 {
+        self.hash_builder.hash_one(key)
+    }
+
+    /// Call with the thread registered and the read lock held.
+    unsafe fn add_replace(&self, key: u64, value: u64) -> *mut RawNode {
+        let node = Box::into_raw(Box::new(RawNode {
+            node: std::mem::zeroed(),
+            head: std::mem::zeroed(),
+            key,
+            value,
+        }));
+
+        urcu_sys::cds_lfht_add_replace(
+            self.ht,
+            self.hash(&key),
+            Some(raw_match),
+            &(*node).key as *const u64 as *const std::ffi::c_void,
+            &mut (*node).node,
+        ) as *mut RawNode
+    }
+}
+
+impl Table<u64> for RawLfht {
+    fn build(size: u64) -> Self {
+        DefaultFlavor::init();
+
+        let ht = unsafe {
+            urcu_sys::cds_lfht_new(
+                size.max(1).next_power_of_two(),
+                1,
+                0,
+                (urcu_sys::CDS_LFHT_AUTO_RESIZE | urcu_sys::CDS_LFHT_ACCOUNTING) as i32,
+                std::ptr::null_mut(),
+            )
+        };
+        let raw = RawLfht {
+            ht,
+            hash_builder: DefaultHashBuilder::default(),
+        };
+
+        unsafe {
+            DefaultFlavor::register_thread();
+            DefaultFlavor::read_lock();
+            for i in 0..size {
+                raw.add_replace(i, i);
+            }
+            DefaultFlavor::read_unlock();
+            DefaultFlavor::unregister_thread();
+        }
+
+        raw
+    }
+
+    fn run(&self, ops: &[Op<u64>], iters: u64) -> u64 {
+        let mut hits = 0;
+
+        unsafe {
+            DefaultFlavor::register_thread();
+
+            for op in ops.iter().cycle().take(iters as usize) {
+                DefaultFlavor::read_lock();
+
+                match op {
+                    Op::Get(key) => {
+                        let mut iter: urcu_sys::cds_lfht_iter = std::mem::zeroed();
+                        urcu_sys::cds_lfht_lookup(
+                            self.ht,
+                            self.hash(key),
+                            Some(raw_match),
+                            key as *const u64 as *const std::ffi::c_void,
+                            &mut iter,
+                        );
+                        let node = urcu_sys::cds_lfht_iter_get_node(&mut iter) as *mut RawNode;
+                        if !node.is_null() {
+                            hits += 1;
+                            black_box((*node).value);
+                        }
+                    }
+                    Op::Write(key) => {
+                        let old = self.add_replace(*key, 0);
+                        if !old.is_null() {
+                            DefaultFlavor::call_rcu(&mut (*old).head, raw_free);
+                        }
+                    }
+                }
+
+                DefaultFlavor::read_unlock();
+
+                #[cfg(feature = "qsbr")]
+                urcu_sys::rcu_quiescent_state();
+            }
+
+            DefaultFlavor::unregister_thread();
+        }
+
+        hits
+    }
+}
+
+impl Drop for RawLfht {
+    fn drop(&mut self) {
+        unsafe {
+            DefaultFlavor::register_thread();
+            DefaultFlavor::barrier();
+
+            let mut iter: urcu_sys::cds_lfht_iter = std::mem::zeroed();
+            urcu_sys::cds_lfht_first(self.ht, &mut iter);
+            let mut node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+            while !node.is_null() {
+                urcu_sys::cds_lfht_next(self.ht, &mut iter);
+                urcu_sys::cds_lfht_del(self.ht, node);
+                drop(Box::from_raw(node as *mut RawNode));
+                node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+            }
+
+            urcu_sys::cds_lfht_destroy(self.ht, std::ptr::null_mut());
+            DefaultFlavor::unregister_thread();
+        }
+    }
+}
+
+/// Run `iters` operations in each thread, returns the time taken by the slowest thread.
+fn measure<K: BenchKey, T: Table<K>>(table: &T, ops: &[Vec<Op<K>>], iters: u64) -> Duration {
+    let barrier = Barrier::new(ops.len() + 1);
+
+    std::thread::scope(|scope| {
+        let threads: Vec<_> = ops
+            .iter()
+            .map(|ops| {
+                let barrier = &barrier;
+                scope.spawn(move || {
+                    barrier.wait();
+                    black_box(table.run(ops, iters));
+                })
+            })
+            .collect();
+
+        barrier.wait();
+        let start = Instant::now();
+        for thread in threads {
+            thread.join().unwrap();
+        }
+        start.elapsed()
+    })
+}
+
+fn bench_workload<K: BenchKey, T: Table<K>>(
+    c: &mut Criterion,
+    group: &str,
+    name: &str,
+    table: &T,
+    workload: Workload,
+    parameter: String,
+) {
+    let ops = generate_ops::<K>(&workload);
+    let mut group = c.benchmark_group(group);
+
+    // throughput of all threads together
+    group.throughput(Throughput::Elements(workload.threads as u64));
+    group.bench_with_input(BenchmarkId::new(name, parameter), &ops, |b, ops| {
+        b.iter_custom(|iters| measure(table, ops, iters))
+    });
+    group.finish();
+}
+
+fn thread_counts() -> Vec<usize> {
+    if let Ok(list) = std::env::var("URCU_BENCH_THREADS") {
+        return list
+            .split(',')
+            .filter_map(|n| n.trim().parse().ok())
+            .collect();
+    }
+
+    let cores = std::thread::available_parallelism().map_or(1, |n| n.get());
+    let mut counts: Vec<usize> = (0..)
+        .map(|shift| 1 << shift)
+        .take_while(|n| *n < cores)
+        .collect();
+    counts.push(cores);
+    counts
+}
+
+fn all_cores() -> usize {
+    *thread_counts().last().unwrap()
+}
+
+fn table_sizes() -> Vec<u64> {
+    let mut sizes = vec![1_000, 100_000, 1_000_000];
+    if std::env::var_os("URCU_BENCH_LARGE").is_some() {
+        sizes.extend([10_000_000, 100_000_000]);
+    }
+    sizes
+}
+
+/// Read-only lookups, 1 to all cores.
+fn read_only(c: &mut Criterion) {
+    for size in [1_000, 1_000_000] {
+        let rcu = <RcuHt<u64, u64> as Table<u64>>::build(size);
+        let rwlock = RwLockHashMap::<u64>::build(size);
+        let raw = RawLfht::build(size);
+
+        for threads in thread_counts() {
+            let workload = Workload::read_only(size, threads);
+            let parameter = format!("{}/{}threads", size, threads);
+
+            bench_workload(c, "read_only", "urcu-ht", &rcu, workload, parameter.clone());
+            bench_workload(
+                c,
+                "read_only",
+                "rwlock",
+                &rwlock,
+                workload,
+                parameter.clone(),
+            );
+            bench_workload(c, "read_only", "cds_lfht", &raw, workload, parameter);
+        }
+    }
+}
+
+/// 99/1 and 90/10 read/write mixes, all cores.
+fn read_write(c: &mut Criterion) {
+    let size = 1_000_000;
+    let threads = all_cores();
+    let rcu = <RcuHt<u64, u64> as Table<u64>>::build(size);
+    let rwlock = RwLockHashMap::<u64>::build(size);
+    let raw = RawLfht::build(size);
+
+    for write_ratio in [0.01, 0.1] {
+        let workload = Workload {
+            write_ratio,
+            ..Workload::read_only(size, threads)
+        };
+        let parameter = format!("{}%writes/{}threads", write_ratio * 100.0, threads);
+
+        bench_workload(
+            c,
+            "read_write",
+            "urcu-ht",
+            &rcu,
+            workload,
+            parameter.clone(),
+        );
+        bench_workload(
+            c,
+            "read_write",
+            "rwlock",
+            &rwlock,
+            workload,
+            parameter.clone(),
+        );
+        bench_workload(c, "read_write", "cds_lfht", &raw, workload, parameter);
+    }
+}
+
+/// Uniform vs Zipfian keys: hot keys stay in cache.
+fn key_distribution(c: &mut Criterion) {
+    let size = 1_000_000;
+    let threads = all_cores();
+    let rcu = <RcuHt<u64, u64> as Table<u64>>::build(size);
+
+    for (name, dist) in [
+        ("uniform", KeyDist::Uniform),
+        ("zipf-0.99", KeyDist::Zipf(0.99)),
+    ] {
+        let workload = Workload {
+            dist,
+            ..Workload::read_only(size, threads)
+        };
+        bench_workload(
+            c,
+            "key_distribution",
+            "urcu-ht",
+            &rcu,
+            workload,
+            name.to_string(),
+        );
+    }
+}
+
+/// Table sizes from 1K objects (fits in L1 cache) to 1M (100M with URCU_BENCH_LARGE).
+fn table_size(c: &mut Criterion) {
+    for size in table_sizes() {
+        let rcu = <RcuHt<u64, u64> as Table<u64>>::build(size);
+        let raw = RawLfht::build(size);
+        let workload = Workload::read_only(size, 1);
+
+        bench_workload(c, "table_size", "urcu-ht", &rcu, workload, size.to_string());
+        bench_workload(
+            c,
+            "table_size",
+            "cds_lfht",
+            &raw,
+            workload,
+            size.to_string(),
+        );
+    }
+}
+
+/// u64 vs String keys (hashing and comparison costs).
+fn key_type(c: &mut Criterion) {
+    let size = 1_000_000;
+    let workload = Workload::read_only(size, 1);
+
+    let rcu = <RcuHt<u64, u64> as Table<u64>>::build(size);
+    bench_workload(c, "key_type", "urcu-ht", &rcu, workload, "u64".to_string());
+    drop(rcu);
+
+    let rcu = <RcuHt<String, u64> as Table<String>>::build(size);
+    bench_workload(
+        c,
+        "key_type",
+        "urcu-ht",
+        &rcu,
+        workload,
+        "String".to_string(),
+    );
+}
+
+/// Mixes of hits and misses.
+fn hit_ratio(c: &mut Criterion) {
+    let size = 1_000_000;
+    let rcu = <RcuHt<u64, u64> as Table<u64>>::build(size);
+
+    for hit_ratio in [1.0, 0.5, 0.0] {
+        let workload = Workload {
+            hit_ratio,
+            ..Workload::read_only(size, 1)
+        };
+        let parameter = format!("{}%hits", hit_ratio * 100.0);
+        bench_workload(c, "hit_ratio", "urcu-ht", &rcu, workload, parameter);
+    }
+}
+
+criterion_group! {
+    name = benches;
+    config = Criterion::default()
+        .sample_size(20)
+        .warm_up_time(Duration::from_millis(500))
+        .measurement_time(Duration::from_secs(2));
+    targets = read_only, read_write, key_distribution, table_size, key_type, hit_ratio
+}
+criterion_main!(benches);
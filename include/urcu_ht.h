@@ -0,0 +1,81 @@
+/*
+ * C API of urcu-ht (cargo feature "ffi"): a RCU hashtable with byte string keys and values,
+ * which can be shared with Rust code in the same process.
+ *
+ * Link with the static (liburcu_ht.a) or dynamic (liburcu_ht.so) library built by
+ * "cargo rustc --release --lib --features ffi --crate-type staticlib,cdylib", and with liburcu of
+ * the selected flavor.
+ *
+ * Functions returning an int return 0 on success, or a negative errno value.
+ */
+#ifndef URCU_HT_H
+#define URCU_HT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* hashtable (RcuHtBytes in Rust) */
+typedef struct urcu_ht urcu_ht;
+/* per thread handle: registers the thread, must stay in the thread which created it */
+typedef struct urcu_ht_thread urcu_ht_thread;
+/* read lock: values returned by lookups are valid until it is released */
+typedef struct urcu_ht_read urcu_ht_read;
+/* write lock: holds the write mutex, removed objects are given to call_rcu when it is released */
+typedef struct urcu_ht_writer urcu_ht_writer;
+
+/* Allocate a hashtable (parameters of cds_lfht_new). Returns NULL on invalid parameters. */
+urcu_ht *urcu_ht_new(uint64_t init_size, uint64_t min_nr_alloc_buckets,
+                     uint64_t max_nr_buckets, int autoresize);
+/* Release a hashtable allocated by urcu_ht_new. All its thread handles must be freed. */
+void urcu_ht_destroy(urcu_ht *ht);
+
+/* Get a thread handle (the first one registers the current thread). */
+urcu_ht_thread *urcu_ht_thread_new(urcu_ht *ht);
+/* Free a thread handle. No read lock of this handle must be alive. */
+void urcu_ht_thread_free(urcu_ht_thread *thread);
+
+/* Take a read lock, release it. */
+urcu_ht_read *urcu_ht_rdlock(urcu_ht_thread *thread);
+void urcu_ht_rdunlock(urcu_ht_read *read);
+
+/* Lookup a key: returns 0 and the value (valid under this read lock), or -ENOENT. */
+int urcu_ht_get(const urcu_ht_read *read, const void *key, size_t key_len,
+                const void **value, size_t *value_len);
+/* Lookup count keys at once: values[i] is NULL if keys[i] is not found.
+ * Returns the number of keys found. */
+size_t urcu_ht_get_many(const urcu_ht_read *read, size_t count,
+                        const void *const *keys, const size_t *key_lens,
+                        const void **values, size_t *value_lens);
+
+/* Single writes: each call takes and releases the write mutex, and gives the replaced or removed
+ * object to call_rcu right away. Use urcu_ht_wrlock to batch many writes. */
+
+/* Insert or replace an object (key and value are copied). */
+int urcu_ht_insert(urcu_ht_thread *thread, const void *key, size_t key_len,
+                   const void *value, size_t value_len);
+/* Insert an object, or return -EEXIST if the key is present. */
+int urcu_ht_insert_unique(urcu_ht_thread *thread, const void *key, size_t key_len,
+                          const void *value, size_t value_len);
+/* Remove an object (released after a grace period), or return -ENOENT. */
+int urcu_ht_remove(urcu_ht_thread *thread, const void *key, size_t key_len);
+
+/* Batched writes: take the write mutex once (NULL if it is poisoned), write, then release it. */
+urcu_ht_writer *urcu_ht_wrlock(urcu_ht_thread *thread);
+void urcu_ht_wrunlock(urcu_ht_writer *writer);
+
+/* Same as urcu_ht_insert, urcu_ht_insert_unique and urcu_ht_remove, under a write lock. */
+int urcu_ht_writer_insert(urcu_ht_writer *writer, const void *key, size_t key_len,
+                          const void *value, size_t value_len);
+int urcu_ht_writer_insert_unique(urcu_ht_writer *writer, const void *key, size_t key_len,
+                                 const void *value, size_t value_len);
+int urcu_ht_writer_remove(urcu_ht_writer *writer, const void *key, size_t key_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URCU_HT_H */
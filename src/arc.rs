@@ -0,0 +1,70 @@
+//! Values outliving the read lock: refcounted values of a [`RcuArcHt`].
+//!
+//! References returned by [`RcuHtRead::get`] are only valid under the read lock. Large values kept
+//! longer either have to be cloned, or keep the read lock (and delay grace periods). Values stored
+//! as `Arc<V>` can be handed out instead: the reference count is incremented under the read lock,
+//! and the handle stays valid once it is released, even if a writer removes or replaces the value.
+//! The value itself is released with its last handle.
+use std::borrow::Borrow;
+use std::hash::{BuildHasher, Hash};
+use std::sync::Arc;
+
+use crate::{DefaultFlavor, DefaultHashBuilder, RcuFlavor, RcuHt, RcuHtRead};
+
+/// A hashtable whose values are refcounted, see [`RcuHtRead::get_arc`].
+///
+/// ```
+/// use std::sync::Arc;
+/// use urcu_ht::RcuArcHt;
+///
+/// let ht: RcuArcHt<u32, Vec<u8>> = RcuArcHt::new(64, 64, 0, true).unwrap();
+/// let thread = ht.thread();
+/// thread.writer().insert_or_replace(1, Arc::new(vec![0; 4096]));
+///
+/// let value = thread.rdlock().get_arc(&1).unwrap();
+/// // the read lock is released, the value is still there once removed
+/// thread.writer().remove(&1).unwrap();
+/// assert_eq!(value.len(), 4096);
+/// ```
+pub type RcuArcHt<K, V, S = DefaultHashBuilder, R = DefaultFlavor> = RcuHt<K, Arc<V>, S, R>;
+
+impl<'rdlock, 'thread, 'ht, K, V, S, R> RcuHtRead<'thread, 'ht, K, Arc<V>, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Get a handle to the value of a key, valid after this read lock is released.
+    ///
+    /// It costs an atomic increment of the reference count (and a decrement when dropped): the
+    /// cache line of the count is shared by all readers of this value.
+    #[inline]
+    pub fn get_arc<Q: ?Sized>(&'rdlock self, key: &Q) -> Option<Arc<V>>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        self.get(key).cloned()
+    }
+}
+
+impl<'rdlock, 'thread, 'ht, K, V, S, R> RcuHtRead<'thread, 'ht, K, V, S, R>
+where
+    K: Hash + Eq,
+    V: Clone,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Get a copy of the value of a key, made under this read lock.
+    ///
+    /// For large values, store them refcounted (see [`RcuArcHt`]): the copy is then a new handle
+    /// to the same value.
+    #[inline]
+    pub fn get_owned<Q: ?Sized>(&'rdlock self, key: &Q) -> Option<V>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        self.get(key).cloned()
+    }
+}
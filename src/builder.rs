@@ -0,0 +1,368 @@
+//! Builder for hashtables needing more than the parameters of [`RcuHt::new`].
+//!
+//! All parameters are mapped to urcu lib `cds_lfht_new` (or `_cds_lfht_new` for an explicit
+//! memory layout):
+//! <https://github.com/urcu/userspace-rcu/blob/master/include/urcu/rculfhash.h>
+use std::hash::{BuildHasher, Hash};
+use std::marker::PhantomData;
+use std::sync::Mutex;
+
+use crate::{
+    reclaim::urcu_create_call_rcu_worker, DefaultFlavor, DefaultHashBuilder, RcuBackpressure,
+    RcuError, RcuFlavor, RcuHt, RcuHtPending, RcuHtStats, RcuHtWriterGuard, RcuLfhtNode,
+    RcuNodePool, RcuNodePoolConfig, RcuReclaim,
+};
+
+/// Memory layout of the bucket table (lib urcu `cds_lfht_mm_type`).
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum RcuHtMemoryLayout {
+    /// Let lib urcu choose: "order" if `max_nr_buckets` is 0, "chunk" otherwise (if possible).
+    Auto,
+    /// One allocation per power of two: the table can grow without limit.
+    Order,
+    /// The table is split in chunks of `min_nr_alloc_buckets` buckets.
+    Chunk,
+    /// Virtual memory for `max_nr_buckets` is reserved once, and populated as the table grows.
+    /// Best layout for very large tables. Requires `max_nr_buckets`.
+    Mmap,
+}
+
+impl RcuHtMemoryLayout {
+    fn mm_type(self) -> *const urcu_sys::cds_lfht_mm_type {
+        match self {
+            RcuHtMemoryLayout::Auto => std::ptr::null(),
+            RcuHtMemoryLayout::Order => std::ptr::addr_of!(urcu_sys::cds_lfht_mm_order),
+            RcuHtMemoryLayout::Chunk => std::ptr::addr_of!(urcu_sys::cds_lfht_mm_chunk),
+            RcuHtMemoryLayout::Mmap => std::ptr::addr_of!(urcu_sys::cds_lfht_mm_mmap),
+        }
+    }
+}
+
+/// Build a new hashtable with custom parameters.
+///
+/// ```
+/// use urcu_ht::{RcuHt, RcuHtBuilder, RcuHtMemoryLayout};
+///
+/// let ht: RcuHt<u32, u32> = RcuHtBuilder::new()
+///     .init_size(1 << 16)
+///     .max_nr_buckets(1 << 20)
+///     .memory_layout(RcuHtMemoryLayout::Mmap)
+///     .accounting(true)
+///     .build()
+///     .expect("Cannot create hashtable");
+/// ```
+#[derive(Debug)]
+pub struct RcuHtBuilder<S = DefaultHashBuilder, R = DefaultFlavor> {
+    init_size: u64,
+    min_nr_alloc_buckets: u64,
+    max_nr_buckets: u64,
+    auto_resize: bool,
+    accounting: bool,
+    memory_layout: RcuHtMemoryLayout,
+    pub(crate) hash_builder: S,
+    pub(crate) pool: Option<RcuNodePoolConfig>,
+    reclaim_batch_size: usize,
+    reclaim_high_water: Option<(usize, RcuBackpressure)>,
+    call_rcu_worker: Option<Option<usize>>,
+    _flavor: PhantomData<fn() -> R>,
+}
+
+impl RcuHtBuilder<DefaultHashBuilder> {
+    /// Default parameters: 64 buckets (minimum 1, no maximum), automatic resize with accounting,
+    /// default hashing algorithm and no node pool.
+    pub fn new() -> Self {
+        RcuHtBuilder {
+            init_size: 64,
+            min_nr_alloc_buckets: 1,
+            max_nr_buckets: 0,
+            auto_resize: true,
+            accounting: true,
+            memory_layout: RcuHtMemoryLayout::Auto,
+            hash_builder: DefaultHashBuilder::default(),
+            pool: None,
+            reclaim_batch_size: crate::URCU_RECLAIM_BATCH_SIZE,
+            reclaim_high_water: None,
+            call_rcu_worker: None,
+            _flavor: PhantomData,
+        }
+    }
+}
+
+// not derived: flavors do not need to be Clone
+impl<S: Clone, R> Clone for RcuHtBuilder<S, R> {
+    fn clone(&self) -> Self {
+        RcuHtBuilder {
+            hash_builder: self.hash_builder.clone(),
+            pool: self.pool.clone(),
+            _flavor: PhantomData,
+            ..*self
+        }
+    }
+}
+
+impl Default for RcuHtBuilder<DefaultHashBuilder> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<S, R> RcuHtBuilder<S, R> {
+    /// Number of buckets allocated initially. Must be power of two.
+    ///
+    /// Set it to the expected number of objects before a bulk load, to avoid successive resizes.
+    pub fn init_size(mut self, init_size: u64) -> Self {
+        self.init_size = init_size;
+        self
+    }
+
+    /// Allocate enough buckets for `capacity` objects (`init_size` is the next power of two).
+    pub fn capacity(mut self, capacity: usize) -> Self {
+        self.init_size = (capacity.max(1) as u64).next_power_of_two();
+        self
+    }
+
+    /// Minimum number of allocated buckets. Must be power of two.
+    pub fn min_nr_alloc_buckets(mut self, min_nr_alloc_buckets: u64) -> Self {
+        self.min_nr_alloc_buckets = min_nr_alloc_buckets;
+        self
+    }
+
+    /// Maximum number of buckets. Must be power of two, 0 means "infinite".
+    pub fn max_nr_buckets(mut self, max_nr_buckets: u64) -> Self {
+        self.max_nr_buckets = max_nr_buckets;
+        self
+    }
+
+    /// Automatically resize hash table (`CDS_LFHT_AUTO_RESIZE`).
+    pub fn auto_resize(mut self, auto_resize: bool) -> Self {
+        self.auto_resize = auto_resize;
+        self
+    }
+
+    /// Count objects (`CDS_LFHT_ACCOUNTING`).
+    ///
+    /// Without accounting, automatic resize only grows the table when a bucket chain gets too long,
+    /// and never shrinks it.
+    pub fn accounting(mut self, accounting: bool) -> Self {
+        self.accounting = accounting;
+        self
+    }
+
+    /// Memory layout of the bucket table.
+    ///
+    /// The hashtable is then created by `_cds_lfht_new` with the flavor description of lib urcu
+    /// ([`RcuFlavor::lfht_flavor`]), instead of `cds_lfht_new`.
+    pub fn memory_layout(mut self, memory_layout: RcuHtMemoryLayout) -> Self {
+        self.memory_layout = memory_layout;
+        self
+    }
+
+    /// Allocate nodes from a node pool (see [`RcuHt::with_node_pool`]).
+    pub fn node_pool(mut self, pool: RcuNodePoolConfig) -> Self {
+        self.pool = Some(pool);
+        self
+    }
+
+    /// Initial size of the batches of removed objects (see [`crate::RcuHtWriter::set_reclaim_batch_size`]).
+    pub fn reclaim_batch_size(mut self, reclaim_batch_size: usize) -> Self {
+        self.reclaim_batch_size = reclaim_batch_size;
+        self
+    }
+
+    /// Slow writers down when more than `high_water` removed (or replaced) objects wait for
+    /// their release by call_rcu (see [`crate::RcuHt::reclaim_backlog`]).
+    ///
+    /// Without high-water mark, the backlog is unbounded: with a heavy replace churn, memory
+    /// grows as long as the call_rcu worker is slower than writers.
+    pub fn reclaim_high_water(mut self, high_water: usize, backpressure: RcuBackpressure) -> Self {
+        self.reclaim_high_water = Some((high_water, backpressure));
+        self
+    }
+
+    /// Release removed objects of this hashtable with its own call_rcu worker thread
+    /// (lib urcu `create_call_rcu_data`), pinned to `cpu` if any.
+    ///
+    /// By default, callbacks are run by the worker of the writer thread: the per CPU
+    /// worker if any (see [`crate::create_per_cpu_call_rcu_workers`]), or the default worker,
+    /// shared with all hashtables. The worker is stopped when the hashtable is dropped.
+    pub fn call_rcu_worker(mut self, cpu: Option<usize>) -> Self {
+        self.call_rcu_worker = Some(cpu);
+        self
+    }
+
+    /// Use `hash_builder` to hash keys.
+    pub fn hasher<T>(self, hash_builder: T) -> RcuHtBuilder<T, R> {
+        RcuHtBuilder {
+            init_size: self.init_size,
+            min_nr_alloc_buckets: self.min_nr_alloc_buckets,
+            max_nr_buckets: self.max_nr_buckets,
+            auto_resize: self.auto_resize,
+            accounting: self.accounting,
+            memory_layout: self.memory_layout,
+            hash_builder,
+            pool: self.pool,
+            reclaim_batch_size: self.reclaim_batch_size,
+            reclaim_high_water: self.reclaim_high_water,
+            call_rcu_worker: self.call_rcu_worker,
+            _flavor: PhantomData,
+        }
+    }
+
+    /// Use RCU flavor `T` (see [`crate::flavor`]) for this hashtable, instead of [`DefaultFlavor`].
+    ///
+    /// Every thread using the hashtable is registered to this flavor, and its read-side critical
+    /// sections only protect hashtables of the same flavor.
+    pub fn flavor<T: RcuFlavor>(self) -> RcuHtBuilder<S, T> {
+        RcuHtBuilder {
+            init_size: self.init_size,
+            min_nr_alloc_buckets: self.min_nr_alloc_buckets,
+            max_nr_buckets: self.max_nr_buckets,
+            auto_resize: self.auto_resize,
+            accounting: self.accounting,
+            memory_layout: self.memory_layout,
+            hash_builder: self.hash_builder,
+            pool: self.pool,
+            reclaim_batch_size: self.reclaim_batch_size,
+            reclaim_high_water: self.reclaim_high_water,
+            call_rcu_worker: self.call_rcu_worker,
+            _flavor: PhantomData,
+        }
+    }
+
+    /// Allocate the hashtable.
+    pub fn build<K, V>(self) -> Result<RcuHt<K, V, S, R>, RcuError>
+    where
+        K: Hash + Eq,
+        S: BuildHasher,
+        R: RcuFlavor,
+    {
+        // mmap layout reserves memory for the maximum number of buckets
+        if self.memory_layout == RcuHtMemoryLayout::Mmap && self.max_nr_buckets == 0 {
+            return Err(RcuError::InvalidParameters);
+        }
+
+        // initialize global lib if not already done
+        R::init();
+
+        let pool = match self.pool {
+            Some(config) => Some(Box::new(RcuNodePool::new(
+                std::alloc::Layout::new::<RcuLfhtNode<K, V>>(),
+                config,
+            )?)),
+            None => None,
+        };
+
+        let mut flags: i32 = 0;
+        if self.auto_resize {
+            flags |= urcu_sys::CDS_LFHT_AUTO_RESIZE as i32;
+        }
+        if self.accounting {
+            flags |= urcu_sys::CDS_LFHT_ACCOUNTING as i32;
+        }
+
+        unsafe {
+            let urcuht = match self.memory_layout {
+                RcuHtMemoryLayout::Auto => urcu_sys::cds_lfht_new(
+                    self.init_size,
+                    self.min_nr_alloc_buckets,
+                    self.max_nr_buckets,
+                    flags,
+                    std::ptr::null_mut(),
+                ),
+                layout => urcu_sys::_cds_lfht_new(
+                    self.init_size,
+                    self.min_nr_alloc_buckets,
+                    self.max_nr_buckets,
+                    flags,
+                    layout.mm_type(),
+                    R::lfht_flavor(),
+                    std::ptr::null_mut(),
+                ),
+            };
+
+            if urcuht.is_null() {
+                return Err(RcuError::InvalidParameters);
+            }
+
+            let crdp = match self.call_rcu_worker {
+                Some(cpu) => match urcu_create_call_rcu_worker::<R>(cpu) {
+                    Ok(crdp) => crdp,
+                    Err(err) => {
+                        urcu_sys::cds_lfht_destroy(urcuht, std::ptr::null_mut());
+                        return Err(err);
+                    }
+                },
+                None => std::ptr::null_mut(),
+            };
+
+            let mut guard = RcuHtWriterGuard::new();
+            guard.reclaim_batch_size = self.reclaim_batch_size;
+
+            Ok(RcuHt {
+                urcuht,
+                mutex: Mutex::new(guard),
+                hash_builder: self.hash_builder,
+                pool,
+                pending: RcuHtPending::new(),
+                stats: RcuHtStats::new(),
+                reclaim: RcuReclaim::new(
+                    std::mem::size_of::<RcuLfhtNode<K, V>>(),
+                    self.reclaim_high_water,
+                    crdp,
+                ),
+                _flavor: PhantomData,
+            })
+        }
+    }
+
+    /// Allocate the hashtable and fill it with all key/values of `iter`.
+    ///
+    /// No other thread can see the hashtable while it is loaded. See also [`RcuHtBuilder::capacity`].
+    pub fn build_from_iter<K, V, I>(self, iter: I) -> Result<RcuHt<K, V, S, R>, RcuError>
+    where
+        K: Hash + Eq,
+        S: BuildHasher,
+        R: RcuFlavor,
+        I: IntoIterator<Item = (K, V)>,
+    {
+        let ht = self.build()?;
+
+        {
+            let thread = ht.thread();
+            let mut writer = thread.writer();
+            writer.extend(iter);
+        }
+
+        Ok(ht)
+    }
+
+    /// Allocate the hashtable and fill it from many threads: each part is inserted by its own thread,
+    /// using a concurrent writer (see [`crate::RcuHtThread::writer`]).
+    ///
+    /// If the same key is present in many parts, the value kept is unspecified.
+    /// The hashtable is only reachable by readers once all parts are inserted.
+    pub fn build_from_parts<K, V, P, I>(self, parts: P) -> Result<RcuHt<K, V, S, R>, RcuError>
+    where
+        K: Hash + Eq + Send,
+        V: Send,
+        S: BuildHasher + Sync,
+        R: RcuFlavor,
+        P: IntoIterator<Item = I>,
+        I: IntoIterator<Item = (K, V)> + Send,
+    {
+        let ht = self.build()?;
+
+        std::thread::scope(|scope| {
+            for part in parts {
+                let ht = &ht;
+                scope.spawn(move || {
+                    let thread = ht.thread();
+                    let mut writer = thread.writer();
+                    writer.extend(part);
+                });
+            }
+        });
+
+        Ok(ht)
+    }
+}
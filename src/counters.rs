@@ -0,0 +1,201 @@
+//! Counters updated by readers: values of a [`RcuCounterMap`].
+//!
+//! Values returned by lookups are shared references: readers cannot update a plain value, and
+//! replacing it needs a writer. A [`RcuCounters`] value holds `N` atomic counters, striped over
+//! cache-line-aligned slots: each thread adds to the slot it was given (round robin), so readers
+//! of different threads do not write to the same cache line as long as there are less threads
+//! than slots. Reading a counter sums all its slots.
+use std::borrow::Borrow;
+use std::hash::{BuildHasher, Hash};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+
+use crate::{DefaultFlavor, DefaultHashBuilder, RcuFlavor, RcuHt, RcuHtRead};
+
+/// A hashtable whose values are counters updated by readers.
+///
+/// ```
+/// use urcu_ht::{RcuCounterMap, RcuCounters};
+///
+/// // packets and bytes per flow
+/// let flows: RcuCounterMap<u32, 2> = RcuCounterMap::new(64, 64, 0, true).unwrap();
+/// let thread = flows.thread();
+/// thread.writer().insert_unique(1, RcuCounters::new()).ok();
+///
+/// let rdlock = thread.rdlock();
+/// assert!(rdlock.add(&1, 0, 1));
+/// assert!(rdlock.add(&1, 1, 1500));
+/// assert_eq!(rdlock.counters(&1), Some([1, 1500]));
+/// ```
+pub type RcuCounterMap<K, const N: usize, S = DefaultHashBuilder, R = DefaultFlavor> =
+    RcuHt<K, RcuCounters<N>, S, R>;
+
+/// Maximum number of slots of a counter.
+pub const URCU_COUNTER_MAX_SLOTS: usize = 64;
+
+static URCU_COUNTER_NEXT_SLOT: AtomicUsize = AtomicUsize::new(0);
+// default number of slots, computed once (0: not computed yet)
+static URCU_COUNTER_DEFAULT_SLOTS: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+    // slot index of this thread, for all counters (reduced to the number of slots of each counter)
+    static URCU_COUNTER_SLOT: usize = URCU_COUNTER_NEXT_SLOT.fetch_add(1, Ordering::Relaxed);
+}
+
+/// Default number of slots: the number of CPUs, rounded up to a power of two.
+fn urcu_counter_default_slots() -> usize {
+    let slots = URCU_COUNTER_DEFAULT_SLOTS.load(Ordering::Relaxed);
+    if slots != 0 {
+        return slots;
+    }
+
+    let slots = std::thread::available_parallelism()
+        .map_or(1, |n| n.get())
+        .next_power_of_two()
+        .min(URCU_COUNTER_MAX_SLOTS);
+    URCU_COUNTER_DEFAULT_SLOTS.store(slots, Ordering::Relaxed);
+    slots
+}
+
+/// Counters of a group of threads, on their own cache line(s).
+#[repr(align(64))]
+struct RcuCounterSlot<const N: usize>([AtomicU64; N]);
+
+/// `N` counters, updated without lock by any number of threads.
+pub struct RcuCounters<const N: usize> {
+    slots: Box<[RcuCounterSlot<N>]>,
+}
+
+impl<const N: usize> RcuCounters<N> {
+    /// Counters at zero, with one slot per CPU.
+    pub fn new() -> Self {
+        Self::with_slots(urcu_counter_default_slots())
+    }
+
+    /// Counters at zero, with `slots` slots (rounded up to a power of two, at most
+    /// [`URCU_COUNTER_MAX_SLOTS`]). Each slot takes at least a cache line.
+    pub fn with_slots(slots: usize) -> Self {
+        let slots = slots.max(1).next_power_of_two().min(URCU_COUNTER_MAX_SLOTS);
+
+        RcuCounters {
+            slots: (0..slots)
+                .map(|_| RcuCounterSlot(std::array::from_fn(|_| AtomicU64::new(0))))
+                .collect(),
+        }
+    }
+
+    /// Counters starting at `values`, with one slot per CPU like [`RcuCounters::new`].
+    pub fn from_values(values: [u64; N]) -> Self {
+        Self::with_slots_and_values(urcu_counter_default_slots(), values)
+    }
+
+    /// Counters starting at `values`, with `slots` slots like [`RcuCounters::with_slots`].
+    /// Initial values are stored in the first slot.
+    pub fn with_slots_and_values(slots: usize, values: [u64; N]) -> Self {
+        let counters = Self::with_slots(slots);
+        for (counter, value) in counters.slots[0].0.iter().zip(values) {
+            counter.store(value, Ordering::Relaxed);
+        }
+        counters
+    }
+
+    #[inline]
+    fn slot(&self) -> &RcuCounterSlot<N> {
+        let index = URCU_COUNTER_SLOT.with(|slot| *slot) & (self.slots.len() - 1);
+        &self.slots[index]
+    }
+
+    /// Add `delta` to counter `index` (wrapping on overflow). Panics if `index >= N`.
+    #[inline]
+    pub fn add(&self, index: usize, delta: u64) {
+        self.slot().0[index].fetch_add(delta, Ordering::Relaxed);
+    }
+
+    /// Add 1 to counter `index`.
+    #[inline]
+    pub fn incr(&self, index: usize) {
+        self.add(index, 1);
+    }
+
+    /// Value of counter `index`: the sum of all slots.
+    ///
+    /// Slots are read while other threads update them: the result is consistent for each slot,
+    /// not for the whole counter.
+    pub fn get(&self, index: usize) -> u64 {
+        self.slots.iter().fold(0u64, |sum, slot| {
+            sum.wrapping_add(slot.0[index].load(Ordering::Relaxed))
+        })
+    }
+
+    /// Values of all counters.
+    pub fn sum(&self) -> [u64; N] {
+        let mut values = [0u64; N];
+
+        for slot in self.slots.iter() {
+            for (value, counter) in values.iter_mut().zip(slot.0.iter()) {
+                *value = value.wrapping_add(counter.load(Ordering::Relaxed));
+            }
+        }
+
+        values
+    }
+}
+
+impl<const N: usize> Default for RcuCounters<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const N: usize> std::fmt::Debug for RcuCounters<N> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_tuple("RcuCounters").field(&self.sum()).finish()
+    }
+}
+
+impl<'rdlock, 'thread, 'ht, K, const N: usize, S, R>
+    RcuHtRead<'thread, 'ht, K, RcuCounters<N>, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Add `delta` to counter `index` of `key`. Returns false if `key` is not found.
+    ///
+    /// Increments done while the object is replaced by a writer may be lost with the old value.
+    #[inline]
+    pub fn add<Q: ?Sized>(&'rdlock self, key: &Q, index: usize, delta: u64) -> bool
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        match self.get(key) {
+            Some(counters) => {
+                counters.add(index, delta);
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Values of all counters of `key`.
+    pub fn counters<Q: ?Sized>(&'rdlock self, key: &Q) -> Option<[u64; N]>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        self.get(key).map(RcuCounters::sum)
+    }
+
+    /// Sum of the counters of all objects (the read lock is held during the whole iteration).
+    pub fn total(&'rdlock self) -> [u64; N] {
+        let mut total = [0u64; N];
+
+        for (_, counters) in self.iter() {
+            for (total, value) in total.iter_mut().zip(counters.sum()) {
+                *total = total.wrapping_add(value);
+            }
+        }
+
+        total
+    }
+}
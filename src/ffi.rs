@@ -0,0 +1,401 @@
+//! C API (feature `ffi`), declared in `include/urcu_ht.h`.
+//!
+//! Keys and values are byte strings: C sees a [`RcuHtBytes`] hashtable, which Rust code can use
+//! directly, so both sides share the same instance (see [`urcu_ht_from_rust`]). Handles follow
+//! the Rust model: a thread handle per thread, read locks taken from it, and values returned by
+//! lookups valid until the read lock is released.
+//!
+//! Writes either take the write mutex per call ([`urcu_ht_insert`], [`urcu_ht_remove`]), or are
+//! batched under a write lock ([`urcu_ht_wrlock`]): removed objects are then given to call_rcu by
+//! batches, instead of one call_rcu per write.
+//!
+//! Functions returning an `int` return 0 on success, or a negative errno value.
+use std::ffi::c_void;
+
+use crate::{RcuHt, RcuHtRead, RcuHtThread, RcuHtWriter, URCU_BATCH_SIZE};
+
+/// Hashtable shared with C code: byte string keys and values.
+pub type RcuHtBytes = RcuHt<Box<[u8]>, Box<[u8]>>;
+
+/// `urcu_ht` of the C API.
+#[allow(non_camel_case_types)]
+pub type urcu_ht = RcuHtBytes;
+
+/// `urcu_ht_thread` of the C API: a thread handle, not bound to the lifetime of its hashtable
+/// (C code must free it before the hashtable).
+#[allow(non_camel_case_types)]
+pub struct urcu_ht_thread {
+    thread: RcuHtThread<'static, Box<[u8]>, Box<[u8]>>,
+}
+
+/// `urcu_ht_read` of the C API: a read lock, bound to its thread handle by C code.
+#[allow(non_camel_case_types)]
+pub struct urcu_ht_read {
+    rdlock: RcuHtRead<'static, 'static, Box<[u8]>, Box<[u8]>>,
+}
+
+/// `urcu_ht_writer` of the C API: a write lock, bound to its thread handle by C code.
+#[allow(non_camel_case_types)]
+pub struct urcu_ht_writer {
+    writer: RcuHtWriter<'static, 'static, 'static, Box<[u8]>, Box<[u8]>>,
+}
+
+/// Get a hashtable created by Rust code, to give it to C code.
+///
+/// C code must not destroy it, and must free its thread handles before Rust code drops it.
+pub fn urcu_ht_from_rust(ht: &RcuHtBytes) -> *mut urcu_ht {
+    ht as *const RcuHtBytes as *mut urcu_ht
+}
+
+/// A byte string given by C code (`ptr` may be null if `len` is 0).
+unsafe fn urcu_ffi_bytes<'a>(ptr: *const c_void, len: usize) -> &'a [u8] {
+    if len == 0 {
+        &[]
+    } else {
+        std::slice::from_raw_parts(ptr.cast::<u8>(), len)
+    }
+}
+
+/// Allocate a hashtable, see [`RcuHt::new`]. Returns NULL on invalid parameters.
+#[no_mangle]
+pub extern "C" fn urcu_ht_new(
+    init_size: u64,
+    min_nr_alloc_buckets: u64,
+    max_nr_buckets: u64,
+    autoresize: libc::c_int,
+) -> *mut urcu_ht {
+    match RcuHtBytes::new(
+        init_size,
+        min_nr_alloc_buckets,
+        max_nr_buckets,
+        autoresize != 0,
+    ) {
+        Ok(ht) => Box::into_raw(Box::new(ht)),
+        Err(_err) => std::ptr::null_mut(),
+    }
+}
+
+/// Release a hashtable allocated by [`urcu_ht_new`], and all its objects.
+///
+/// # Safety
+///
+/// All thread handles of this hashtable must be freed. NULL is ignored.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_destroy(ht: *mut urcu_ht) {
+    if !ht.is_null() {
+        drop(Box::from_raw(ht));
+    }
+}
+
+/// Get a thread handle (it registers the current thread, see [`RcuHtThread`]).
+///
+/// # Safety
+///
+/// `ht` must be a valid hashtable, which outlives this handle. The handle must stay in this thread.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_thread_new(ht: *mut urcu_ht) -> *mut urcu_ht_thread {
+    Box::into_raw(Box::new(urcu_ht_thread {
+        thread: RcuHtThread::new(&*ht),
+    }))
+}
+
+/// Free a thread handle (the thread is unregistered when its last handle is freed).
+///
+/// # Safety
+///
+/// No read lock of this handle must be alive. NULL is ignored.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_thread_free(thread: *mut urcu_ht_thread) {
+    if !thread.is_null() {
+        drop(Box::from_raw(thread));
+    }
+}
+
+/// Take a read lock (enter a read-side critical section).
+///
+/// # Safety
+///
+/// `thread` must be a valid thread handle of the current thread, which outlives this read lock.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_rdlock(thread: *mut urcu_ht_thread) -> *mut urcu_ht_read {
+    let thread: &'static urcu_ht_thread = &*thread;
+
+    Box::into_raw(Box::new(urcu_ht_read {
+        rdlock: thread.thread.rdlock(),
+    }))
+}
+
+/// Release a read lock: values returned by lookups under this read lock must not be used anymore.
+///
+/// # Safety
+///
+/// `read` must be a read lock of the current thread. NULL is ignored.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_rdunlock(read: *mut urcu_ht_read) {
+    if !read.is_null() {
+        drop(Box::from_raw(read));
+    }
+}
+
+/// Lookup a key. On success, `*value` and `*value_len` describe the value, valid until `read`
+/// is released. Returns -ENOENT if the key is not found.
+///
+/// # Safety
+///
+/// `read` must be a read lock of the current thread, `key` must point to `key_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_get(
+    read: *const urcu_ht_read,
+    key: *const c_void,
+    key_len: usize,
+    value: *mut *const c_void,
+    value_len: *mut usize,
+) -> libc::c_int {
+    match (*read).rdlock.get(urcu_ffi_bytes(key, key_len)) {
+        Some(found) => {
+            *value = found.as_ptr().cast();
+            *value_len = found.len();
+            0
+        }
+        None => -libc::ENOENT,
+    }
+}
+
+/// Lookup `count` keys at once (see [`RcuHtRead::get_many_into`]). `values[i]` is set to NULL if
+/// `keys[i]` is not found. Returns the number of keys found.
+///
+/// # Safety
+///
+/// `read` must be a read lock of the current thread. `keys` and `key_lens` must hold `count`
+/// keys, `values` and `value_lens` must have room for `count` results.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_get_many(
+    read: *const urcu_ht_read,
+    count: usize,
+    keys: *const *const c_void,
+    key_lens: *const usize,
+    values: *mut *const c_void,
+    value_lens: *mut usize,
+) -> usize {
+    if count == 0 {
+        return 0;
+    }
+
+    let rdlock = &(*read).rdlock;
+    let keys = std::slice::from_raw_parts(keys, count);
+    let key_lens = std::slice::from_raw_parts(key_lens, count);
+    let values = std::slice::from_raw_parts_mut(values, count);
+    let value_lens = std::slice::from_raw_parts_mut(value_lens, count);
+    let mut found = 0;
+
+    // keys are converted by groups, to keep hashing and lookups batched without allocation
+    let mut group: [&[u8]; URCU_BATCH_SIZE] = [&[]; URCU_BATCH_SIZE];
+    let mut out = [None; URCU_BATCH_SIZE];
+
+    for (start, keys) in (0..count)
+        .step_by(URCU_BATCH_SIZE)
+        .zip(keys.chunks(URCU_BATCH_SIZE))
+    {
+        let n = keys.len();
+        for (slot, (key, len)) in group.iter_mut().zip(keys.iter().zip(&key_lens[start..])) {
+            *slot = urcu_ffi_bytes(*key, *len);
+        }
+
+        rdlock.get_many_into(&group[..n], &mut out[..n]);
+
+        for (i, result) in out[..n].iter().enumerate() {
+            match result {
+                Some(value) => {
+                    values[start + i] = value.as_ptr().cast();
+                    value_lens[start + i] = value.len();
+                    found += 1;
+                }
+                None => {
+                    values[start + i] = std::ptr::null();
+                    value_lens[start + i] = 0;
+                }
+            }
+        }
+    }
+
+    found
+}
+
+unsafe fn urcu_ffi_insert(
+    writer: &mut RcuHtWriter<'_, '_, '_, Box<[u8]>, Box<[u8]>>,
+    key: *const c_void,
+    key_len: usize,
+    value: *const c_void,
+    value_len: usize,
+) -> libc::c_int {
+    writer.insert_or_replace(
+        urcu_ffi_bytes(key, key_len).into(),
+        urcu_ffi_bytes(value, value_len).into(),
+    );
+    0
+}
+
+unsafe fn urcu_ffi_insert_unique(
+    writer: &mut RcuHtWriter<'_, '_, '_, Box<[u8]>, Box<[u8]>>,
+    key: *const c_void,
+    key_len: usize,
+    value: *const c_void,
+    value_len: usize,
+) -> libc::c_int {
+    match writer.insert_unique(
+        urcu_ffi_bytes(key, key_len).into(),
+        urcu_ffi_bytes(value, value_len).into(),
+    ) {
+        Ok(()) => 0,
+        Err(_existing) => -libc::EEXIST,
+    }
+}
+
+unsafe fn urcu_ffi_remove(
+    writer: &mut RcuHtWriter<'_, '_, '_, Box<[u8]>, Box<[u8]>>,
+    key: *const c_void,
+    key_len: usize,
+) -> libc::c_int {
+    match writer.remove(urcu_ffi_bytes(key, key_len)) {
+        Ok(()) => 0,
+        Err(_err) => -libc::ENOENT,
+    }
+}
+
+/// Insert an object, or replace the value of an existing key (under the write mutex).
+/// Key and value are copied. Returns -EINVAL if the write mutex is poisoned.
+///
+/// The write mutex is taken and released by each call, and the replaced object (if any) is given
+/// to call_rcu right away: see [`urcu_ht_wrlock`] to batch many writes.
+///
+/// # Safety
+///
+/// `thread` must be a thread handle of the current thread, `key` and `value` must point to
+/// `key_len` and `value_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_insert(
+    thread: *mut urcu_ht_thread,
+    key: *const c_void,
+    key_len: usize,
+    value: *const c_void,
+    value_len: usize,
+) -> libc::c_int {
+    match (*thread).thread.wrlock() {
+        Some(mut writer) => urcu_ffi_insert(&mut writer, key, key_len, value, value_len),
+        None => -libc::EINVAL,
+    }
+}
+
+/// Same as [`urcu_ht_insert`], but returns -EEXIST (without replacing it) if the key is present.
+///
+/// # Safety
+///
+/// Same as [`urcu_ht_insert`].
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_insert_unique(
+    thread: *mut urcu_ht_thread,
+    key: *const c_void,
+    key_len: usize,
+    value: *const c_void,
+    value_len: usize,
+) -> libc::c_int {
+    match (*thread).thread.wrlock() {
+        Some(mut writer) => urcu_ffi_insert_unique(&mut writer, key, key_len, value, value_len),
+        None => -libc::EINVAL,
+    }
+}
+
+/// Remove an object (under the write mutex). It is released after a grace period.
+/// Returns -ENOENT if the key is not found.
+///
+/// Like [`urcu_ht_insert`], each call takes the write mutex and calls call_rcu.
+///
+/// # Safety
+///
+/// `thread` must be a thread handle of the current thread, `key` must point to `key_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_remove(
+    thread: *mut urcu_ht_thread,
+    key: *const c_void,
+    key_len: usize,
+) -> libc::c_int {
+    match (*thread).thread.wrlock() {
+        Some(mut writer) => urcu_ffi_remove(&mut writer, key, key_len),
+        None => -libc::EINVAL,
+    }
+}
+
+/// Take the write mutex, for a batch of writes (see [`RcuHtThread::wrlock`]).
+/// Returns NULL if the write mutex is poisoned.
+///
+/// # Safety
+///
+/// `thread` must be a valid thread handle of the current thread, which outlives this write lock.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_wrlock(thread: *mut urcu_ht_thread) -> *mut urcu_ht_writer {
+    let thread: &'static urcu_ht_thread = &*thread;
+
+    match thread.thread.wrlock() {
+        Some(writer) => Box::into_raw(Box::new(urcu_ht_writer { writer })),
+        None => std::ptr::null_mut(),
+    }
+}
+
+/// Release a write lock: objects removed or replaced under it are given to call_rcu.
+///
+/// # Safety
+///
+/// `writer` must be a write lock of the current thread. NULL is ignored.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_wrunlock(writer: *mut urcu_ht_writer) {
+    if !writer.is_null() {
+        drop(Box::from_raw(writer));
+    }
+}
+
+/// Same as [`urcu_ht_insert`], under a write lock taken by [`urcu_ht_wrlock`].
+///
+/// # Safety
+///
+/// `writer` must be a write lock of the current thread, `key` and `value` must point to
+/// `key_len` and `value_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_writer_insert(
+    writer: *mut urcu_ht_writer,
+    key: *const c_void,
+    key_len: usize,
+    value: *const c_void,
+    value_len: usize,
+) -> libc::c_int {
+    urcu_ffi_insert(&mut (*writer).writer, key, key_len, value, value_len)
+}
+
+/// Same as [`urcu_ht_insert_unique`], under a write lock taken by [`urcu_ht_wrlock`].
+///
+/// # Safety
+///
+/// Same as [`urcu_ht_writer_insert`].
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_writer_insert_unique(
+    writer: *mut urcu_ht_writer,
+    key: *const c_void,
+    key_len: usize,
+    value: *const c_void,
+    value_len: usize,
+) -> libc::c_int {
+    urcu_ffi_insert_unique(&mut (*writer).writer, key, key_len, value, value_len)
+}
+
+/// Same as [`urcu_ht_remove`], under a write lock taken by [`urcu_ht_wrlock`].
+///
+/// # Safety
+///
+/// `writer` must be a write lock of the current thread, `key` must point to `key_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn urcu_ht_writer_remove(
+    writer: *mut urcu_ht_writer,
+    key: *const c_void,
+    key_len: usize,
+) -> libc::c_int {
+    urcu_ffi_remove(&mut (*writer).writer, key, key_len)
+}
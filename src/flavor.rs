@@ -0,0 +1,313 @@
+//! RCU flavors.
+//!
+//! lib urcu provides several implementations of RCU ("flavors"), with different read-side costs
+//! and constraints. The flavor is selected by a cargo feature, which selects the matching urcu-sys
+//! flavor: its functions keep the lib urcu names (`rcu_read_lock`, `call_rcu`...), so a program
+//! links a single flavor. Hashtables still take it as a type parameter ([`DefaultFlavor`]).
+//!
+//! - [`Memb`]: memory barriers on the read side, only when a grace period is in progress (sys_membarrier).
+//! - [`Qsbr`]: read locks do nothing, but reader threads must announce quiescent states.
+use std::cell::Cell;
+use std::thread::LocalKey;
+
+/// An RCU flavor of lib urcu.
+///
+/// # Safety
+///
+/// All functions must map to the same lib urcu flavor, and `lfht_flavor` must be the
+/// `rcu_flavor_struct` of this flavor: hashtables created with an explicit memory layout use it
+/// to wait for grace periods.
+pub unsafe trait RcuFlavor: 'static {
+    /// lib urcu flavor description, given to `_cds_lfht_new` (see [`crate::RcuHtMemoryLayout`]).
+    fn lfht_flavor() -> *const urcu_sys::rcu_flavor_struct;
+
+    /// Initialize the library, if needed. Called before a hashtable of this flavor is created.
+    fn init() {}
+
+    /// Per thread counter of handles of this flavor: the thread is registered by the first one.
+    fn registration_count() -> &'static LocalKey<Cell<u32>>;
+
+    unsafe fn register_thread();
+    unsafe fn unregister_thread();
+    unsafe fn read_lock();
+    unsafe fn read_unlock();
+
+    /// Returns true if the current thread is inside a read-side critical section.
+    fn read_ongoing() -> bool;
+
+    /// Mark the current thread offline: grace periods do not wait for it until it is online again.
+    /// Returns false if it was already offline.
+    ///
+    /// Only qsbr readers delay grace periods outside read-side critical sections: other flavors do nothing.
+    unsafe fn thread_offline() -> bool {
+        true
+    }
+
+    /// Mark the current thread online again, after [`RcuFlavor::thread_offline`] returned true.
+    unsafe fn thread_online() {}
+
+    unsafe fn call_rcu(
+        head: *mut urcu_sys::rcu_head,
+        func: unsafe extern "C" fn(head: *mut urcu_sys::rcu_head),
+    );
+    unsafe fn synchronize_rcu();
+    unsafe fn barrier();
+
+    /// Start a call_rcu worker thread (pinned to `cpu_affinity`, or not pinned if -1).
+    unsafe fn create_call_rcu_data(
+        flags: libc::c_ulong,
+        cpu_affinity: libc::c_int,
+    ) -> *mut urcu_sys::call_rcu_data;
+    unsafe fn call_rcu_data_free(crdp: *mut urcu_sys::call_rcu_data);
+    /// call_rcu worker used by the current thread (null: per CPU or default worker).
+    unsafe fn get_thread_call_rcu_data() -> *mut urcu_sys::call_rcu_data;
+    unsafe fn set_thread_call_rcu_data(crdp: *mut urcu_sys::call_rcu_data);
+    /// Start one call_rcu worker thread per CPU, pinned to its CPU.
+    unsafe fn create_all_cpu_call_rcu_data(flags: libc::c_ulong) -> libc::c_int;
+}
+
+/// lib urcu "memb" flavor (liburcu-memb).
+#[cfg(feature = "memb")]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Memb;
+
+#[cfg(feature = "memb")]
+thread_local! {
+    static URCU_MEMB_REGISTERED_COUNT: Cell<u32> = Cell::new(0);
+}
+
+#[cfg(feature = "memb")]
+unsafe impl RcuFlavor for Memb {
+    fn lfht_flavor() -> *const urcu_sys::rcu_flavor_struct {
+        std::ptr::addr_of!(urcu_sys::urcu_memb_flavor)
+    }
+
+    fn init() {
+        // global flag to know if we need to initialize urcu library (calling rcu_init)
+        static URCU_LIB_INITIALIZED: std::sync::Once = std::sync::Once::new();
+        URCU_LIB_INITIALIZED.call_once(|| unsafe {
+            urcu_sys::rcu_init();
+        });
+    }
+
+    fn registration_count() -> &'static LocalKey<Cell<u32>> {
+        &URCU_MEMB_REGISTERED_COUNT
+    }
+
+    unsafe fn register_thread() {
+        urcu_sys::rcu_register_thread();
+    }
+
+    unsafe fn unregister_thread() {
+        urcu_sys::rcu_unregister_thread();
+    }
+
+    unsafe fn read_lock() {
+        urcu_sys::rcu_read_lock();
+    }
+
+    unsafe fn read_unlock() {
+        urcu_sys::rcu_read_unlock();
+    }
+
+    fn read_ongoing() -> bool {
+        unsafe { urcu_sys::rcu_read_ongoing() != 0 }
+    }
+
+    unsafe fn call_rcu(
+        head: *mut urcu_sys::rcu_head,
+        func: unsafe extern "C" fn(head: *mut urcu_sys::rcu_head),
+    ) {
+        urcu_sys::call_rcu(head, Some(func));
+    }
+
+    unsafe fn synchronize_rcu() {
+        urcu_sys::synchronize_rcu();
+    }
+
+    unsafe fn barrier() {
+        urcu_sys::rcu_barrier();
+    }
+
+    unsafe fn create_call_rcu_data(
+        flags: libc::c_ulong,
+        cpu_affinity: libc::c_int,
+    ) -> *mut urcu_sys::call_rcu_data {
+        urcu_sys::create_call_rcu_data(flags, cpu_affinity)
+    }
+
+    unsafe fn call_rcu_data_free(crdp: *mut urcu_sys::call_rcu_data) {
+        urcu_sys::call_rcu_data_free(crdp);
+    }
+
+    unsafe fn get_thread_call_rcu_data() -> *mut urcu_sys::call_rcu_data {
+        urcu_sys::get_thread_call_rcu_data()
+    }
+
+    unsafe fn set_thread_call_rcu_data(crdp: *mut urcu_sys::call_rcu_data) {
+        urcu_sys::set_thread_call_rcu_data(crdp);
+    }
+
+    unsafe fn create_all_cpu_call_rcu_data(flags: libc::c_ulong) -> libc::c_int {
+        urcu_sys::create_all_cpu_call_rcu_data(flags)
+    }
+}
+
+/// lib urcu "qsbr" flavor (liburcu-qsbr).
+///
+/// Read locks do nothing in lib urcu: read-side critical sections are tracked here, so a thread
+/// cannot announce a quiescent state (or go offline) while it still holds references.
+#[cfg(feature = "qsbr")]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Qsbr;
+
+#[cfg(feature = "qsbr")]
+thread_local! {
+    static URCU_QSBR_REGISTERED_COUNT: Cell<u32> = Cell::new(0);
+    static URCU_QSBR_READ_DEPTH: Cell<u32> = Cell::new(0);
+    static URCU_QSBR_THREAD_OFFLINE: Cell<bool> = Cell::new(false);
+}
+
+#[cfg(feature = "qsbr")]
+unsafe impl RcuFlavor for Qsbr {
+    fn lfht_flavor() -> *const urcu_sys::rcu_flavor_struct {
+        std::ptr::addr_of!(urcu_sys::urcu_qsbr_flavor)
+    }
+
+    fn registration_count() -> &'static LocalKey<Cell<u32>> {
+        &URCU_QSBR_REGISTERED_COUNT
+    }
+
+    unsafe fn register_thread() {
+        // a registered thread is online
+        URCU_QSBR_THREAD_OFFLINE.with(|offline| offline.set(false));
+        urcu_sys::rcu_register_thread();
+    }
+
+    unsafe fn unregister_thread() {
+        urcu_sys::rcu_unregister_thread();
+    }
+
+    unsafe fn read_lock() {
+        assert!(
+            !URCU_QSBR_THREAD_OFFLINE.with(Cell::get),
+            "read lock taken by an offline thread"
+        );
+        URCU_QSBR_READ_DEPTH.with(|depth| depth.set(depth.get() + 1));
+    }
+
+    unsafe fn read_unlock() {
+        URCU_QSBR_READ_DEPTH.with(|depth| depth.set(depth.get() - 1));
+    }
+
+    fn read_ongoing() -> bool {
+        // lib urcu rcu_read_ongoing() returns true as long as the thread is online
+        URCU_QSBR_READ_DEPTH.with(Cell::get) != 0
+    }
+
+    unsafe fn thread_offline() -> bool {
+        if URCU_QSBR_THREAD_OFFLINE.with(Cell::get) {
+            return false;
+        }
+
+        Qsbr::thread_offline();
+        true
+    }
+
+    unsafe fn thread_online() {
+        Qsbr::thread_online();
+    }
+
+    unsafe fn call_rcu(
+        head: *mut urcu_sys::rcu_head,
+        func: unsafe extern "C" fn(head: *mut urcu_sys::rcu_head),
+    ) {
+        urcu_sys::call_rcu(head, Some(func));
+    }
+
+    unsafe fn synchronize_rcu() {
+        urcu_sys::synchronize_rcu();
+    }
+
+    unsafe fn barrier() {
+        urcu_sys::rcu_barrier();
+    }
+
+    unsafe fn create_call_rcu_data(
+        flags: libc::c_ulong,
+        cpu_affinity: libc::c_int,
+    ) -> *mut urcu_sys::call_rcu_data {
+        urcu_sys::create_call_rcu_data(flags, cpu_affinity)
+    }
+
+    unsafe fn call_rcu_data_free(crdp: *mut urcu_sys::call_rcu_data) {
+        urcu_sys::call_rcu_data_free(crdp);
+    }
+
+    unsafe fn get_thread_call_rcu_data() -> *mut urcu_sys::call_rcu_data {
+        urcu_sys::get_thread_call_rcu_data()
+    }
+
+    unsafe fn set_thread_call_rcu_data(crdp: *mut urcu_sys::call_rcu_data) {
+        urcu_sys::set_thread_call_rcu_data(crdp);
+    }
+
+    unsafe fn create_all_cpu_call_rcu_data(flags: libc::c_ulong) -> libc::c_int {
+        urcu_sys::create_all_cpu_call_rcu_data(flags)
+    }
+}
+
+#[cfg(feature = "qsbr")]
+impl Qsbr {
+    /// Announce a quiescent state. Panics inside a read-side critical section.
+    pub(crate) fn quiescent_state() {
+        assert!(
+            !Self::read_ongoing(),
+            "quiescent state inside a read-side critical section"
+        );
+
+        unsafe {
+            urcu_sys::rcu_quiescent_state();
+        }
+    }
+
+    /// Mark the current thread offline. Panics inside a read-side critical section.
+    pub(crate) fn thread_offline() {
+        assert!(
+            !Self::read_ongoing(),
+            "thread offline inside a read-side critical section"
+        );
+
+        URCU_QSBR_THREAD_OFFLINE.with(|offline| offline.set(true));
+        unsafe {
+            urcu_sys::rcu_thread_offline();
+        }
+    }
+
+    /// Mark the current thread online.
+    pub(crate) fn thread_online() {
+        unsafe {
+            urcu_sys::rcu_thread_online();
+        }
+        URCU_QSBR_THREAD_OFFLINE.with(|offline| offline.set(false));
+    }
+}
+
+/// Flavor of hashtables created without [`crate::RcuHtBuilder::flavor`].
+#[cfg(feature = "memb")]
+pub type DefaultFlavor = Memb;
+/// Flavor of hashtables created without [`crate::RcuHtBuilder::flavor`].
+#[cfg(all(not(feature = "memb"), feature = "qsbr"))]
+pub type DefaultFlavor = Qsbr;
+
+// both flavors use the same (unprefixed) urcu-sys functions: only one lib urcu is linked
+#[cfg(all(feature = "memb", feature = "qsbr"))]
+compile_error!(
+    "features memb and qsbr cannot be enabled together (use default-features = false for qsbr)"
+);
+
+#[cfg(not(any(feature = "memb", feature = "qsbr")))]
+// default features enable memb: only reached when all flavors are disabled explicitly
+compile_error!(
+    "an urcu flavor feature must be enabled with default-features = false: memb or qsbr"
+);
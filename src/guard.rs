@@ -0,0 +1,155 @@
+//! Thread registration and read locks independent of any hashtable.
+//!
+//! [`crate::RcuHtThread`] and [`crate::RcuHtRead`] are bound to a single hashtable: a thread
+//! reading many hashtables needs one handle per hashtable, and pays one read lock / unlock per
+//! hashtable. An [`RcuThreadGuard`] registers the current thread once (usually for its whole life),
+//! and a single [`RcuReadGuard`] covers lookups in every hashtable of the same flavor.
+use std::borrow::Borrow;
+use std::hash::{BuildHasher, Hash};
+use std::marker::PhantomData;
+
+use crate::{
+    urcu_cds_lfht_node_to_rust_type, urcu_get_node_with_hash, urcu_key_hash, urcu_thread_register,
+    urcu_thread_unregister, DefaultFlavor, RcuFlavor, RcuHt, RcuOfflineSection, RcuReadSection,
+};
+
+/// Registration of the current thread in urcu lib, for all hashtables of flavor `R`.
+///
+/// It must stick to a single thread, so it is neither Send nor Sync.
+/// While it is alive, creating and dropping [`crate::RcuHtThread`] handles is cheap: the thread is
+/// already registered.
+///
+/// ```
+/// use urcu_ht::{RcuHt, RcuThreadGuard};
+///
+/// let users = RcuHt::<u32, &str>::new(64, 64, 0, true).unwrap();
+/// let groups = RcuHt::<&str, u32>::new(64, 64, 0, true).unwrap();
+/// users.thread().wrlock().unwrap().insert_or_replace(1, "root");
+/// groups.thread().wrlock().unwrap().insert_or_replace("root", 0);
+///
+/// let guard = RcuThreadGuard::new();
+/// let read = guard.rdlock();
+/// let name = read.get(&users, &1).unwrap();
+/// assert_eq!(read.get(&groups, name), Some(&0));
+/// ```
+pub struct RcuThreadGuard<R: RcuFlavor = DefaultFlavor> {
+    _not_send: PhantomData<(*const (), R)>,
+}
+
+impl RcuThreadGuard<DefaultFlavor> {
+    /// Register the current thread for hashtables of the default flavor.
+    pub fn new() -> Self {
+        Self::with_flavor()
+    }
+}
+
+impl Default for RcuThreadGuard<DefaultFlavor> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<R: RcuFlavor> RcuThreadGuard<R> {
+    /// Register the current thread for hashtables of flavor `R`.
+    pub fn with_flavor() -> Self {
+        urcu_thread_register::<R>();
+
+        RcuThreadGuard {
+            _not_send: PhantomData,
+        }
+    }
+
+    /// Take a read lock, valid for all hashtables of flavor `R`.
+    pub fn rdlock(&self) -> RcuReadGuard<'_, R> {
+        RcuReadGuard {
+            _rcu: RcuReadSection::new(),
+            _thread: PhantomData,
+        }
+    }
+
+    /// Run `f` with this thread offline (see [`crate::RcuHtThread::offline`]).
+    pub fn offline<F, T>(&mut self, f: F) -> T
+    where
+        F: FnOnce() -> T,
+    {
+        let _offline = RcuOfflineSection::<R>::new();
+        f()
+    }
+}
+
+#[cfg(feature = "qsbr")]
+impl RcuThreadGuard<crate::flavor::Qsbr> {
+    /// Announce a quiescent state (see [`crate::RcuHtThread::quiescent_state`]).
+    pub fn quiescent_state(&mut self) {
+        crate::flavor::Qsbr::quiescent_state();
+    }
+
+    /// Mark this thread offline (see [`crate::RcuHtThread::thread_offline`]).
+    pub fn thread_offline(&mut self) {
+        crate::flavor::Qsbr::thread_offline();
+    }
+
+    /// Mark this thread online again (see [`crate::RcuHtThread::thread_online`]).
+    pub fn thread_online(&mut self) {
+        crate::flavor::Qsbr::thread_online();
+    }
+}
+
+impl<R: RcuFlavor> Drop for RcuThreadGuard<R> {
+    fn drop(&mut self) {
+        urcu_thread_unregister::<R>();
+    }
+}
+
+/// A single read-side critical section, covering lookups in any hashtable of flavor `R`.
+///
+/// References returned by lookups are valid as long as both this guard and the hashtable are alive.
+pub struct RcuReadGuard<'thread, R: RcuFlavor = DefaultFlavor> {
+    _rcu: RcuReadSection<R>,
+    _thread: PhantomData<&'thread RcuThreadGuard<R>>,
+}
+
+impl<'thread, R: RcuFlavor> RcuReadGuard<'thread, R> {
+    /// Get a reference to the value of a key in `ht`.
+    pub fn get<'a, K, V, S, Q: ?Sized>(
+        &'a self,
+        ht: &'a RcuHt<K, V, S, R>,
+        key: &Q,
+    ) -> Option<&'a V>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+        S: BuildHasher,
+    {
+        self.get_with_hash(ht, urcu_key_hash(&ht.hash_builder, key), key)
+    }
+
+    /// Same as [`RcuReadGuard::get`], using a hash value already computed by the caller
+    /// (see [`crate::RcuHtRead::get_with_hash`]).
+    pub fn get_with_hash<'a, K, V, S, Q: ?Sized>(
+        &'a self,
+        ht: &'a RcuHt<K, V, S, R>,
+        hash: u64,
+        key: &Q,
+    ) -> Option<&'a V>
+    where
+        K: Borrow<Q>,
+        Q: Eq,
+    {
+        let timer = ht.stats.lookup_start();
+
+        let ret = unsafe {
+            let found_node = urcu_get_node_with_hash::<Q, K, V>(ht.urcuht, hash, key);
+
+            if found_node.is_null() {
+                None
+            } else {
+                let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+                Some(&(*node).data)
+            }
+        };
+
+        ht.stats.lookup_end(timer, ret.is_some());
+        ret
+    }
+}
@@ -0,0 +1,245 @@
+//! Read-side iteration over a hashtable.
+//!
+//! lib urcu hashtable is a split-ordered list: iterating with cds_lfht_first / cds_lfht_next visits
+//! objects by ascending "reverse hash" (the bits of the hash value in reverse order).
+//! This is what makes resumable and partitioned scans possible: a range of reverse hash values
+//! is a contiguous part of the list.
+use std::hash::{BuildHasher, Hash};
+use std::marker::PhantomData;
+
+use crate::{urcu_cds_lfht_node_to_rust_type, urcu_lookup, RcuFlavor, RcuHtRead, RcuLfhtNode};
+
+/// Iterator over all objects of a hashtable, returned by [`RcuHtRead::iter`].
+///
+/// Objects added or removed during the iteration may be visited or not.
+pub struct RcuHtIter<'rdlock, K, V> {
+    urcuht: *mut urcu_sys::cds_lfht,
+    iter: urcu_sys::cds_lfht_iter,
+    // references returned cannot outlive the read lock
+    _rdlock: PhantomData<&'rdlock (K, V)>,
+}
+
+impl<'rdlock, K: 'rdlock, V: 'rdlock> Iterator for RcuHtIter<'rdlock, K, V> {
+    type Item = (&'rdlock K, &'rdlock V);
+
+    fn next(&mut self) -> Option<Self::Item> {
+        unsafe {
+            let found_node = urcu_sys::cds_lfht_iter_get_node(&mut self.iter);
+            if found_node.is_null() {
+                return None;
+            }
+
+            urcu_sys::cds_lfht_next(self.urcuht, &mut self.iter);
+
+            let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+            Some((&(*node).key, &(*node).data))
+        }
+    }
+}
+
+/// Position of a resumable scan over (a part of) a hashtable. See [`RcuHtRead::scan`].
+///
+/// A cursor can be used with successive read locks: the read lock can be released between two
+/// chunks of a long scan, so grace periods are not delayed.
+/// Objects added or removed while the scan is in progress may be visited or not.
+#[derive(Clone, Debug)]
+pub struct RcuHtCursor<K> {
+    /// first reverse hash value of this part of the hashtable
+    start: u64,
+    /// last reverse hash value of this part of the hashtable
+    pub(crate) end: u64,
+    /// reverse hash and key of the last object visited
+    pub(crate) last: Option<(u64, K)>,
+    /// reverse hash and key of the last object walked through to find the position again
+    walk: Option<(u64, K)>,
+    pub(crate) done: bool,
+}
+
+impl<K> RcuHtCursor<K> {
+    /// A cursor to scan the whole hashtable.
+    pub fn new() -> Self {
+        Self::partition(0, 1)
+    }
+
+    /// A cursor to scan part `index` of the hashtable split into `count` parts of equal hash range.
+    ///
+    /// Each part can be scanned by a different thread, but this does not scale: objects before a
+    /// part are still walked through (without being visited) to reach that part, because the
+    /// hashtable does not provide a way to jump directly in the middle of the list. The walk to part
+    /// `index` costs about `index * n / count` objects, so all parts cost about `n * count / 2`.
+    /// This walk is counted in the objects of each [`RcuHtRead::scan`] chunk.
+    pub fn partition(index: usize, count: usize) -> Self {
+        assert!(index < count, "partition index out of range");
+
+        let bound = |i: usize| ((i as u128) << 64) / count as u128;
+        let end = if index + 1 == count {
+            u64::MAX
+        } else {
+            (bound(index + 1) - 1) as u64
+        };
+
+        RcuHtCursor {
+            start: bound(index) as u64,
+            end,
+            last: None,
+            walk: None,
+            done: false,
+        }
+    }
+
+    /// Returns true when all objects of this part of the hashtable were visited.
+    pub fn is_done(&self) -> bool {
+        self.done
+    }
+}
+
+impl<K> Default for RcuHtCursor<K> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Get the reverse hash of a node. Node flags are stored in the next pointer, not in reverse_hash.
+pub(crate) unsafe fn urcu_node_reverse_hash(node: *mut urcu_sys::cds_lfht_node) -> u64 {
+    (*node).reverse_hash as u64
+}
+
+impl<'rdlock, 'thread, 'ht, K, V, S, R> RcuHtRead<'thread, 'ht, K, V, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Iterate over all objects of the hashtable (cds_lfht_first / cds_lfht_next).
+    ///
+    /// The read lock is held during the whole iteration: for very large hashtables,
+    /// see [`RcuHtRead::scan`] to split it in smaller chunks.
+    pub fn iter(&'rdlock self) -> RcuHtIter<'rdlock, K, V> {
+        unsafe {
+            let mut iter: urcu_sys::cds_lfht_iter = std::mem::zeroed();
+            urcu_sys::cds_lfht_first(self.urcuht, &mut iter);
+
+            RcuHtIter {
+                urcuht: self.urcuht,
+                iter,
+                _rdlock: PhantomData,
+            }
+        }
+    }
+
+    /// Visit at most `max` objects, starting at `cursor` position, and move the cursor after them.
+    ///
+    /// Returns the number of objects visited (it can be 0 before the end of the scan). Once the
+    /// whole range of the cursor is visited, [`RcuHtCursor::is_done`] returns true.
+    ///
+    /// The cursor remembers the last key visited: the next chunk restarts right after this key,
+    /// even with a different read lock. If this key was removed in the meantime (or for the first
+    /// chunk of a partition), the hashtable is walked from its beginning to find the position again,
+    /// and objects sharing the hash value of the removed key may be visited twice. Objects walked
+    /// through are counted in `max`: a long walk continues with the next chunks.
+    pub fn scan<F>(&'rdlock self, cursor: &mut RcuHtCursor<K>, max: usize, mut f: F) -> usize
+    where
+        K: Clone,
+        F: FnMut(&'rdlock K, &'rdlock V),
+    {
+        if cursor.done || max == 0 {
+            return 0;
+        }
+
+        let mut count = 0;
+        let mut last_node: *mut RcuLfhtNode<K, V> = std::ptr::null_mut();
+
+        unsafe {
+            let mut budget = max;
+            let mut iter = match urcu_scan_position::<K, V>(self.urcuht, cursor, &mut budget) {
+                Some(iter) => iter,
+                None => return 0,
+            };
+
+            loop {
+                let found_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+                if found_node.is_null() || urcu_node_reverse_hash(found_node) > cursor.end {
+                    cursor.done = true;
+                    break;
+                }
+
+                if count == budget {
+                    break;
+                }
+
+                let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+                f(&(*node).key, &(*node).data);
+
+                count += 1;
+                last_node = node;
+
+                urcu_sys::cds_lfht_next(self.urcuht, &mut iter);
+            }
+
+            // only the last key of a chunk is kept
+            if !last_node.is_null() {
+                let reverse_hash = urcu_node_reverse_hash(&mut (*last_node).node);
+                cursor.last = Some((reverse_hash, (*last_node).key.clone()));
+            }
+        }
+
+        count
+    }
+}
+
+/// Get an iterator on the first object not visited yet by `cursor`.
+/// Must be called with the read lock held.
+///
+/// At most `budget` objects are walked through to find it (the budget is decreased by the number
+/// of objects walked): if the budget runs out, the cursor remembers where the walk stopped, and
+/// `None` is returned. The next call continues the walk from there (or from the beginning of the
+/// hashtable again, if this object was removed too).
+pub(crate) unsafe fn urcu_scan_position<K: Eq + Clone, V>(
+    urcuht: *mut urcu_sys::cds_lfht,
+    cursor: &mut RcuHtCursor<K>,
+    budget: &mut usize,
+) -> Option<urcu_sys::cds_lfht_iter> {
+    let skip_below = match &cursor.last {
+        Some((reverse_hash, key)) => {
+            // jump directly after the last key visited, if still present
+            let mut iter = urcu_lookup::<K, K, V>(urcuht, reverse_hash.reverse_bits(), key);
+
+            if !urcu_sys::cds_lfht_iter_get_node(&mut iter).is_null() {
+                urcu_sys::cds_lfht_next(urcuht, &mut iter);
+                cursor.walk = None;
+                return Some(iter);
+            }
+
+            *reverse_hash
+        }
+        None => cursor.start,
+    };
+
+    // continue an interrupted walk, if its last object is still present
+    let mut iter = match &cursor.walk {
+        Some((reverse_hash, key)) => {
+            urcu_lookup::<K, K, V>(urcuht, reverse_hash.reverse_bits(), key)
+        }
+        None => std::mem::zeroed(),
+    };
+    if urcu_sys::cds_lfht_iter_get_node(&mut iter).is_null() {
+        urcu_sys::cds_lfht_first(urcuht, &mut iter);
+    }
+
+    loop {
+        let found_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+        if found_node.is_null() || urcu_node_reverse_hash(found_node) >= skip_below {
+            cursor.walk = None;
+            return Some(iter);
+        }
+
+        if *budget == 0 {
+            let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+            cursor.walk = Some((urcu_node_reverse_hash(found_node), (*node).key.clone()));
+            return None;
+        }
+        *budget -= 1;
+
+        urcu_sys::cds_lfht_next(urcuht, &mut iter);
+    }
+}
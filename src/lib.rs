@@ -2,11 +2,13 @@
 //! Userspace RCU is a data synchronization library providing read-side access which scales linearly with the number of cores.
 //! urcu-ht aims to provide a safe wrapper of liburcu.
 //!
-//! The default hashing algorithm is currently [wyhash].
+//! The default hashing algorithm is currently [wyhash], with a fixed seed.
 //! There is currently no work done to protected it against HashDos.
+//! Another hashing algorithm (or a randomly seeded one) can be used with [`RcuHt::with_hasher`].
 //!
 //! Thanks to this implementation, there is no rwlock or mutex in reader threads.
 //! For writer thread, we still need a lock to protect against concurrent insert or remove.
+//! Writers which do not need a sequence of operations to be atomic can also skip this lock (concurrent writers).
 //!
 //! [liburcu]: http://liburcu.org/
 //! [wyhash]: https://docs.rs/wyhash/0.5.0/wyhash/
@@ -50,13 +52,55 @@
 //! child.join().expect("cannot join thread");
 //! ```
 use std::borrow::Borrow;
-use std::cell::Cell;
-use std::hash::{Hash, Hasher};
+use std::hash::{BuildHasher, Hash, Hasher};
 use std::marker::PhantomData;
-#[cfg(feature = "memb")]
-use std::sync::Once;
 use std::sync::{Mutex, MutexGuard};
 
+mod arc;
+mod builder;
+mod counters;
+#[cfg(feature = "ffi")]
+pub mod ffi;
+pub mod flavor;
+mod guard;
+mod iter;
+mod ordered;
+mod pending;
+mod pool;
+mod reclaim;
+mod replicated;
+mod sharded;
+#[cfg(unix)]
+mod snapshot;
+mod stats;
+mod ttl;
+
+pub use arc::RcuArcHt;
+pub use builder::{RcuHtBuilder, RcuHtMemoryLayout};
+pub use counters::{RcuCounterMap, RcuCounters, URCU_COUNTER_MAX_SLOTS};
+pub use flavor::{DefaultFlavor, RcuFlavor};
+pub use guard::{RcuReadGuard, RcuThreadGuard};
+pub use iter::{RcuHtCursor, RcuHtIter};
+pub use ordered::{
+    RcuOrderedMap, RcuOrderedMapRange, RcuOrderedMapRead, RcuOrderedMapThread, RcuOrderedMapWriter,
+};
+pub use pending::RcuHtOp;
+use pending::RcuHtPending;
+use pool::RcuNodePool;
+pub use pool::RcuNodePoolConfig;
+use reclaim::RcuReclaim;
+pub use reclaim::{create_per_cpu_call_rcu_workers, RcuBackpressure, RcuReclaimBacklog};
+pub use replicated::{ReplicatedRcuHt, ReplicatedRcuHtThread, ReplicatedRcuHtWriter};
+pub use sharded::{
+    ShardedRcuHt, ShardedRcuHtRead, ShardedRcuHtShardWriter, ShardedRcuHtThread, ShardedRcuHtWriter,
+};
+#[cfg(unix)]
+pub use snapshot::RcuSnapshotPod;
+use stats::RcuHtStats;
+#[cfg(feature = "stats")]
+pub use stats::{RcuHtStatsSnapshot, URCU_STATS_LATENCY_BUCKETS};
+pub use ttl::{RcuTtl, RcuTtlClock, RcuTtlSweeper};
+
 /// Possible error types returned by this module
 #[derive(Debug)]
 pub enum RcuError {
@@ -69,40 +113,65 @@ pub enum RcuError {
     DeleteError(i32),
 }
 
-// Rcu object is used only to call once urcu lib initialization (urcu_init)
-struct Rcu;
+/// Default hashing algorithm: [wyhash] with a fixed seed.
+///
+/// [wyhash]: https://docs.rs/wyhash/0.5.0/wyhash/
+#[derive(Clone, Copy, Debug)]
+pub struct DefaultHashBuilder {
+    seed: u64,
+}
 
-// global flag to know if we need to initialize urcu library (calling urcu_init).
-#[cfg(feature = "memb")]
-static URCU_LIB_INITIALIZED: Once = Once::new();
+impl DefaultHashBuilder {
+    /// Use a custom seed (for instance a random one, to make hash values harder to predict).
+    pub fn with_seed(seed: u64) -> Self {
+        DefaultHashBuilder { seed }
+    }
+}
 
-impl Rcu {
-    pub fn init() {
-        #[cfg(feature = "memb")]
-        URCU_LIB_INITIALIZED.call_once(|| unsafe {
-            urcu_sys::rcu_init();
-        });
+impl Default for DefaultHashBuilder {
+    fn default() -> Self {
+        DefaultHashBuilder { seed: 3 }
+    }
+}
+
+impl BuildHasher for DefaultHashBuilder {
+    type Hasher = wyhash::WyHash;
+
+    fn build_hasher(&self) -> Self::Hasher {
+        wyhash::WyHash::with_seed(self.seed)
     }
 }
 
 /// An RcuHt object is an instance of a RCU hashtable.
-pub struct RcuHt<K, V> {
+pub struct RcuHt<K, V, S = DefaultHashBuilder, R: RcuFlavor = DefaultFlavor> {
     /// mutex to protect writer (write operation must be done under lock)
     mutex: Mutex<RcuHtWriterGuard<K, V>>,
     /// a pointer to an instance of lib urcu hashtable
     urcuht: *mut urcu_sys::cds_lfht,
+    /// used to compute hash of keys
+    hash_builder: S,
+    /// optional node allocator (boxed: RCU callbacks keep a pointer to it)
+    pool: Option<Box<RcuNodePool>>,
+    /// write operations deferred by RcuHt::defer, applied by the next RcuHtWriter::apply_pending
+    pending: RcuHtPending<K, V>,
+    /// counters, only updated with the "stats" feature
+    stats: RcuHtStats,
+    /// backlog of removed objects, back-pressure settings and optional call_rcu worker
+    reclaim: RcuReclaim,
+    /// RCU flavor used by readers and writers of this hashtable
+    _flavor: PhantomData<fn() -> R>,
 }
 
 /// RcuHt can be shared between threads (under std::sync::Arc<>).
-unsafe impl<K, V> Send for RcuHt<K, V> {}
+unsafe impl<K, V, S: Send, R: RcuFlavor> Send for RcuHt<K, V, S, R> {}
 /// RcuHt can be shared between threads (under std::sync::Arc<>).
-unsafe impl<K, V> Sync for RcuHt<K, V> {}
+unsafe impl<K, V, S: Sync, R: RcuFlavor> Sync for RcuHt<K, V, S, R> {}
 
-impl<K, V> RcuHt<K, V>
+impl<K, V> RcuHt<K, V, DefaultHashBuilder>
 where
     K: Hash + Eq,
 {
-    /// Allocate a new instance of urcu hashtable.
+    /// Allocate a new instance of urcu hashtable, using the default hashing algorithm.
     ///
     /// Parameters are mapped to urcu lib : <https://github.com/urcu/userspace-rcu/blob/master/include/urcu/rculfhash.h#L190>
     ///
@@ -119,57 +188,246 @@ where
         max_nr_buckets: u64,
         autoresize: bool,
     ) -> Result<Self, RcuError> {
-        // initialize global lib if not already done
-        Rcu::init();
+        Self::with_hasher(
+            init_size,
+            min_nr_alloc_buckets,
+            max_nr_buckets,
+            autoresize,
+            DefaultHashBuilder::default(),
+        )
+    }
 
-        let flags: i32 = match autoresize {
-            true => urcu_sys::CDS_LFHT_AUTO_RESIZE as i32,
-            false => 0,
-        };
+    /// Allocate a new instance of urcu hashtable, using a node pool.
+    ///
+    /// Nodes are allocated by slabs and reused instead of being allocated and released one by one
+    /// (see [`RcuNodePoolConfig`]). Other parameters are the same than [`RcuHt::new`].
+    pub fn with_node_pool(
+        init_size: u64,
+        min_nr_alloc_buckets: u64,
+        max_nr_buckets: u64,
+        autoresize: bool,
+        pool: RcuNodePoolConfig,
+    ) -> Result<Self, RcuError> {
+        Self::with_hasher_and_node_pool(
+            init_size,
+            min_nr_alloc_buckets,
+            max_nr_buckets,
+            autoresize,
+            DefaultHashBuilder::default(),
+            Some(pool),
+        )
+    }
 
-        unsafe {
-            let urcuht = urcu_sys::cds_lfht_new(
-                init_size,
-                min_nr_alloc_buckets,
-                max_nr_buckets,
-                flags,
-                std::ptr::null_mut(),
-            );
+    /// Allocate a new hashtable sized for `capacity` objects, and fill it with all key/values of `iter`.
+    ///
+    /// Buckets are allocated up front, so the hashtable is not resized while loading.
+    /// The hashtable is only reachable by readers once this function returns.
+    /// See [`RcuHtBuilder::build_from_parts`] to load it from many threads.
+    pub fn from_iter_with_capacity<I>(iter: I, capacity: usize) -> Result<Self, RcuError>
+    where
+        I: IntoIterator<Item = (K, V)>,
+    {
+        RcuHtBuilder::new().capacity(capacity).build_from_iter(iter)
+    }
+}
 
-            if urcuht.is_null() {
-                return Err(RcuError::InvalidParameters);
-            }
+impl<K, V, S> RcuHt<K, V, S>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+{
+    /// Allocate a new instance of urcu hashtable, using `hash_builder` to hash keys.
+    ///
+    /// Other parameters are the same than [`RcuHt::new`].
+    pub fn with_hasher(
+        init_size: u64,
+        min_nr_alloc_buckets: u64,
+        max_nr_buckets: u64,
+        autoresize: bool,
+        hash_builder: S,
+    ) -> Result<Self, RcuError> {
+        Self::with_hasher_and_node_pool(
+            init_size,
+            min_nr_alloc_buckets,
+            max_nr_buckets,
+            autoresize,
+            hash_builder,
+            None,
+        )
+    }
 
-            let mutex = Mutex::new(RcuHtWriterGuard::new());
+    /// Allocate a new instance of urcu hashtable, using `hash_builder` to hash keys,
+    /// and an optional node pool (see [`RcuHt::with_node_pool`]).
+    pub fn with_hasher_and_node_pool(
+        init_size: u64,
+        min_nr_alloc_buckets: u64,
+        max_nr_buckets: u64,
+        autoresize: bool,
+        hash_builder: S,
+        pool: Option<RcuNodePoolConfig>,
+    ) -> Result<Self, RcuError> {
+        let builder = RcuHtBuilder::new()
+            .init_size(init_size)
+            .min_nr_alloc_buckets(min_nr_alloc_buckets)
+            .max_nr_buckets(max_nr_buckets)
+            .auto_resize(autoresize)
+            .accounting(false)
+            .hasher(hash_builder);
+
+        match pool {
+            Some(pool) => builder.node_pool(pool).build(),
+            None => builder.build(),
+        }
+    }
+}
 
-            Ok(RcuHt { urcuht, mutex })
+impl<K, V, S, R> RcuHt<K, V, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Resize the hashtable to `new_size` buckets (must be power of two), for instance before a bulk load.
+    ///
+    /// The table is resized before returning. With automatic resize, it may be resized again later.
+    /// This waits for grace periods: it must not be called while holding a read lock.
+    pub fn resize(&self, new_size: u64) -> Result<(), RcuError> {
+        if !new_size.is_power_of_two() {
+            return Err(RcuError::InvalidParameters);
         }
+
+        urcu_thread_register::<R>();
+
+        let res = unsafe {
+            if R::read_ongoing() {
+                Err(RcuError::InvalidParameters)
+            } else {
+                urcu_sys::cds_lfht_resize(self.urcuht, new_size);
+                Ok(())
+            }
+        };
+
+        urcu_thread_unregister::<R>();
+        res
     }
 
     /// Get a per thread handle. Will be used for read/write operations.
-    pub fn thread(&self) -> RcuHtThread<K, V> {
-        RcuHtThread::new(self.urcuht, &self.mutex)
+    pub fn thread(&self) -> RcuHtThread<K, V, S, R> {
+        RcuHtThread::new(self)
+    }
+
+    /// Returns a reference to the hashtable's BuildHasher.
+    pub fn hasher(&self) -> &S {
+        &self.hash_builder
+    }
+
+    /// Queue a write operation, without waiting for the write mutex.
+    ///
+    /// Operations are only visible to readers once a writer applies them
+    /// (see [`RcuHtWriter::apply_pending`]): writers holding the write lock, or a background
+    /// writer thread, should call it regularly. This function does not need a registered thread.
+    ///
+    /// ```
+    /// use urcu_ht::{RcuHt, RcuHtOp};
+    ///
+    /// let ht = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+    /// let thread = ht.thread();
+    ///
+    /// // a data path thread never waits for the write mutex
+    /// match thread.try_wrlock() {
+    ///     Some(mut wrlock) => wrlock.insert_or_replace(1, 10),
+    ///     None => ht.defer(RcuHtOp::InsertOrReplace(1, 10)),
+    /// }
+    ///
+    /// // later, in the thread owning the write mutex
+    /// thread.wrlock().unwrap().apply_pending();
+    /// assert_eq!(thread.rdlock().get(&1), Some(&10));
+    /// ```
+    pub fn defer(&self, op: RcuHtOp<K, V>) {
+        self.pending.push(op);
+    }
+
+    /// Returns true if write operations are waiting to be applied (see [`RcuHt::defer`]).
+    pub fn has_pending(&self) -> bool {
+        !self.pending.is_empty()
+    }
+
+    /// Objects removed (or replaced) and given to call_rcu, not released yet.
+    ///
+    /// Objects retired by writers still alive (not given to call_rcu yet) are not counted.
+    pub fn reclaim_backlog(&self) -> RcuReclaimBacklog {
+        self.reclaim.backlog()
+    }
+
+    /// Snapshot of the statistics of this hashtable ("stats" feature).
+    ///
+    /// It only reads counters, so it is cheap and can be called at any time from any thread.
+    /// Objects count is not included: see [`RcuHtRead::stats`].
+    #[cfg(feature = "stats")]
+    pub fn stats(&self) -> RcuHtStatsSnapshot {
+        self.stats.snapshot()
     }
 }
 
-impl<K, V> Drop for RcuHt<K, V> {
+impl<K, V, S, R: RcuFlavor> Drop for RcuHt<K, V, S, R> {
     /// Release an instance of a RCU hashtable.
     fn drop(&mut self) {
+        // we have a mutable reference: there is no more writer or reader able to access this hashtable.
+        // lib urcu API still requires a registered thread to use the hashtable.
+        urcu_thread_register::<R>();
+
+        let pool = self.pool.as_deref();
+
         unsafe {
-            // must be called when there is no more writer or reader able to access this hashtable.
-            // XXX should probably be empty before free ???
+            // release nodes retired by the writers and not yet given to call_rcu
+            if let Ok(guard) = self.mutex.get_mut() {
+                guard.flush::<R>(pool, &self.stats, &self.reclaim);
+            }
+
+            // wait until all pending callbacks are done: they can reference the node pool.
+            if pool.is_some() {
+                R::barrier();
+            }
+
+            // pending callbacks of the dedicated worker (if any) move to the default worker
+            self.reclaim.free_worker::<R>();
+
+            // hashtable must be empty before being destroyed.
+            // Nobody can see these nodes anymore, so they can be released without waiting a grace period.
+            urcu_read_lock::<R>();
+
+            let mut iter: urcu_sys::cds_lfht_iter = std::mem::zeroed();
+            urcu_sys::cds_lfht_first(self.urcuht, &mut iter);
+
+            let mut found_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+            while !found_node.is_null() {
+                urcu_sys::cds_lfht_next(self.urcuht, &mut iter);
+                urcu_sys::cds_lfht_del(self.urcuht, found_node);
+
+                urcu_drop_nodes(&[urcu_cds_lfht_node_to_rust_type::<K, V>(found_node)], pool);
+
+                found_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+            }
+
+            urcu_read_unlock::<R>();
+
             urcu_sys::cds_lfht_destroy(self.urcuht, std::ptr::null_mut());
         }
+
+        urcu_thread_unregister::<R>();
     }
 }
 
 /// This describes every object stored in hashtable.
+///
+/// There is no rcu_head here: removed nodes are released by batches (see RcuReclaimBatch).
+/// Fields are in lookup order: the list node (next pointer and reverse hash) is read first,
+/// then the key is compared. For small keys and values, all of them fit in a single cache line
+/// (see [`RcuNodePoolConfig::cache_line_aligned`] to make sure a node is never split across two lines).
 #[repr(C)]
 struct RcuLfhtNode<K, V> {
     /// internal node to link to other objects it in hashtable
     node: urcu_sys::cds_lfht_node,
-    /// data structure used for delayed free
-    head: urcu_sys::rcu_head,
     /// object key (user data)
     key: K,
     /// object data (user data)
@@ -180,6 +438,11 @@ struct RcuLfhtNode<K, V> {
 /// Returns 1 if current node key and lookup key are equals, 0 otherwise.
 /// Called by urcu_sys::cds_lfht_lookup
 /// Unsized callback version
+///
+/// lib urcu only calls it for nodes whose reverse hash (the full 64 bits hash value) is equal
+/// to the one looked up: keys are compared only on a full hash collision, so there is no need to
+/// store a hash or a tag in RcuLfhtNode. `key` points to a `&Q` on the caller stack: the extra
+/// indirection needed for unsized keys (str, [T]) stays in L1 cache.
 unsafe extern "C" fn urcu_match_ref_fn<Q, K, V>(
     node: *mut urcu_sys::cds_lfht_node,
     key: *const std::ffi::c_void,
@@ -230,30 +493,38 @@ unsafe fn urcu_cds_lfht_node_to_rust_type<K, V>(
     ptr.sub(offset).cast::<RcuLfhtNode<K, V>>()
 }
 
-/// Get back to RcuLfhtNode rust type from a "head" pointer. C-like dark pointer operations and casting.
-unsafe fn urcu_cds_lfht_head_to_rust_type<K, V>(
-    node: *mut urcu_sys::rcu_head,
-) -> *mut RcuLfhtNode<K, V> {
-    let offset = memoffset::offset_of!(RcuLfhtNode::<K, V>, head);
-
-    let ptr = node.cast::<u8>();
-    ptr.sub(offset).cast::<RcuLfhtNode<K, V>>()
-}
-
 /// Helper function used to perform lookup (used at multiple places).
+/// `hash` is the key hash, computed by the caller.
 /// This function must be called with rcu_read_lock held.
 /// Threads calling this API need to be registered (urcu_sys::rcu_register_thread).
-unsafe fn urcu_get_node<Q, K, V>(
+unsafe fn urcu_get_node_with_hash<Q, K, V>(
     ht: *mut urcu_sys::cds_lfht,
+    hash: u64,
     key: &Q,
 ) -> *mut urcu_sys::cds_lfht_node
 where
     K: Borrow<Q>,
-    Q: ?Sized + Hash + Eq,
+    Q: ?Sized + Eq,
 {
-    let hash = urcu_key_hash(key);
+    let mut iter = urcu_lookup::<Q, K, V>(ht, hash, key);
+
+    let found_node: *mut urcu_sys::cds_lfht_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+
+    found_node
+}
 
-    let mut iter: urcu_sys::cds_lfht_iter = std::mem::MaybeUninit::uninit().assume_init();
+/// Same as urcu_get_node_with_hash, returning the iterator (needed to replace the node found).
+/// This function must be called with rcu_read_lock held.
+unsafe fn urcu_lookup<Q, K, V>(
+    ht: *mut urcu_sys::cds_lfht,
+    hash: u64,
+    key: &Q,
+) -> urcu_sys::cds_lfht_iter
+where
+    K: Borrow<Q>,
+    Q: ?Sized + Eq,
+{
+    let mut iter: urcu_sys::cds_lfht_iter = std::mem::zeroed();
 
     // cds_lfht_lookup - lookup a node by key.
     // @ht: the hash table.
@@ -270,150 +541,360 @@ where
         &mut iter as *mut urcu_sys::cds_lfht_iter,
     );
 
-    let found_node: *mut urcu_sys::cds_lfht_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
-
-    found_node
+    iter
 }
 
 /// helper function to compute a hash of a key.
-fn urcu_key_hash<K: ?Sized + Hash>(data: &K) -> u64 {
-    let mut hasher = wyhash::WyHash::with_seed(3);
+fn urcu_key_hash<K: ?Sized + Hash, S: BuildHasher>(hash_builder: &S, data: &K) -> u64 {
+    let mut hasher = hash_builder.build_hasher();
     data.hash(&mut hasher);
     hasher.finish()
 }
 
-/// Callback function, called after some delay, when it is time to free a node.
-unsafe extern "C" fn urcu_free_node<K, V>(head: *mut urcu_sys::rcu_head)
-where
-    K: Hash + Eq,
-{
-    let node = urcu_cds_lfht_head_to_rust_type::<K, V>(head);
+/// Count objects of a hashtable. This function must be called with rcu_read_lock held.
+unsafe fn urcu_count_nodes(ht: *mut urcu_sys::cds_lfht) -> u64 {
+    let mut split_count_before: std::os::raw::c_long = 0;
+    let mut count: std::os::raw::c_ulong = 0;
+    let mut split_count_after: std::os::raw::c_long = 0;
+
+    urcu_sys::cds_lfht_count_nodes(
+        ht,
+        &mut split_count_before,
+        &mut count,
+        &mut split_count_after,
+    );
+
+    count as u64
+}
+
+/// Allocate memory for a new node, from the node pool if any.
+/// `free_nodes` is the writer private free list used by the node pool.
+unsafe fn urcu_alloc_node<K, V>(
+    pool: Option<&RcuNodePool>,
+    free_nodes: &mut Vec<*mut u8>,
+) -> *mut RcuLfhtNode<K, V> {
+    match pool {
+        Some(pool) => pool.alloc(free_nodes).cast::<RcuLfhtNode<K, V>>(),
+        None => {
+            /* alloc style from https://doc.rust-lang.org/nomicon/vec/vec-alloc.html */
+            let layout = std::alloc::Layout::new::<RcuLfhtNode<K, V>>();
+            let ptr = std::alloc::alloc(layout);
+
+            match std::ptr::NonNull::new(ptr as *mut RcuLfhtNode<K, V>) {
+                Some(p) => p.as_ptr(),
+                None => std::alloc::handle_alloc_error(layout),
+            }
+        }
+    }
+}
+
+/// Drop user data of nodes, then release their memory (to the node pool if any).
+/// Nodes must not be reachable anymore.
+unsafe fn urcu_drop_nodes<K, V>(nodes: &[*mut RcuLfhtNode<K, V>], pool: Option<&RcuNodePool>) {
+    for node in nodes {
+        std::ptr::drop_in_place(&mut (**node).key);
+        std::ptr::drop_in_place(&mut (**node).data);
+    }
+
+    match pool {
+        Some(pool) => pool.free(nodes.iter().map(|node| node.cast::<u8>())),
+        None => {
+            let layout = std::alloc::Layout::new::<RcuLfhtNode<K, V>>();
+            for node in nodes {
+                std::alloc::dealloc(node.cast::<u8>(), layout);
+            }
+        }
+    }
+}
+
+/// Nodes retired together, released by a single RCU callback.
+#[repr(C)]
+struct RcuReclaimBatch<K, V> {
+    /// data structure used for delayed free
+    head: urcu_sys::rcu_head,
+    /// node pool owning these nodes (null without node pool)
+    pool: *const RcuNodePool,
+    /// reclaim backlog of the hashtable
+    queued: std::sync::Arc<std::sync::atomic::AtomicUsize>,
+    nodes: Vec<*mut RcuLfhtNode<K, V>>,
+}
+
+/// Default number of removed nodes accumulated before a reclaim batch is given to call_rcu.
+const URCU_RECLAIM_BATCH_SIZE: usize = 64;
+
+/// Callback function, called after some delay, when it is time to free a batch of nodes.
+unsafe extern "C" fn urcu_free_batch<K, V>(head: *mut urcu_sys::rcu_head) {
+    let offset = memoffset::offset_of!(RcuReclaimBatch::<K, V>, head);
+    let batch = Box::from_raw(
+        head.cast::<u8>()
+            .sub(offset)
+            .cast::<RcuReclaimBatch<K, V>>(),
+    );
 
-    std::ptr::drop_in_place(&mut (*node).key);
-    std::ptr::drop_in_place(&mut (*node).data);
+    urcu_drop_nodes(&batch.nodes, batch.pool.as_ref());
+    batch
+        .queued
+        .fetch_sub(batch.nodes.len(), std::sync::atomic::Ordering::Relaxed);
+}
 
-    let layout = std::alloc::Layout::new::<RcuLfhtNode<K, V>>();
-    std::alloc::dealloc(node as *mut u8, layout);
+/// Register the current thread in urcu lib, unless it is already registered.
+/// Every call must be balanced by a call to urcu_thread_unregister.
+/// A thread registration counter is kept per flavor: since this is a local thread storage,
+/// there is no concurrency, so no need for atomics.
+fn urcu_thread_register<R: RcuFlavor>() {
+    // manage thread reference counter : if the count is 1 => register this thread
+    let thread_count = R::registration_count().with(|cell| {
+        let mut thread_count = cell.get();
+        thread_count += 1;
+        cell.set(thread_count);
+        thread_count
+    });
+
+    if thread_count == 1 {
+        unsafe {
+            R::register_thread();
+        }
+    }
 }
 
-// thread local flag for thread register / unregister
-// since this is a local thread storage, there is no concurrency, so no need for atomics
-thread_local! {
-    static URCU_THREAD_REGISTERED_COUNT: Cell<u32>  = Cell::new(0);
+/// Unregister the current thread from urcu lib, if this is the last registration.
+fn urcu_thread_unregister<R: RcuFlavor>() {
+    /* manage thread reference counter : if the count is 0 (last object) => unregister this thread */
+    let thread_count = R::registration_count().with(|cell| {
+        let mut thread_count = cell.get();
+        thread_count -= 1;
+        cell.set(thread_count);
+        thread_count
+    });
+
+    if thread_count == 0 {
+        unsafe {
+            R::unregister_thread();
+        }
+    }
 }
 
 /// Per thread object used to provide safe access to RCU hashtable.
 ///
 /// It registers the current thread if needed (the first reader or writer object triggers the registration).
 /// It unregisters the current thread when no more objects are alive in this thread.
-pub struct RcuHtThread<'ht, K, V> {
-    urcuht: *mut urcu_sys::cds_lfht,
-    mutex: &'ht Mutex<RcuHtWriterGuard<K, V>>,
+pub struct RcuHtThread<'ht, K, V, S = DefaultHashBuilder, R: RcuFlavor = DefaultFlavor> {
+    ht: &'ht RcuHt<K, V, S, R>,
 }
 
-impl<'ht, K, V> RcuHtThread<'ht, K, V>
+impl<'ht, K, V, S, R: RcuFlavor> RcuHtThread<'ht, K, V, S, R>
 where
     K: Hash + Eq,
+    S: BuildHasher,
 {
     /// Get a new "read" handle.
     /// A different handle is needed for each thread doing "read" operations.
     /// It registers this thread in urcu lib.
     /// It must stick to a single thread. One must not try to move this handle between threads.
-    pub fn new(urcuht: *mut urcu_sys::cds_lfht, mutex: &'ht Mutex<RcuHtWriterGuard<K, V>>) -> Self {
-        // manage thread reference counter : if the count is 1 => register this thread
-        let thread_count = URCU_THREAD_REGISTERED_COUNT.with(|cell| {
-            let mut thread_count = cell.get();
-            thread_count += 1;
-            cell.set(thread_count);
-            thread_count
-        });
-
-        if thread_count == 1 {
-            unsafe {
-                urcu_sys::rcu_register_thread();
-            }
-        }
+    pub fn new(ht: &'ht RcuHt<K, V, S, R>) -> Self {
+        urcu_thread_register::<R>();
 
-        // return an object with a pointer to the hashtable
-        // Return an object with a reference to a shared write mutex for this hashtable.
+        // Return an object with a reference to the hashtable (and so to its shared write mutex).
         RcuHtThread {
-            urcuht,
-            // This prevent concurrent write on this hashtable.
-            // Since mutex is a reference, we are sure original hashtable cannot be deleted before this object.
+            // The write mutex prevents concurrent write on this hashtable.
+            // Since ht is a reference, we are sure original hashtable cannot be deleted before this object.
             // This is needed to protect hashtable deletion.
-            mutex,
+            ht,
         }
     }
 
-    pub fn wrlock(&self) -> Option<RcuHtWriter<K, V>> {
-        match self.mutex.lock() {
-            Ok(guard) => Some(RcuHtWriter::new(self.urcuht, self, guard)),
+    pub fn wrlock(&self) -> Option<RcuHtWriter<K, V, S, R>> {
+        let timer = self.ht.stats.timer();
+        let guard = self.ht.mutex.lock();
+        self.ht.stats.writer_locked(timer);
+
+        match guard {
+            Ok(guard) => Some(RcuHtWriter::new(
+                self.ht.urcuht,
+                self,
+                RcuHtWriterState::Locked(guard),
+            )),
             Err(_err) => None,
         }
     }
 
-    pub fn rdlock(&self) -> RcuHtRead<K, V> {
-        RcuHtRead::new(self.urcuht, self)
+    /// Same as [`RcuHtThread::wrlock`], without waiting: returns None if the write mutex is
+    /// already locked (or poisoned). See also [`RcuHt::defer`].
+    pub fn try_wrlock(&self) -> Option<RcuHtWriter<'_, '_, '_, K, V, S, R>> {
+        match self.ht.mutex.try_lock() {
+            Ok(guard) => {
+                self.ht.stats.writer_locked_without_wait();
+                Some(RcuHtWriter::new(
+                    self.ht.urcuht,
+                    self,
+                    RcuHtWriterState::Locked(guard),
+                ))
+            }
+            Err(_err) => None,
+        }
     }
 
-    #[cfg(feature = "qsbr")]
-    pub fn quiescent_state(&self) {
-        unsafe {
-            urcu_sys::rcu_quiescent_state();
-        }
+    /// Get a concurrent writer: it does not take the write mutex.
+    ///
+    /// lib urcu hashtable supports concurrent add, replace and del operations, so many concurrent
+    /// writers (and writers returned by [`RcuHtThread::wrlock`]) can update the hashtable at the same time.
+    /// Each operation is atomic, but a sequence of operations is not: another writer can change
+    /// the hashtable between two calls.
+    pub fn writer(&self) -> RcuHtWriter<'ht, '_, 'ht, K, V, S, R> {
+        RcuHtWriter::new(
+            self.ht.urcuht,
+            self,
+            RcuHtWriterState::Owned(RcuHtWriterGuard::new()),
+        )
+    }
+
+    pub fn rdlock(&self) -> RcuHtRead<K, V, S, R> {
+        RcuHtRead::new(self.ht.urcuht, self)
+    }
+
+    /// Run `f` with this thread offline, for instance around a blocking call (epoll, channel...).
+    ///
+    /// With qsbr, grace periods do not wait for this thread while `f` runs, so removed objects
+    /// of all qsbr hashtables are still released. Other flavors do nothing: a registered thread
+    /// outside read-side critical sections never delays grace periods.
+    ///
+    /// This handle is borrowed mutably, so no read lock, writer or reference obtained from it can be
+    /// alive (and none can be taken by `f`). A read lock of another handle of this thread must not
+    /// be alive either (it panics with qsbr, and in debug builds with other flavors).
+    /// The thread is online again when `f` returns (or panics).
+    pub fn offline<F, T>(&mut self, f: F) -> T
+    where
+        F: FnOnce() -> T,
+    {
+        let _offline = RcuOfflineSection::<R>::new();
+        f()
     }
 }
 
-impl<'ht, K, V> Drop for RcuHtThread<'ht, K, V> {
-    fn drop(&mut self) {
-        /* manage thread reference counter : if the count is 0 (last object) => unregister this thread */
-        let thread_count = URCU_THREAD_REGISTERED_COUNT.with(|cell| {
-            let mut thread_count = cell.get();
-            thread_count -= 1;
-            cell.set(thread_count);
-            thread_count
-        });
+#[cfg(feature = "qsbr")]
+impl<'ht, K, V, S> RcuHtThread<'ht, K, V, S, flavor::Qsbr> {
+    /// Announce a quiescent state (QSBR): this thread does not hold any reference to hashtable objects.
+    ///
+    /// Readers must call it regularly, otherwise grace periods never end and removed objects are never released.
+    /// This handle is borrowed mutably, so no read lock, writer or reference obtained from it can be alive.
+    /// Panics if a read lock of another handle of this thread is still alive.
+    pub fn quiescent_state(&mut self) {
+        flavor::Qsbr::quiescent_state();
+    }
 
-        if thread_count == 0 {
-            unsafe {
-                urcu_sys::rcu_unregister_thread();
-            }
-        }
+    /// Mark this thread offline (QSBR), for instance before a blocking call: grace periods do not wait
+    /// for an offline thread. Until [`RcuHtThread::thread_online`] is called, taking a read lock panics.
+    ///
+    /// Panics if a read lock of another handle of this thread is still alive.
+    pub fn thread_offline(&mut self) {
+        flavor::Qsbr::thread_offline();
+    }
+
+    /// Mark this thread online again (QSBR), after [`RcuHtThread::thread_offline`].
+    pub fn thread_online(&mut self) {
+        flavor::Qsbr::thread_online();
+    }
+}
+
+impl<'ht, K, V, S, R: RcuFlavor> Drop for RcuHtThread<'ht, K, V, S, R> {
+    fn drop(&mut self) {
+        urcu_thread_unregister::<R>();
     }
 }
 
-fn urcu_read_lock() {
-    #[cfg(feature = "memb")]
+fn urcu_read_lock<R: RcuFlavor>() {
     unsafe {
-        urcu_sys::rcu_read_lock();
+        R::read_lock();
     }
 }
 
-fn urcu_read_unlock() {
-    #[cfg(feature = "memb")]
+fn urcu_read_unlock<R: RcuFlavor>() {
     unsafe {
-        urcu_sys::rcu_read_unlock();
+        R::read_unlock();
+    }
+}
+
+/// Read-side critical section, released when dropped (even when unwinding).
+/// It must be released by the thread which took it, so it is neither Send nor Sync.
+struct RcuReadSection<R: RcuFlavor> {
+    _not_send: PhantomData<(*const (), R)>,
+}
+
+impl<R: RcuFlavor> RcuReadSection<R> {
+    fn new() -> Self {
+        urcu_read_lock::<R>();
+        RcuReadSection {
+            _not_send: PhantomData,
+        }
+    }
+}
+
+impl<R: RcuFlavor> Drop for RcuReadSection<R> {
+    fn drop(&mut self) {
+        urcu_read_unlock::<R>();
+    }
+}
+
+/// Current thread offline (see RcuHtThread::offline), online again when dropped (even when unwinding).
+struct RcuOfflineSection<R: RcuFlavor> {
+    // the thread was online before
+    online: bool,
+    _not_send: PhantomData<(*const (), R)>,
+}
+
+impl<R: RcuFlavor> RcuOfflineSection<R> {
+    fn new() -> Self {
+        debug_assert!(
+            !R::read_ongoing(),
+            "thread offline inside a read-side critical section"
+        );
+
+        RcuOfflineSection {
+            online: unsafe { R::thread_offline() },
+            _not_send: PhantomData,
+        }
+    }
+}
+
+impl<R: RcuFlavor> Drop for RcuOfflineSection<R> {
+    fn drop(&mut self) {
+        if self.online {
+            unsafe {
+                R::thread_online();
+            }
+        }
     }
 }
 
-pub struct RcuHtRead<'thread, 'ht, K, V> {
+/// Number of keys processed together by batched lookups (see RcuHtRead::get_many_into).
+const URCU_BATCH_SIZE: usize = 32;
+
+pub struct RcuHtRead<'thread, 'ht, K, V, S = DefaultHashBuilder, R: RcuFlavor = DefaultFlavor> {
     urcuht: *mut urcu_sys::cds_lfht,
-    _thread: &'thread RcuHtThread<'ht, K, V>,
+    hash_builder: &'ht S,
+    stats: &'ht RcuHtStats,
+    _thread: &'thread RcuHtThread<'ht, K, V, S, R>,
 }
 
-impl<'rdlock, 'thread, 'ht, K, V> RcuHtRead<'thread, 'ht, K, V>
+impl<'rdlock, 'thread, 'ht, K, V, S, R: RcuFlavor> RcuHtRead<'thread, 'ht, K, V, S, R>
 where
     K: Hash + Eq,
+    S: BuildHasher,
 {
     /// Get a new "read" handle.
     /// A different handle is needed for each thread doing "read" operations.
     /// It registers this thread in urcu lib.
     /// It must stick to a single thread. One must not try to move this handle between threads.
-    pub fn new(urcuht: *mut urcu_sys::cds_lfht, thread: &'thread RcuHtThread<'ht, K, V>) -> Self {
-        urcu_read_lock();
+    pub fn new(
+        urcuht: *mut urcu_sys::cds_lfht,
+        thread: &'thread RcuHtThread<'ht, K, V, S, R>,
+    ) -> Self {
+        urcu_read_lock::<R>();
 
         RcuHtRead {
             urcuht,
+            hash_builder: &thread.ht.hash_builder,
+            stats: &thread.ht.stats,
             _thread: thread,
         }
     }
@@ -422,11 +903,24 @@ where
     where
         K: Borrow<Q>,
         Q: Hash + Eq,
+    {
+        self.get_with_hash(urcu_key_hash(self.hash_builder, key), key)
+    }
+
+    /// Same as [`RcuHtRead::get`], using a hash value already computed by the caller.
+    ///
+    /// The hashtable BuildHasher is not used: `hash` must be the value used when this key was added
+    /// (see [`RcuHtWriter::insert_or_replace_with_hash`]), otherwise the object will not be found.
+    pub fn get_with_hash<Q: ?Sized>(&'rdlock self, hash: u64, key: &Q) -> Option<&'rdlock V>
+    where
+        K: Borrow<Q>,
+        Q: Eq,
     {
         let mut ret: Option<&V> = None;
+        let timer = self.stats.lookup_start();
 
         unsafe {
-            let found_node = urcu_get_node::<Q, K, V>(self.urcuht, key);
+            let found_node = urcu_get_node_with_hash::<Q, K, V>(self.urcuht, hash, key);
 
             if !found_node.is_null() {
                 let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
@@ -434,59 +928,288 @@ where
             }
         }
 
+        self.stats.lookup_end(timer, ret.is_some());
         ret
     }
-}
 
-impl<'thread, 'ht, K, V> Drop for RcuHtRead<'thread, 'ht, K, V> {
-    fn drop(&mut self) {
-        urcu_read_unlock();
+    /// Lookup a batch of keys within this single read-side critical section.
+    ///
+    /// Results are returned in the same order as `keys`.
+    /// See [`RcuHtRead::get_many_into`] for batches whose size is only known at runtime.
+    pub fn get_many<Q: ?Sized, const N: usize>(
+        &'rdlock self,
+        keys: &[&Q; N],
+    ) -> [Option<&'rdlock V>; N]
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        let mut ret = [None; N];
+        self.get_many_into(keys, &mut ret);
+        ret
     }
-}
 
-pub struct RcuHtWriterGuard<K, V> {
-    phantom_key: PhantomData<K>,
-    phantom_val: PhantomData<V>,
-}
+    /// Lookup a batch of keys within this single read-side critical section.
+    ///
+    /// `out[i]` receives the result of the lookup of `keys[i]`. Both slices must have the same length.
+    ///
+    /// Keys are processed by groups of `URCU_BATCH_SIZE`: all keys of a group are hashed first,
+    /// then looked up one after the other (lib urcu does not expose its buckets, so they cannot be
+    /// prefetched). It saves a read lock per key, and keeps hashing out of the lookup loop.
+    pub fn get_many_into<Q: ?Sized>(&'rdlock self, keys: &[&Q], out: &mut [Option<&'rdlock V>])
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        assert_eq!(
+            keys.len(),
+            out.len(),
+            "keys and out must have the same length"
+        );
+
+        let mut hashes = [0u64; URCU_BATCH_SIZE];
+        let mut nodes = [std::ptr::null_mut(); URCU_BATCH_SIZE];
+
+        for (keys, out) in keys
+            .chunks(URCU_BATCH_SIZE)
+            .zip(out.chunks_mut(URCU_BATCH_SIZE))
+        {
+            for (hash, key) in hashes.iter_mut().zip(keys) {
+                *hash = urcu_key_hash(self.hash_builder, *key);
+            }
 
-impl<K, V> RcuHtWriterGuard<K, V> {
-    fn new() -> Self {
-        RcuHtWriterGuard {
-            phantom_key: PhantomData,
-            phantom_val: PhantomData,
+            unsafe {
+                for ((node, hash), key) in nodes.iter_mut().zip(&hashes).zip(keys) {
+                    let found_node = urcu_get_node_with_hash::<Q, K, V>(self.urcuht, *hash, *key);
+
+                    *node = if found_node.is_null() {
+                        std::ptr::null_mut()
+                    } else {
+                        urcu_cds_lfht_node_to_rust_type::<K, V>(found_node)
+                    };
+                }
+
+                let mut hits = 0;
+                for (ret, node) in out.iter_mut().zip(&nodes) {
+                    *ret = if node.is_null() {
+                        None
+                    } else {
+                        hits += 1;
+                        Some(&(**node).data)
+                    };
+                }
+                self.stats.lookups(hits, keys.len() as u64 - hits);
+            }
         }
     }
-}
 
-/// Writer object used to perform safe add and del operations.
-///
-/// It can only be called under locked mutex to protect from concurrent access.
-/// It must not be shared between threads.
-pub struct RcuHtWriter<'guard, 'thread, 'ht, K, V> {
+    /// Count the objects of the hashtable (cds_lfht_count_nodes).
+    ///
+    /// This walks the whole hashtable: objects added or removed concurrently may be counted or not.
+    pub fn count_nodes(&self) -> u64 {
+        unsafe { urcu_count_nodes(self.urcuht) }
+    }
+
+    /// Same as [`RcuHt::stats`], including the objects count ([`RcuHtRead::count_nodes`]).
+    #[cfg(feature = "stats")]
+    pub fn stats(&self) -> RcuHtStatsSnapshot {
+        RcuHtStatsSnapshot {
+            nodes: Some(self.count_nodes()),
+            ..self.stats.snapshot()
+        }
+    }
+}
+
+impl<'thread, 'ht, K, V, S, R: RcuFlavor> Drop for RcuHtRead<'thread, 'ht, K, V, S, R> {
+    fn drop(&mut self) {
+        urcu_read_unlock::<R>();
+    }
+}
+
+/// Reference to a value returned by a writer.
+///
+/// It holds a read-side critical section, so the value cannot be released while this object is alive,
+/// even if a concurrent writer removes it from the hashtable.
+pub struct RcuHtRef<'a, V, R: RcuFlavor = DefaultFlavor> {
+    value: &'a V,
+    _rcu: RcuReadSection<R>,
+}
+
+impl<'a, V, R: RcuFlavor> std::ops::Deref for RcuHtRef<'a, V, R> {
+    type Target = V;
+
+    fn deref(&self) -> &V {
+        self.value
+    }
+}
+
+impl<'a, V: std::fmt::Debug, R: RcuFlavor> std::fmt::Debug for RcuHtRef<'a, V, R> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        self.value.fmt(f)
+    }
+}
+
+/// Writer state, protected by the write mutex.
+pub struct RcuHtWriterGuard<K, V> {
+    /// nodes ready to be reused (node pool only)
+    free_nodes: Vec<*mut u8>,
+    /// removed nodes waiting to be given to call_rcu as a single batch
+    retired: Vec<*mut RcuLfhtNode<K, V>>,
+    /// number of retired nodes triggering a flush
+    reclaim_batch_size: usize,
+}
+
+impl<K, V> RcuHtWriterGuard<K, V> {
+    fn new() -> Self {
+        RcuHtWriterGuard {
+            free_nodes: Vec::new(),
+            retired: Vec::new(),
+            reclaim_batch_size: URCU_RECLAIM_BATCH_SIZE,
+        }
+    }
+
+    /// Release a node removed from the hashtable, after a grace period.
+    ///
+    /// Nodes are queued by batches: a single callback releases them all.
+    /// Above the high-water mark with [`RcuBackpressure::Synchronize`], nodes are kept until the
+    /// next write operation releases them inline (see RcuHtWriter::backpressure), unless a read
+    /// lock of this thread is alive.
+    unsafe fn retire_node<R: RcuFlavor>(
+        &mut self,
+        pool: Option<&RcuNodePool>,
+        stats: &RcuHtStats,
+        reclaim: &RcuReclaim,
+        node: *mut RcuLfhtNode<K, V>,
+    ) {
+        self.retired.push(node);
+
+        if self.retired.len() >= self.reclaim_batch_size
+            && !(reclaim.backpressure == RcuBackpressure::Synchronize
+                && reclaim.over_high_water(self.retired.len())
+                && !R::read_ongoing())
+        {
+            self.flush::<R>(pool, stats, reclaim);
+        }
+    }
+
+    /// Queue all retired nodes for release after a grace period.
+    unsafe fn flush<R: RcuFlavor>(
+        &mut self,
+        pool: Option<&RcuNodePool>,
+        stats: &RcuHtStats,
+        reclaim: &RcuReclaim,
+    ) {
+        if self.retired.is_empty() {
+            return;
+        }
+
+        let count = self.retired.len();
+        let batch = Box::new(RcuReclaimBatch {
+            head: std::mem::zeroed(),
+            pool: pool.map_or(std::ptr::null(), |pool| pool as *const RcuNodePool),
+            queued: reclaim.queued.clone(),
+            nodes: std::mem::replace(
+                &mut self.retired,
+                Vec::with_capacity(self.reclaim_batch_size),
+            ),
+        });
+
+        let batch = Box::into_raw(batch);
+        reclaim.call_rcu::<R>(&mut (*batch).head, urcu_free_batch::<K, V>, count);
+        stats.call_rcu();
+    }
+
+    /// Wait for a grace period, then release all retired nodes from the current thread.
+    /// Must not be called from a read-side critical section.
+    unsafe fn synchronize<R: RcuFlavor>(&mut self, pool: Option<&RcuNodePool>, stats: &RcuHtStats) {
+        if self.retired.is_empty() {
+            return;
+        }
+
+        let timer = stats.timer();
+        R::synchronize_rcu();
+        stats.grace_period_done(timer);
+
+        urcu_drop_nodes(&self.retired, pool);
+        self.retired.clear();
+    }
+}
+
+/// State of a writer: shared under the write mutex, or private to a concurrent writer.
+enum RcuHtWriterState<'guard, K, V> {
+    /// exclusive writer (RcuHtThread::wrlock)
+    Locked(MutexGuard<'guard, RcuHtWriterGuard<K, V>>),
+    /// concurrent writer (RcuHtThread::writer)
+    Owned(RcuHtWriterGuard<K, V>),
+}
+
+impl<'guard, K, V> std::ops::Deref for RcuHtWriterState<'guard, K, V> {
+    type Target = RcuHtWriterGuard<K, V>;
+
+    fn deref(&self) -> &Self::Target {
+        match self {
+            RcuHtWriterState::Locked(guard) => guard,
+            RcuHtWriterState::Owned(guard) => guard,
+        }
+    }
+}
+
+impl<'guard, K, V> std::ops::DerefMut for RcuHtWriterState<'guard, K, V> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        match self {
+            RcuHtWriterState::Locked(guard) => guard,
+            RcuHtWriterState::Owned(guard) => guard,
+        }
+    }
+}
+
+/// Writer object used to perform safe add and del operations.
+///
+/// It is either an exclusive writer, created under locked mutex to protect from concurrent access
+/// (see [`RcuHtThread::wrlock`]), or a concurrent writer (see [`RcuHtThread::writer`]).
+/// It must not be shared between threads.
+pub struct RcuHtWriter<
+    'guard,
+    'thread,
+    'ht,
+    K,
+    V,
+    S = DefaultHashBuilder,
+    R: RcuFlavor = DefaultFlavor,
+> {
     urcuht: *mut urcu_sys::cds_lfht,
+    hash_builder: &'ht S,
+    pool: Option<&'ht RcuNodePool>,
+    stats: &'ht RcuHtStats,
+    reclaim: &'ht RcuReclaim,
     // keep references to thread so object cannot be destroyed in an invalid order
-    _thread: &'thread RcuHtThread<'ht, K, V>,
+    _thread: &'thread RcuHtThread<'ht, K, V, S, R>,
     // have the guard here so lock will be released when writer is destroyed
-    _guard: MutexGuard<'guard, RcuHtWriterGuard<K, V>>,
+    guard: RcuHtWriterState<'guard, K, V>,
 }
 
-impl<'guard, 'thread, 'ht, K, V> RcuHtWriter<'guard, 'thread, 'ht, K, V>
+impl<'guard, 'thread, 'ht, K, V, S, R: RcuFlavor> RcuHtWriter<'guard, 'thread, 'ht, K, V, S, R>
 where
     K: Hash + Eq,
+    S: BuildHasher,
 {
     /// Creates a write instance.
     ///
     /// There should be only one single instance allocated under the write mutex.
     fn new(
         urcuht: *mut urcu_sys::cds_lfht,
-        thread: &'thread RcuHtThread<'ht, K, V>,
-        guard: MutexGuard<'guard, RcuHtWriterGuard<K, V>>,
-    ) -> RcuHtWriter<'guard, 'thread, 'ht, K, V> {
+        thread: &'thread RcuHtThread<'ht, K, V, S, R>,
+        guard: RcuHtWriterState<'guard, K, V>,
+    ) -> RcuHtWriter<'guard, 'thread, 'ht, K, V, S, R> {
         // return an object containing the pointer to the hashtable
         RcuHtWriter {
             urcuht,
+            hash_builder: &thread.ht.hash_builder,
+            pool: thread.ht.pool.as_deref(),
+            stats: &thread.ht.stats,
+            reclaim: &thread.ht.reclaim,
             _thread: thread,
-            _guard: guard,
+            guard,
         }
     }
 
@@ -496,61 +1219,350 @@ where
     /// Main difference with standard collection HashMap : we cannot return/move existing value here.
     /// We must destroy it after a grace period. If it were returned by this function, it could be deleted immediately
     pub fn insert_or_replace(&mut self, key: K, value: V) {
-        let h = urcu_key_hash(&key);
+        let h = urcu_key_hash(self.hash_builder, &key);
+
+        self.insert_or_replace_with_hash(h, key, value)
+    }
+
+    /// Same as [`RcuHtWriter::insert_or_replace`], using a hash value already computed by the caller.
+    ///
+    /// The hashtable BuildHasher is not used: the same `hash` must be provided to every later
+    /// lookup or removal of this key (see [`RcuHtRead::get_with_hash`] and [`RcuHtWriter::remove_with_hash`]).
+    pub fn insert_or_replace_with_hash(&mut self, h: u64, key: K, value: V) {
+        self.backpressure();
+
+        unsafe {
+            let new = self.new_node(key, value);
+
+            // now add or replace it
+            let _rcu = RcuReadSection::<R>::new();
+            self.add_replace_node(h, new);
+        }
+    }
 
-        let layout = std::alloc::Layout::new::<RcuLfhtNode<K, V>>();
+    /// Add a key/value only if `key` is not present yet (cds_lfht_add_unique).
+    ///
+    /// If `key` is already present, the hashtable is unchanged, the provided key and value are dropped,
+    /// and a reference to the existing value is returned.
+    /// A single traversal is done, but a node is allocated even if `key` is already present:
+    /// see [`RcuHtWriter::insert_unique_with`] to avoid it.
+    pub fn insert_unique(&mut self, key: K, value: V) -> Result<(), RcuHtRef<'_, V, R>> {
+        let h = urcu_key_hash(self.hash_builder, &key);
+        self.backpressure();
 
         unsafe {
-            /* allocate a new RcuLfhtNode to store data */
-            /* alloc style from https://doc.rust-lang.org/nomicon/vec/vec-alloc.html */
+            let rcu = RcuReadSection::<R>::new();
 
-            let ptr = std::alloc::alloc(layout);
+            let new = self.new_node(key, value);
+            let added = self.add_unique_node(h, new);
 
-            let val = match std::ptr::NonNull::new(ptr as *mut RcuLfhtNode<K, V>) {
-                Some(p) => p,
-                None => std::alloc::handle_alloc_error(layout),
+            if added.is_null() {
+                return Ok(());
+            }
+
+            self.drop_unpublished_node(new);
+
+            Err(RcuHtRef {
+                value: &(*added).data,
+                _rcu: rcu,
+            })
+        }
+    }
+
+    /// Add a key with value `f()` only if `key` is not present yet.
+    ///
+    /// `key` is looked up first: if it is already present, `f` is not called, no node is allocated,
+    /// and a reference to the existing value is returned.
+    pub fn insert_unique_with<F>(&mut self, key: K, f: F) -> Result<(), RcuHtRef<'_, V, R>>
+    where
+        F: FnOnce() -> V,
+    {
+        let h = urcu_key_hash(self.hash_builder, &key);
+        self.backpressure();
+
+        unsafe {
+            let rcu = RcuReadSection::<R>::new();
+
+            let found_node = urcu_get_node_with_hash::<K, K, V>(self.urcuht, h, &key);
+
+            let existing = if found_node.is_null() {
+                let new = self.new_node(key, f());
+                let added = self.add_unique_node(h, new);
+
+                if added.is_null() {
+                    return Ok(());
+                }
+
+                // added by a concurrent writer after our lookup
+                self.drop_unpublished_node(new);
+                added
+            } else {
+                urcu_cds_lfht_node_to_rust_type::<K, V>(found_node)
             };
 
-            // initialize all 4 fields of this new struct
-            (*val.as_ptr()).node = std::mem::MaybeUninit::zeroed().assume_init();
-            (*val.as_ptr()).head = std::mem::MaybeUninit::zeroed().assume_init();
+            Err(RcuHtRef {
+                value: &(*existing).data,
+                _rcu: rcu,
+            })
+        }
+    }
+
+    /// Replace the value of an existing `key` by `f(current value)`.
+    ///
+    /// A single lookup is done: the node found is directly replaced by a new node holding the new value
+    /// (cds_lfht_replace), and the old node is released after a grace period.
+    /// Readers see either the old or the new value: the key is never missing.
+    /// With concurrent writers, `f` is called again if the object is replaced meanwhile.
+    ///
+    /// This function fails if `key` is not found.
+    pub fn update<Q: ?Sized, F>(&mut self, key: &Q, mut f: F) -> Result<(), RcuError>
+    where
+        K: Borrow<Q> + Clone,
+        Q: Hash + Eq,
+        F: FnMut(&V) -> V,
+    {
+        let h = urcu_key_hash(self.hash_builder, key);
+        self.backpressure();
 
-            let val = &mut *val.as_ptr();
+        unsafe {
+            // RCU read-side lock must be held between lookup and replacement.
+            let _rcu = RcuReadSection::<R>::new();
 
-            std::ptr::write(&mut val.key, key);
-            std::ptr::write(&mut val.data, value);
+            loop {
+                let mut iter = urcu_lookup::<Q, K, V>(self.urcuht, h, key);
+                let found_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
 
-            // now add or replace it
-            urcu_read_lock();
-
-            // Return the node replaced upon success. If no node matching the key
-            // was present, return NULL, which also means the operation succeeded.
-            // This replacement operation should never fail.
-            // Call with rcu_read_lock held.
-            let old_node: *mut urcu_sys::cds_lfht_node = urcu_sys::cds_lfht_add_replace(
-                self.urcuht,
-                h,
-                Some(urcu_match_fn::<K, V>),
-                // coercion allowed from &T to *const T
-                // see : https://doc.rust-lang.org/reference/type-coercions.html#coercion-types */
-                &val.key as *const K as *const std::ffi::c_void,
-                &mut val.node as *mut urcu_sys::cds_lfht_node,
-            );
+                if found_node.is_null() {
+                    return Err(RcuError::NotFound);
+                }
+
+                let old = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+                let new = self.new_node((*old).key.clone(), f(&(*old).data));
+
+                if self.replace_node(h, &mut iter, new) {
+                    return Ok(());
+                }
+
+                // replaced or removed by a concurrent writer: try again
+                self.drop_unpublished_node(new);
+            }
+        }
+    }
+
+    /// Insert `key` with value `insert()` if it is not present yet, or else replace its value by
+    /// `update(current value)`.
+    ///
+    /// A single lookup is done, followed by either an insertion (cds_lfht_add_unique)
+    /// or a replacement (cds_lfht_replace) of the node found.
+    /// With concurrent writers, `update` is called again if the object is replaced meanwhile.
+    pub fn upsert<I, F>(&mut self, key: K, insert: I, mut update: F)
+    where
+        I: FnOnce() -> V,
+        F: FnMut(&V) -> V,
+    {
+        let h = urcu_key_hash(self.hash_builder, &key);
+        self.backpressure();
+
+        let mut key = key;
+        let mut insert = Some(insert);
+        // value built by insert() but not inserted yet (a concurrent writer added this key first)
+        let mut pending: Option<V> = None;
+
+        unsafe {
+            // RCU read-side lock must be held between lookup and insertion or replacement.
+            let _rcu = RcuReadSection::<R>::new();
+
+            loop {
+                let mut iter = urcu_lookup::<K, K, V>(self.urcuht, h, &key);
+                let found_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+
+                if found_node.is_null() {
+                    let value = match pending.take() {
+                        Some(value) => value,
+                        None => (insert.take().expect("insert() already called"))(),
+                    };
+                    let new = self.new_node(key, value);
+
+                    if self.add_unique_node(h, new).is_null() {
+                        return;
+                    }
+
+                    let (k, v) = self.take_unpublished_node(new);
+                    key = k;
+                    pending = Some(v);
+                } else {
+                    let old = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+                    let new = self.new_node(key, update(&(*old).data));
+
+                    if self.replace_node(h, &mut iter, new) {
+                        return;
+                    }
+
+                    key = self.take_unpublished_node(new).0;
+                }
+            }
+        }
+    }
+
+    /// Call `f` with the value of `key`, without any copy.
+    ///
+    /// Readers can access this value at the same time: it can only be modified through interior
+    /// mutability (atomics for instance), which is why `V` must be `Sync`.
+    ///
+    /// This function fails if `key` is not found.
+    pub fn update_in_place<Q: ?Sized, F>(&self, key: &Q, f: F) -> Result<(), RcuError>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+        V: Sync,
+        F: FnOnce(&V),
+    {
+        let h = urcu_key_hash(self.hash_builder, key);
 
-            urcu_read_unlock();
+        unsafe {
+            let _rcu = RcuReadSection::<R>::new();
 
-            // if add_replace returns an node, we must free it
-            if !old_node.is_null() {
-                // After successful replacement, a grace period must be waited for before
-                // freeing or re-using the memory reserved for the returned node.
-                let node = urcu_cds_lfht_node_to_rust_type::<K, V>(old_node);
+            let found_node = urcu_get_node_with_hash::<Q, K, V>(self.urcuht, h, key);
 
-                // ask to free data after grace period
-                urcu_sys::call_rcu(&mut (*node).head, Some(urcu_free_node::<K, V>));
+            if found_node.is_null() {
+                return Err(RcuError::NotFound);
             }
+
+            let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+            f(&(*node).data);
+        }
+
+        Ok(())
+    }
+
+    /// Allocate and initialize a new node, not yet added in hashtable.
+    unsafe fn new_node(&mut self, key: K, value: V) -> *mut RcuLfhtNode<K, V> {
+        /* allocate a new RcuLfhtNode to store data */
+        let val = urcu_alloc_node::<K, V>(self.pool, &mut self.guard.free_nodes);
+
+        // initialize all 3 fields of this new struct
+        std::ptr::write(&mut (*val).node, std::mem::zeroed());
+        std::ptr::write(&mut (*val).key, key);
+        std::ptr::write(&mut (*val).data, value);
+
+        val
+    }
+
+    /// Add a new node, replacing the node with the same key if any. The replaced node is retired.
+    /// Call with rcu_read_lock held.
+    unsafe fn add_replace_node(&mut self, h: u64, new: *mut RcuLfhtNode<K, V>) {
+        // Return the node replaced upon success. If no node matching the key
+        // was present, return NULL, which also means the operation succeeded.
+        // This replacement operation should never fail.
+        let old_node: *mut urcu_sys::cds_lfht_node = urcu_sys::cds_lfht_add_replace(
+            self.urcuht,
+            h,
+            Some(urcu_match_fn::<K, V>),
+            // coercion allowed from &T to *const T
+            // see : https://doc.rust-lang.org/reference/type-coercions.html#coercion-types */
+            &(*new).key as *const K as *const std::ffi::c_void,
+            &mut (*new).node as *mut urcu_sys::cds_lfht_node,
+        );
+
+        // if add_replace returns an node, we must free it
+        if old_node.is_null() {
+            self.stats.insert();
+        } else {
+            self.stats.replace();
+
+            // After successful replacement, a grace period must be waited for before
+            // freeing or re-using the memory reserved for the returned node.
+            let node = urcu_cds_lfht_node_to_rust_type::<K, V>(old_node);
+
+            // ask to free data after grace period
+            self.guard
+                .retire_node::<R>(self.pool, self.stats, self.reclaim, node);
         }
     }
 
+    /// Get back key and value of a node which was never added in hashtable, and release it.
+    /// No reader can see this node: there is no need to wait for a grace period.
+    unsafe fn take_unpublished_node(&mut self, node: *mut RcuLfhtNode<K, V>) -> (K, V) {
+        let key = std::ptr::read(&(*node).key);
+        let value = std::ptr::read(&(*node).data);
+
+        match self.pool {
+            // nodes allocated above the pool memory limit come from the global allocator
+            Some(pool) => pool.free_unpublished(node.cast::<u8>(), &mut self.guard.free_nodes),
+            None => std::alloc::dealloc(
+                node.cast::<u8>(),
+                std::alloc::Layout::new::<RcuLfhtNode<K, V>>(),
+            ),
+        }
+
+        (key, value)
+    }
+
+    /// Drop and release a node which was never added in hashtable.
+    unsafe fn drop_unpublished_node(&mut self, node: *mut RcuLfhtNode<K, V>) {
+        drop(self.take_unpublished_node(node));
+    }
+
+    /// Add `new` only if its key is not present yet.
+    /// Returns null upon success, or the node already present with this key (and nothing is done).
+    /// Call with rcu_read_lock held.
+    unsafe fn add_unique_node(
+        &mut self,
+        h: u64,
+        new: *mut RcuLfhtNode<K, V>,
+    ) -> *mut RcuLfhtNode<K, V> {
+        // Return the node added upon success, or the node already present with this key.
+        let added = urcu_sys::cds_lfht_add_unique(
+            self.urcuht,
+            h,
+            Some(urcu_match_fn::<K, V>),
+            &(*new).key as *const K as *const std::ffi::c_void,
+            &mut (*new).node,
+        );
+
+        if added == &mut (*new).node as *mut urcu_sys::cds_lfht_node {
+            self.stats.insert();
+            std::ptr::null_mut()
+        } else {
+            urcu_cds_lfht_node_to_rust_type::<K, V>(added)
+        }
+    }
+
+    /// Replace the node found by `iter` by `new`, then retire the old node.
+    /// Returns false (and nothing is done) if the old node was removed meanwhile.
+    /// Call with rcu_read_lock held.
+    unsafe fn replace_node(
+        &mut self,
+        h: u64,
+        iter: &mut urcu_sys::cds_lfht_iter,
+        new: *mut RcuLfhtNode<K, V>,
+    ) -> bool {
+        let old_node = urcu_sys::cds_lfht_iter_get_node(iter);
+
+        // Return 0 if replacement is successful, negative value otherwise.
+        // Replacing a NULL old node or an already removed node will fail with -ENOENT.
+        let err = urcu_sys::cds_lfht_replace(
+            self.urcuht,
+            iter,
+            h,
+            Some(urcu_match_fn::<K, V>),
+            &(*new).key as *const K as *const std::ffi::c_void,
+            &mut (*new).node,
+        );
+
+        if err != 0 {
+            return false;
+        }
+        self.stats.replace();
+
+        // ask to free data after grace period
+        let node = urcu_cds_lfht_node_to_rust_type::<K, V>(old_node);
+        self.guard
+            .retire_node::<R>(self.pool, self.stats, self.reclaim, node);
+
+        true
+    }
+
     /// Delete the value indexed by the `key` from the hashtable.
     ///
     /// This function may fail if node is not found.
@@ -558,15 +1570,29 @@ where
     where
         K: Borrow<Q>,
         Q: Hash + Eq,
+    {
+        let h = urcu_key_hash(self.hash_builder, key);
+
+        self.remove_with_hash(h, key)
+    }
+
+    /// Same as [`RcuHtWriter::remove`], using a hash value already computed by the caller.
+    ///
+    /// `h` must be the value provided when this key was added.
+    pub fn remove_with_hash<Q: ?Sized>(&mut self, h: u64, key: &Q) -> Result<(), RcuError>
+    where
+        K: Borrow<Q>,
+        Q: Eq,
     {
         let mut found = false;
         let mut err = 0;
+        self.backpressure();
 
         unsafe {
             // RCU read-side lock must be held between lookup and removal.
-            urcu_read_lock();
+            urcu_read_lock::<R>();
 
-            let found_node = urcu_get_node::<Q, K, V>(self.urcuht, key);
+            let found_node = urcu_get_node_with_hash::<Q, K, V>(self.urcuht, h, key);
 
             if !found_node.is_null() {
                 found = true;
@@ -579,24 +1605,171 @@ where
                 // Threads calling this API need to be registered RCU read-side threads.
                 err = urcu_sys::cds_lfht_del(self.urcuht, found_node);
 
-                // Ask to free data after grace period
-                let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
-                urcu_sys::call_rcu(&mut (*node).head, Some(urcu_free_node::<K, V>));
+                // Only the writer which actually removed the node can release it.
+                if err == 0 {
+                    // Ask to free data after grace period
+                    let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+                    self.stats.remove();
+                    self.guard
+                        .retire_node::<R>(self.pool, self.stats, self.reclaim, node);
+                }
             }
 
-            urcu_read_unlock();
+            urcu_read_unlock::<R>();
         }
 
-        if found {
-            if err != 0 {
-                Err(RcuError::DeleteError(err))
-            } else {
-                Ok(())
-            }
+        // if del failed, the node was removed by a concurrent writer after our lookup
+        if found && err == 0 {
+            Ok(())
         } else {
             Err(RcuError::NotFound)
         }
     }
+
+    /// Set the number of removed (or replaced) objects accumulated before they are given to call_rcu.
+    ///
+    /// Removed objects are released by batches: a single call_rcu callback releases a whole batch,
+    /// after a grace period. Pending objects are also queued when the writer is released.
+    /// This setting is kept by the hashtable for the next writers. A size of 0 or 1 disables batching.
+    pub fn set_reclaim_batch_size(&mut self, size: usize) {
+        self.guard.reclaim_batch_size = size;
+
+        if self.guard.retired.len() >= size {
+            unsafe {
+                self.guard.flush::<R>(self.pool, self.stats, self.reclaim);
+            }
+        }
+    }
+
+    /// Apply all write operations queued by [`RcuHt::defer`], and returns how many were applied.
+    ///
+    /// Operations of a same thread are applied in the order they were queued.
+    pub fn apply_pending(&mut self) -> usize {
+        let ops = self._thread.ht.pending.take();
+        let count = ops.len();
+
+        for op in ops {
+            match op {
+                RcuHtOp::InsertOrReplace(key, value) => self.insert_or_replace(key, value),
+                RcuHtOp::Remove(key) => {
+                    let _ = self.remove(&key);
+                }
+            }
+        }
+
+        count
+    }
+
+    /// Slow down if the reclaim backlog is above the high-water mark (see
+    /// [`RcuHtBuilder::reclaim_high_water`]). Called before write operations, outside read-side
+    /// critical sections.
+    ///
+    /// Waiting for a grace period would deadlock if a read lock of this thread is alive: retired
+    /// objects are then given to call_rcu, and the skip is counted in
+    /// [`RcuReclaimBacklog::backpressure_skipped`].
+    #[inline]
+    fn backpressure(&mut self) {
+        if !self.reclaim.over_high_water(self.guard.retired.len()) {
+            return;
+        }
+
+        unsafe {
+            if R::read_ongoing() {
+                self.reclaim.backpressure_skipped();
+                self.guard.flush::<R>(self.pool, self.stats, self.reclaim);
+                return;
+            }
+
+            match self.reclaim.backpressure {
+                RcuBackpressure::Synchronize => self.guard.synchronize::<R>(self.pool, self.stats),
+                RcuBackpressure::Block => {
+                    self.guard.flush::<R>(self.pool, self.stats, self.reclaim);
+
+                    let timer = self.stats.timer();
+                    R::barrier();
+                    self.stats.grace_period_done(timer);
+                }
+            }
+        }
+    }
+
+    /// Give all objects removed (or replaced) by this writer to call_rcu right now.
+    pub fn flush(&mut self) {
+        unsafe {
+            self.guard.flush::<R>(self.pool, self.stats, self.reclaim);
+        }
+    }
+
+    /// Wait for a grace period (synchronize_rcu), then release all objects removed (or replaced)
+    /// by this writer, from the current thread.
+    ///
+    /// This blocks until all current readers release their read lock, but no call_rcu callback is queued.
+    /// When called in a read-side critical section (a RcuHtRead alive in this thread),
+    /// waiting would deadlock, so objects are given to call_rcu instead.
+    pub fn synchronize(&mut self) {
+        unsafe {
+            if R::read_ongoing() {
+                self.guard.flush::<R>(self.pool, self.stats, self.reclaim);
+            } else {
+                self.guard.synchronize::<R>(self.pool, self.stats);
+            }
+        }
+    }
+}
+
+/// Number of objects inserted under a single read-side critical section by RcuHtWriter::extend.
+const URCU_EXTEND_CHUNK_SIZE: usize = 1024;
+
+impl<'guard, 'thread, 'ht, K, V, S, R: RcuFlavor> Extend<(K, V)>
+    for RcuHtWriter<'guard, 'thread, 'ht, K, V, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+{
+    /// Insert (or replace) all key/values of `iter`.
+    ///
+    /// Objects are inserted by chunks: a single read-side critical section is taken for a whole chunk,
+    /// instead of one per object. `iter` is consumed while holding it, so it must not block.
+    fn extend<I: IntoIterator<Item = (K, V)>>(&mut self, iter: I) {
+        let mut iter = iter.into_iter();
+
+        loop {
+            let mut count = 0;
+            self.backpressure();
+
+            unsafe {
+                let _rcu = RcuReadSection::<R>::new();
+
+                for (key, value) in iter.by_ref().take(URCU_EXTEND_CHUNK_SIZE) {
+                    let h = urcu_key_hash(self.hash_builder, &key);
+                    let new = self.new_node(key, value);
+                    self.add_replace_node(h, new);
+                    count += 1;
+                }
+            }
+
+            if count < URCU_EXTEND_CHUNK_SIZE {
+                break;
+            }
+        }
+    }
+}
+
+impl<'guard, 'thread, 'ht, K, V, S, R: RcuFlavor> Drop
+    for RcuHtWriter<'guard, 'thread, 'ht, K, V, S, R>
+{
+    /// Queue nodes retired by this writer before releasing the write lock,
+    /// so they do not wait for the next writer.
+    fn drop(&mut self) {
+        unsafe {
+            self.guard.flush::<R>(self.pool, self.stats, self.reclaim);
+
+            // free nodes of a concurrent writer go back to the shared node pool
+            if let (RcuHtWriterState::Owned(guard), Some(pool)) = (&mut self.guard, self.pool) {
+                pool.give_back(&mut guard.free_nodes);
+            }
+        }
+    }
 }
 
 #[cfg(test)]
@@ -698,4 +1871,1301 @@ mod tests {
         };
         */
     }
+
+    #[test]
+    fn get_many() {
+        let ht = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            for i in 0..100 {
+                wrlock.insert_or_replace(i, i * 10);
+            }
+        }
+
+        let rdlock = thread.rdlock();
+        let ret = rdlock.get_many(&[&1, &200, &99]);
+        assert_eq!(ret, [Some(&10), None, Some(&990)]);
+
+        // more keys than a single batch
+        let keys: Vec<u32> = (50..150).collect();
+        let keys: Vec<&u32> = keys.iter().collect();
+        let mut out = vec![None; keys.len()];
+        rdlock.get_many_into(&keys, &mut out);
+        for (key, ret) in keys.iter().zip(&out) {
+            match **key {
+                k if k < 100 => assert_eq!(*ret, Some(&(k * 10))),
+                _ => assert_eq!(*ret, None),
+            }
+        }
+    }
+
+    #[test]
+    fn custom_hasher() {
+        // identity hash of u64 keys, for keys which are already hashed
+        #[derive(Default)]
+        struct IdentityHasher(u64);
+
+        impl std::hash::Hasher for IdentityHasher {
+            fn finish(&self) -> u64 {
+                self.0
+            }
+
+            // other keys: fold their bytes into the state
+            fn write(&mut self, bytes: &[u8]) {
+                for &byte in bytes {
+                    self.0 = self.0.rotate_left(8) ^ byte as u64;
+                }
+            }
+
+            fn write_u64(&mut self, i: u64) {
+                self.0 = i;
+            }
+        }
+
+        let ht = RcuHt::<u64, u64, _>::with_hasher(
+            64,
+            64,
+            0,
+            true,
+            std::hash::BuildHasherDefault::<IdentityHasher>::default(),
+        )
+        .unwrap();
+
+        let thread = ht.thread();
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            wrlock.insert_or_replace(0xdead_beef, 1);
+            wrlock.insert_or_replace(42, 2);
+            wrlock.remove(&42).unwrap();
+        }
+
+        let rdlock = thread.rdlock();
+        assert_eq!(rdlock.get(&0xdead_beef), Some(&1));
+        assert_eq!(rdlock.get(&42), None);
+    }
+
+    #[test]
+    fn precomputed_hash() {
+        let ht = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            wrlock.insert_or_replace_with_hash(0x1234, 1, 10);
+            wrlock.insert_or_replace_with_hash(0x1234, 2, 20);
+            wrlock.insert_or_replace_with_hash(0x1234, 1, 11);
+        }
+
+        {
+            let rdlock = thread.rdlock();
+            assert_eq!(rdlock.get_with_hash(0x1234, &1), Some(&11));
+            assert_eq!(rdlock.get_with_hash(0x1234, &2), Some(&20));
+            assert_eq!(rdlock.get_with_hash(0x4321, &2), None);
+        }
+
+        let mut wrlock = thread.wrlock().unwrap();
+        assert!(wrlock.remove_with_hash(0x4321, &1).is_err());
+        assert!(wrlock.remove_with_hash(0x1234, &1).is_ok());
+    }
+
+    #[test]
+    fn node_pool() {
+        use crate::RcuNodePoolConfig;
+        use std::sync::atomic::{AtomicUsize, Ordering};
+
+        // count values alive, to check every value is dropped exactly once
+        static ALIVE: AtomicUsize = AtomicUsize::new(0);
+
+        struct Value(u32);
+
+        impl Value {
+            fn new(v: u32) -> Self {
+                ALIVE.fetch_add(1, Ordering::Relaxed);
+                Value(v)
+            }
+        }
+
+        impl Drop for Value {
+            fn drop(&mut self) {
+                ALIVE.fetch_sub(1, Ordering::Relaxed);
+            }
+        }
+
+        // small slabs and limit, so some nodes are allocated out of slabs
+        let config = RcuNodePoolConfig {
+            slab_nodes: 16,
+            max_bytes: 4096,
+            ..Default::default()
+        };
+        let ht = RcuHt::<u32, Value>::with_node_pool(64, 64, 0, true, config).unwrap();
+
+        {
+            let thread = ht.thread();
+            for round in 0..10 {
+                let mut wrlock = thread.wrlock().unwrap();
+                for i in 0..200 {
+                    wrlock.insert_or_replace(i, Value::new(round));
+                }
+                for i in 0..100 {
+                    wrlock.remove(&i).unwrap();
+                }
+            }
+
+            let rdlock = thread.rdlock();
+            assert!(rdlock.get(&50).is_none());
+            assert_eq!(rdlock.get(&150).unwrap().0, 9);
+        }
+
+        drop(ht);
+        unsafe {
+            urcu_sys::rcu_barrier();
+        }
+        assert_eq!(ALIVE.load(Ordering::Relaxed), 0);
+
+        // without slab memory, nodes never published go back to the global allocator
+        let config = RcuNodePoolConfig {
+            slab_nodes: 16,
+            max_bytes: 0,
+            ..Default::default()
+        };
+        let ht = RcuHt::<u32, u32>::with_node_pool(64, 64, 0, true, config).unwrap();
+        let thread = ht.thread();
+        let mut wrlock = thread.wrlock().unwrap();
+        wrlock.insert_or_replace(1, 1);
+        assert!(wrlock.insert_unique(1, 2).is_err());
+        assert!(wrlock.guard.free_nodes.is_empty());
+    }
+
+    #[test]
+    fn batched_reclaim() {
+        use std::sync::atomic::{AtomicUsize, Ordering};
+        use std::sync::Arc;
+
+        // count values alive, to check when values are released
+        static ALIVE: AtomicUsize = AtomicUsize::new(0);
+
+        struct Value;
+
+        impl Value {
+            fn new() -> Arc<Self> {
+                ALIVE.fetch_add(1, Ordering::Relaxed);
+                Arc::new(Value)
+            }
+        }
+
+        impl Drop for Value {
+            fn drop(&mut self) {
+                ALIVE.fetch_sub(1, Ordering::Relaxed);
+            }
+        }
+
+        let ht = RcuHt::<u32, Arc<Value>>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        let mut wrlock = thread.wrlock().unwrap();
+        wrlock.set_reclaim_batch_size(1000);
+
+        for i in 0..100 {
+            wrlock.insert_or_replace(i, Value::new());
+        }
+        for i in 0..100 {
+            wrlock.remove(&i).unwrap();
+        }
+
+        // batch is not full: nothing queued yet
+        assert_eq!(ALIVE.load(Ordering::Relaxed), 100);
+
+        wrlock.synchronize();
+        assert_eq!(ALIVE.load(Ordering::Relaxed), 0);
+    }
+
+    #[test]
+    fn concurrent_writers() {
+        use crate::RcuNodePoolConfig;
+
+        let ht = RcuHt::<u32, u32>::with_node_pool(64, 64, 0, true, RcuNodePoolConfig::default())
+            .unwrap();
+
+        std::thread::scope(|scope| {
+            for t in 0..4 {
+                let ht = &ht;
+                scope.spawn(move || {
+                    let thread = ht.thread();
+                    let mut writer = thread.writer();
+                    for i in 0..1000 {
+                        writer.insert_or_replace(i, t);
+                    }
+                    // odd keys are removed by all threads: only one of them succeeds
+                    for i in (1..1000).step_by(2) {
+                        let _ = writer.remove(&i);
+                    }
+                });
+            }
+        });
+
+        let thread = ht.thread();
+        let rdlock = thread.rdlock();
+        for i in 0..1000 {
+            assert_eq!(rdlock.get(&i).is_some(), i % 2 == 0);
+        }
+    }
+
+    #[test]
+    fn update() {
+        use std::sync::atomic::{AtomicU64, Ordering};
+
+        let ht = RcuHt::<String, u64>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        let mut wrlock = thread.wrlock().unwrap();
+
+        assert!(wrlock.update("counter", |v| v + 1).is_err());
+
+        for _ in 0..10 {
+            wrlock.upsert("counter".to_string(), || 1, |v| v + 1);
+        }
+        wrlock.update("counter", |v| v * 2).unwrap();
+        drop(wrlock);
+
+        assert_eq!(thread.rdlock().get("counter"), Some(&20));
+
+        // in place update of atomic values
+        let ht = RcuHt::<u32, AtomicU64>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        let mut wrlock = thread.wrlock().unwrap();
+        wrlock.insert_or_replace(1, AtomicU64::new(0));
+        for _ in 0..10 {
+            wrlock
+                .update_in_place(&1, |v| {
+                    v.fetch_add(1, Ordering::Relaxed);
+                })
+                .unwrap();
+        }
+        assert!(wrlock.update_in_place(&2, |_| {}).is_err());
+        drop(wrlock);
+
+        assert_eq!(thread.rdlock().get(&1).unwrap().load(Ordering::Relaxed), 10);
+    }
+
+    #[test]
+    fn insert_unique() {
+        let ht = RcuHt::<u32, String>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        let mut wrlock = thread.wrlock().unwrap();
+
+        assert!(wrlock.insert_unique(1, "one".to_string()).is_ok());
+        assert_eq!(
+            *wrlock.insert_unique(1, "uno".to_string()).unwrap_err(),
+            "one"
+        );
+
+        assert!(wrlock.insert_unique_with(2, || "two".to_string()).is_ok());
+        assert_eq!(
+            *wrlock
+                .insert_unique_with(2, || unreachable!("key is already present"))
+                .unwrap_err(),
+            "two"
+        );
+        drop(wrlock);
+
+        let rdlock = thread.rdlock();
+        assert_eq!(rdlock.get(&1).unwrap(), "one");
+        assert_eq!(rdlock.get(&2).unwrap(), "two");
+    }
+
+    #[test]
+    fn iter_and_scan() {
+        use crate::RcuHtCursor;
+
+        let ht = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            for i in 0..1000 {
+                wrlock.insert_or_replace(i, i + 1);
+            }
+        }
+
+        let mut seen = vec![0; 1000];
+        for (k, v) in thread.rdlock().iter() {
+            assert_eq!(*k + 1, *v);
+            seen[*k as usize] += 1;
+        }
+        assert!(seen.iter().all(|count| *count == 1));
+
+        // 3 partitions, scanned by chunks of 10 objects with a new read lock for each chunk
+        let mut seen = vec![0; 1000];
+        for part in 0..3 {
+            let mut cursor = RcuHtCursor::partition(part, 3);
+            while !cursor.is_done() {
+                let mut last = None;
+                let rdlock = thread.rdlock();
+                rdlock.scan(&mut cursor, 10, |k, _| {
+                    seen[*k as usize] += 1;
+                    last = Some(*k);
+                });
+                drop(rdlock);
+
+                // remove some objects between chunks: a scan must restart after removed keys
+                if let Some(last) = last {
+                    if last % 2 == 0 {
+                        thread.wrlock().unwrap().remove(&last).unwrap();
+                    }
+                }
+            }
+        }
+        assert!(seen.iter().all(|count| *count == 1));
+    }
+
+    #[test]
+    fn scan_walk_is_bounded() {
+        use crate::RcuHtCursor;
+
+        let ht = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            for i in 0..1000 {
+                wrlock.insert_or_replace(i, i);
+            }
+        }
+
+        // the objects of the first part are walked through by steps of at most 10 objects to reach
+        // the second part, and again each time the last key of a chunk of the second part is removed
+        let mut seen = vec![0; 1000];
+        let mut empty_chunks = 0;
+        for part in 0..2 {
+            let mut cursor = RcuHtCursor::partition(part, 2);
+            while !cursor.is_done() {
+                let mut last = None;
+                let count = thread.rdlock().scan(&mut cursor, 10, |k, _| {
+                    seen[*k as usize] += 1;
+                    last = Some(*k);
+                });
+                assert!(count <= 10);
+                match last {
+                    Some(last) if part == 1 && last % 10 == 0 => {
+                        thread.wrlock().unwrap().remove(&last).unwrap()
+                    }
+                    Some(_) => (),
+                    None => empty_chunks += 1,
+                }
+            }
+        }
+        assert!(empty_chunks > 10);
+        assert!(seen.iter().all(|count| *count == 1));
+    }
+
+    #[test]
+    fn builder_and_resize() {
+        use crate::{RcuHtBuilder, RcuHtMemoryLayout};
+
+        // mmap layout needs a maximum number of buckets
+        assert!(RcuHtBuilder::new()
+            .memory_layout(RcuHtMemoryLayout::Mmap)
+            .build::<u32, u32>()
+            .is_err());
+
+        let ht: RcuHt<u32, u32> = RcuHtBuilder::new()
+            .init_size(16)
+            .max_nr_buckets(1 << 16)
+            .memory_layout(RcuHtMemoryLayout::Mmap)
+            .accounting(true)
+            .reclaim_batch_size(8)
+            .build()
+            .expect("Cannot create hashtable");
+
+        assert!(ht.resize(1000).is_err());
+        ht.resize(1 << 12).expect("Cannot resize hashtable");
+
+        let ht = ht.thread();
+        {
+            let mut write = ht.wrlock().unwrap();
+            for i in 0..1000 {
+                write.insert_or_replace(i, i);
+            }
+        }
+
+        let read = ht.rdlock();
+        assert_eq!(read.count_nodes(), 1000);
+        assert_eq!(read.get(&999), Some(&999));
+    }
+
+    #[test]
+    fn bulk_load() {
+        use crate::{RcuHtBuilder, RcuNodePoolConfig};
+
+        let ht = RcuHt::from_iter_with_capacity((0..5000u32).map(|i| (i, i * 2)), 5000)
+            .expect("Cannot create hashtable");
+        {
+            let ht = ht.thread();
+            let read = ht.rdlock();
+            assert_eq!(read.count_nodes(), 5000);
+            assert_eq!(read.get(&4999), Some(&9998));
+        }
+
+        // 4 parts loaded by 4 threads, last part overlaps the others
+        let parts = (0..4u32).map(|part| (part * 1000..part * 1000 + 1500).map(|i| (i, i)));
+        let ht: RcuHt<u32, u32> = RcuHtBuilder::new()
+            .capacity(4500)
+            .node_pool(RcuNodePoolConfig::default())
+            .build_from_parts(parts)
+            .expect("Cannot create hashtable");
+
+        let ht = ht.thread();
+        let mut write = ht.wrlock().unwrap();
+        write.extend((4500..4600).map(|i| (i, i)));
+        drop(write);
+
+        let read = ht.rdlock();
+        assert_eq!(read.count_nodes(), 4600);
+        assert!((0..4600).all(|i| read.get(&i) == Some(&i)));
+    }
+
+    #[test]
+    fn cache_line_aligned_pool() {
+        use crate::pool::RcuNodePool;
+        use crate::RcuNodePoolConfig;
+        use std::alloc::Layout;
+
+        let config = RcuNodePoolConfig {
+            slab_nodes: 7,
+            cache_line_aligned: true,
+            ..Default::default()
+        };
+
+        // 16 bytes of cds_lfht_node + u32 key + u32 value: 24 bytes, padded to 32
+        for (size, stride) in [(24, 32), (64, 64), (72, 128)] {
+            let pool = RcuNodePool::new(Layout::from_size_align(size, 8).unwrap(), config).unwrap();
+            let mut local = Vec::new();
+
+            let nodes: Vec<*mut u8> = (0..20).map(|_| unsafe { pool.alloc(&mut local) }).collect();
+            for node in &nodes {
+                let addr = *node as usize;
+                assert_eq!(addr % stride.min(64), 0);
+                // first and last byte of the node are in the same line (if it fits in a line)
+                if size <= 64 {
+                    assert_eq!(addr / 64, (addr + size - 1) / 64);
+                }
+            }
+
+            unsafe {
+                pool.free(nodes.into_iter());
+            }
+            pool.give_back(&mut local);
+        }
+
+        let ht = RcuHt::<u32, u32>::with_node_pool(64, 64, 0, true, config).unwrap();
+        let ht = ht.thread();
+        let mut write = ht.wrlock().unwrap();
+        write.extend((0..100).map(|i| (i, i)));
+        drop(write);
+
+        let read = ht.rdlock();
+        assert!((0..100).all(|i| read.get(&i) == Some(&i)));
+    }
+
+    #[test]
+    fn hash_collisions() {
+        // all keys share the same hash value: every lookup has to compare keys
+        #[derive(Default)]
+        struct ConstantHasher;
+
+        impl std::hash::Hasher for ConstantHasher {
+            fn finish(&self) -> u64 {
+                0x1234
+            }
+
+            fn write(&mut self, _bytes: &[u8]) {}
+        }
+
+        let ht = RcuHt::<String, usize, _>::with_hasher(
+            64,
+            64,
+            0,
+            true,
+            std::hash::BuildHasherDefault::<ConstantHasher>::default(),
+        )
+        .unwrap();
+
+        let thread = ht.thread();
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            for i in 0..50 {
+                wrlock.insert_or_replace(format!("key {}", i), i);
+            }
+            assert!(wrlock.insert_unique("key 7".to_string(), 0).is_err());
+            wrlock.insert_or_replace("key 8".to_string(), 80);
+            wrlock.remove("key 9").unwrap();
+            assert!(wrlock.remove("key 9").is_err());
+        }
+
+        let rdlock = thread.rdlock();
+        assert_eq!(rdlock.count_nodes(), 49);
+        assert_eq!(rdlock.get("key 7"), Some(&7));
+        assert_eq!(rdlock.get("key 8"), Some(&80));
+        assert_eq!(rdlock.get("key 9"), None);
+        assert_eq!(rdlock.get("key 50"), None);
+        assert_eq!(
+            rdlock.get_many(&["key 0", "key 9", "key 49"]),
+            [Some(&0), None, Some(&49)]
+        );
+    }
+
+    #[test]
+    fn sharded() {
+        use crate::ShardedRcuHt;
+
+        let ht = ShardedRcuHt::<u32, u32, 4>::new(64, 64, 0, true).unwrap();
+
+        // one writer thread per shard, holding its shard write lock
+        std::thread::scope(|scope| {
+            for shard in 0..4 {
+                let ht = &ht;
+                scope.spawn(move || {
+                    let thread = ht.thread();
+                    let mut wrlock = thread.wrlock(shard).unwrap();
+                    for i in (0..4000).filter(|i| ht.shard_index(i) == shard) {
+                        wrlock.insert_or_replace(i, i);
+                    }
+                });
+            }
+        });
+
+        ht.resize(1024).unwrap();
+
+        let thread = ht.thread();
+        {
+            let mut writers = thread.writers();
+            writers.insert_or_replace(5000, 1);
+            writers.remove(&0).unwrap();
+            assert!(writers.remove(&0).is_err());
+            writers.flush();
+        }
+
+        // a shard writer refuses keys of other shards
+        let other = (ht.shard_index(&1) + 1) % 4;
+        let result = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+            thread.writer(other).insert_or_replace(1, 2)
+        }));
+        assert!(result.is_err());
+
+        let rdlock = thread.rdlock();
+        assert_eq!(rdlock.count_nodes(), 4000);
+        // keys are spread over all shards
+        assert!((0..4).all(|shard| rdlock.shard_count_nodes(shard) > 800));
+        assert_eq!(rdlock.get(&0), None);
+        assert!((1..4000).all(|i| rdlock.get(&i) == Some(&i)));
+        assert_eq!(rdlock.get(&5000), Some(&1));
+    }
+
+    #[test]
+    fn replicated() {
+        use crate::replicated::NumaTopology;
+        use crate::{RcuHtBuilder, ReplicatedRcuHt};
+
+        // two nodes, the second one without any CPU
+        let topology = NumaTopology::new(vec![0, 1], vec![vec![0], vec![]]);
+        let ht =
+            ReplicatedRcuHt::<String, u32>::with_topology(RcuHtBuilder::new(), topology).unwrap();
+        assert_eq!(ht.replica_count(), 2);
+
+        let thread = ht.thread();
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            for i in 0..100 {
+                wrlock.insert_or_replace(i.to_string(), i);
+            }
+            wrlock.remove("7").unwrap();
+            assert!(wrlock.remove("7").is_err());
+        }
+
+        // writes were applied to both replicas
+        for replica in 0..2 {
+            let rdlock = thread.replica_rdlock(replica);
+            assert_eq!(rdlock.count_nodes(), 99);
+            assert_eq!(rdlock.get("42"), Some(&42));
+            assert_eq!(rdlock.get("7"), None);
+        }
+
+        assert_eq!(thread.local_replica(), 0);
+        assert_eq!(thread.rdlock().get("99"), Some(&99));
+
+        ht.resize(128).unwrap();
+        assert_eq!(thread.replica_rdlock(1).count_nodes(), 99);
+    }
+
+    #[test]
+    fn thread_guard() {
+        use crate::{urcu_key_hash, RcuThreadGuard};
+
+        let ht1 = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+        let ht2 = RcuHt::<String, u64>::new(64, 64, 0, true).unwrap();
+        let ht3 = RcuHt::<u64, &str>::new(64, 64, 0, true).unwrap();
+
+        let guard = RcuThreadGuard::new();
+
+        {
+            // handles created while the guard is alive do not register the thread again
+            ht1.thread().wrlock().unwrap().insert_or_replace(1, 2);
+            ht2.thread()
+                .wrlock()
+                .unwrap()
+                .insert_or_replace("2".to_string(), 3);
+            ht3.thread().wrlock().unwrap().insert_or_replace(3, "three");
+        }
+
+        // a single read lock for the three lookups
+        let read = guard.rdlock();
+        let v1 = read.get(&ht1, &1).unwrap();
+        let v2 = read.get(&ht2, v1.to_string().as_str()).unwrap();
+        assert_eq!(read.get(&ht3, v2), Some(&"three"));
+        assert_eq!(read.get(&ht1, &2), None);
+
+        let h = urcu_key_hash(ht1.hasher(), &1u32);
+        assert_eq!(read.get_with_hash(&ht1, h, &1), Some(&2));
+    }
+
+    #[test]
+    fn deferred_writes() {
+        use crate::RcuHtOp;
+
+        let ht = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            wrlock.insert_or_replace(100, 100);
+
+            // the write mutex is held: other writers must not wait, they defer their operations
+            std::thread::scope(|scope| {
+                for t in 0..4 {
+                    let ht = &ht;
+                    scope.spawn(move || {
+                        assert!(ht.thread().try_wrlock().is_none());
+                        for i in 0..100 {
+                            ht.defer(RcuHtOp::InsertOrReplace(t * 100 + i, i));
+                        }
+                        ht.defer(RcuHtOp::Remove(t * 100));
+                    });
+                }
+            });
+
+            assert!(ht.has_pending());
+            assert_eq!(wrlock.apply_pending(), 404);
+            assert!(!ht.has_pending());
+            assert_eq!(wrlock.apply_pending(), 0);
+        }
+
+        let rdlock = thread.rdlock();
+        assert_eq!(rdlock.count_nodes(), 396);
+        assert_eq!(rdlock.get(&0), None);
+        assert_eq!(rdlock.get(&100), None);
+        assert_eq!(rdlock.get(&399), Some(&99));
+        drop(rdlock);
+
+        // operations still queued when the hashtable is released are dropped with it
+        ht.defer(RcuHtOp::InsertOrReplace(1, 1));
+        assert!(thread.try_wrlock().is_some());
+    }
+
+    #[cfg(feature = "stats")]
+    #[test]
+    fn stats() {
+        let ht = RcuHt::<u32, u32>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            for i in 0..10 {
+                wrlock.insert_or_replace(i, i);
+            }
+            wrlock.insert_or_replace(0, 1);
+            wrlock.remove(&1).unwrap();
+            assert!(wrlock.remove(&1).is_err());
+            wrlock.synchronize();
+            // already locked: not counted
+            assert!(thread.try_wrlock().is_none());
+        }
+        drop(thread.try_wrlock().unwrap());
+
+        {
+            let rdlock = thread.rdlock();
+            for i in 0..1000 {
+                rdlock.get(&(i % 20));
+            }
+            rdlock.get_many(&[&0, &1, &2]);
+
+            let stats = rdlock.stats();
+            assert_eq!(stats.nodes, Some(9));
+        }
+
+        let stats = ht.stats();
+        assert_eq!(stats.nodes, None);
+        assert_eq!(stats.lookups, 1003);
+        assert_eq!(stats.hits, 500 - 50 + 2);
+        assert_eq!(stats.misses, 1003 - stats.hits);
+        assert_eq!(stats.inserts, 10);
+        assert_eq!(stats.replaces, 1);
+        assert_eq!(stats.removes, 1);
+        assert_eq!(stats.writer_locks, 2);
+        assert_eq!(stats.grace_periods, 1);
+        assert_eq!(stats.call_rcu, 0);
+        assert_eq!(stats.lookup_latency.iter().sum::<u64>(), 1000 / 64);
+        assert!(stats.lookup_latency_percentile(99.0).is_some());
+    }
+
+    #[test]
+    fn flavors() {
+        use crate::{flavor, RcuFlavor, RcuHtBuilder};
+
+        fn check<R: RcuFlavor>() {
+            let ht: RcuHt<u32, u32, _, R> = RcuHtBuilder::new().flavor::<R>().build().unwrap();
+            let thread = ht.thread();
+
+            {
+                let mut wrlock = thread.wrlock().unwrap();
+                wrlock.insert_or_replace(1, 1);
+                wrlock.insert_or_replace(1, 2);
+                wrlock.remove(&1).unwrap();
+                wrlock.insert_or_replace(2, 2);
+                wrlock.synchronize();
+            }
+
+            let rdlock = thread.rdlock();
+            assert_eq!(rdlock.get(&1), None);
+            assert_eq!(rdlock.get(&2), Some(&2));
+        }
+
+        check::<crate::DefaultFlavor>();
+        #[cfg(feature = "memb")]
+        check::<flavor::Memb>();
+        #[cfg(feature = "qsbr")]
+        check::<flavor::Qsbr>();
+    }
+
+    #[test]
+    fn reclaim_backpressure() {
+        use crate::{DefaultFlavor, RcuBackpressure, RcuFlavor, RcuHtBuilder, RcuLfhtNode};
+        use std::sync::atomic::{AtomicUsize, Ordering};
+        use std::sync::Arc;
+
+        struct Counted(Arc<AtomicUsize>);
+
+        impl Drop for Counted {
+            fn drop(&mut self) {
+                self.0.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+
+        for backpressure in [RcuBackpressure::Synchronize, RcuBackpressure::Block] {
+            let dropped = Arc::new(AtomicUsize::new(0));
+            let ht: RcuHt<u32, Counted> = RcuHtBuilder::new()
+                .reclaim_batch_size(4)
+                .reclaim_high_water(16, backpressure)
+                .call_rcu_worker(None)
+                .build()
+                .unwrap();
+
+            {
+                let thread = ht.thread();
+                let mut wrlock = thread.wrlock().unwrap();
+                for _ in 0..1000 {
+                    wrlock.insert_or_replace(1, Counted(dropped.clone()));
+
+                    let backlog = ht.reclaim_backlog();
+                    assert!(backlog.nodes <= 16 + 4, "{backpressure:?}: {backlog:?}");
+                    assert_eq!(
+                        backlog.bytes,
+                        backlog.nodes * std::mem::size_of::<RcuLfhtNode<u32, Counted>>()
+                    );
+                }
+            }
+
+            assert_eq!(ht.reclaim_backlog().backpressure_skipped, 0);
+
+            // writers cannot slow down under a read lock: nodes go to call_rcu, the skips are counted
+            #[cfg(not(feature = "qsbr"))]
+            {
+                let thread = ht.thread();
+                let _rdlock = thread.rdlock();
+                let mut wrlock = thread.wrlock().unwrap();
+                for _ in 0..100 {
+                    wrlock.insert_or_replace(1, Counted(dropped.clone()));
+                    assert!(wrlock.guard.retired.len() <= 4, "{backpressure:?}");
+                }
+                assert!(ht.reclaim_backlog().backpressure_skipped > 0);
+            }
+            let skipped = if cfg!(feature = "qsbr") { 0 } else { 100 };
+
+            // the worker is stopped with the hashtable: its callbacks are run by the default worker
+            drop(ht);
+            unsafe { DefaultFlavor::barrier() };
+            assert_eq!(dropped.load(Ordering::Relaxed), 1000 + skipped);
+        }
+    }
+
+    #[test]
+    fn counter_map() {
+        use crate::{RcuCounterMap, RcuCounters};
+        use std::sync::Arc;
+
+        let map: Arc<RcuCounterMap<u32, 2>> =
+            Arc::new(RcuCounterMap::new(64, 64, 0, true).unwrap());
+        {
+            let thread = map.thread();
+            let mut writer = thread.wrlock().unwrap();
+            writer.insert_or_replace(1, RcuCounters::new());
+            writer.insert_or_replace(2, RcuCounters::with_slots(3));
+            writer.insert_or_replace(3, RcuCounters::from_values([10, 20]));
+        }
+
+        let readers: Vec<_> = (0..4)
+            .map(|_| {
+                let map = map.clone();
+                std::thread::spawn(move || {
+                    let thread = map.thread();
+                    for _ in 0..1000 {
+                        let rdlock = thread.rdlock();
+                        assert!(rdlock.add(&1, 0, 1));
+                        assert!(rdlock.add(&2, 1, 2));
+                        rdlock.get(&3).unwrap().incr(0);
+                        assert!(!rdlock.add(&4, 0, 1));
+                    }
+                })
+            })
+            .collect();
+        for reader in readers {
+            reader.join().unwrap();
+        }
+
+        let thread = map.thread();
+        let rdlock = thread.rdlock();
+        assert_eq!(rdlock.counters(&1), Some([4000, 0]));
+        assert_eq!(rdlock.counters(&2), Some([0, 8000]));
+        assert_eq!(rdlock.get(&3).unwrap().get(0), 4010);
+        assert_eq!(rdlock.counters(&4), None);
+        assert_eq!(rdlock.total(), [8010, 8020]);
+
+        let counters = RcuCounters::with_slots_and_values(3, [1, 2]);
+        assert_eq!(counters.sum(), [1, 2]);
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn snapshot() {
+        use crate::{DefaultHashBuilder, RcuHtBuilder};
+
+        let path = std::env::temp_dir().join(format!("urcu-ht-test-{}.snap", std::process::id()));
+        let ht =
+            RcuHt::from_iter_with_capacity((0..10_000u32).map(|i| (i, (i as u64) << 8)), 10_000)
+                .unwrap();
+
+        let written = ht
+            .snapshot_to(std::fs::File::create(&path).unwrap())
+            .unwrap();
+        assert_eq!(written, 10_000);
+
+        let restored = RcuHt::<u32, u64>::load_snapshot(&path).unwrap();
+        {
+            let thread = restored.thread();
+            let rdlock = thread.rdlock();
+            assert_eq!(rdlock.count_nodes(), 10_000);
+            assert!((0..10_000u32).all(|i| rdlock.get(&i) == Some(&((i as u64) << 8))));
+        }
+
+        // other layout, other hasher
+        assert!(RcuHt::<u64, u64>::load_snapshot(&path).is_err());
+        let restored: RcuHt<u32, u64, _> = RcuHtBuilder::new()
+            .hasher(DefaultHashBuilder::with_seed(42))
+            .build_from_snapshot(&path)
+            .unwrap();
+        assert_eq!(restored.thread().rdlock().get(&1234), Some(&(1234 << 8)));
+
+        // truncated file
+        let bytes = std::fs::read(&path).unwrap();
+        std::fs::write(&path, &bytes[..bytes.len() - 12]).unwrap();
+        assert!(RcuHt::<u32, u64>::load_snapshot(&path).is_err());
+
+        // empty hashtable
+        let empty = RcuHt::<u32, u64>::new(64, 64, 0, true).unwrap();
+        assert_eq!(
+            empty
+                .snapshot_to(std::fs::File::create(&path).unwrap())
+                .unwrap(),
+            0
+        );
+        let restored = RcuHt::<u32, u64>::load_snapshot(&path).unwrap();
+        assert_eq!(restored.thread().rdlock().count_nodes(), 0);
+
+        std::fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn ordered_map() {
+        use crate::{RcuError, RcuOrderedMap};
+        use std::sync::Arc;
+
+        let map = Arc::new(RcuOrderedMap::<u32, u32>::new());
+        {
+            let thread = map.thread();
+            let mut writer = thread.wrlock().unwrap();
+            // shuffled insertion order
+            for i in 0..1000u32 {
+                let key = (i * 7919) % 1000;
+                writer.insert_or_replace(key, key);
+            }
+            writer.insert_or_replace(500, 5000);
+            assert!(writer.remove(&999).is_ok());
+            assert!(matches!(writer.remove(&999), Err(RcuError::NotFound)));
+            assert_eq!(writer.get(&500), Some(&5000));
+        }
+        assert_eq!(map.len(), 999);
+
+        {
+            let thread = map.thread();
+            let rdlock = thread.rdlock();
+            assert_eq!(rdlock.get(&500), Some(&5000));
+            assert_eq!(rdlock.get(&999), None);
+            assert_eq!(rdlock.first(), Some((&0, &0)));
+
+            let keys: Vec<_> = rdlock.iter().map(|(k, _)| *k).collect();
+            assert_eq!(keys, (0..999).collect::<Vec<_>>());
+
+            let keys: Vec<_> = rdlock.range(10..15).map(|(k, _)| *k).collect();
+            assert_eq!(keys, [10, 11, 12, 13, 14]);
+            let keys: Vec<_> = rdlock.range(995..=2000).map(|(k, _)| *k).collect();
+            assert_eq!(keys, [995, 996, 997, 998]);
+            let keys: Vec<_> = rdlock
+                .range((std::ops::Bound::Excluded(3), std::ops::Bound::Included(5)))
+                .map(|(k, _)| *k)
+                .collect();
+            assert_eq!(keys, [4, 5]);
+            assert_eq!(rdlock.range(2000..).count(), 0);
+        }
+
+        // readers scan while a writer churns the odd keys: even keys are always there, in order.
+        // qsbr readers would have to announce quiescent states (see the qsbr test)
+        #[cfg(not(feature = "qsbr"))]
+        {
+            use std::sync::atomic::{AtomicBool, Ordering};
+
+            let stop = Arc::new(AtomicBool::new(false));
+            let readers: Vec<_> = (0..2)
+                .map(|_| {
+                    let (map, stop) = (map.clone(), stop.clone());
+                    std::thread::spawn(move || {
+                        let thread = map.thread();
+                        while !stop.load(Ordering::Relaxed) {
+                            let rdlock = thread.rdlock();
+                            let mut last = None;
+                            let mut even = 0;
+                            for (k, _) in rdlock.range(100..900) {
+                                assert!(last < Some(*k));
+                                last = Some(*k);
+                                even += (k % 2 == 0) as u32;
+                            }
+                            assert_eq!(even, 400);
+                        }
+                    })
+                })
+                .collect();
+
+            {
+                let thread = map.thread();
+                for round in 0..50u32 {
+                    let mut writer = thread.wrlock().unwrap();
+                    for key in (1..999).step_by(2) {
+                        if round % 2 == 0 {
+                            writer.remove(&key).unwrap();
+                        } else {
+                            writer.insert_or_replace(key, round);
+                        }
+                    }
+                }
+            }
+
+            stop.store(true, Ordering::Relaxed);
+            for reader in readers {
+                reader.join().unwrap();
+            }
+        }
+    }
+
+    #[cfg(feature = "ffi")]
+    #[test]
+    fn ffi() {
+        use crate::ffi::*;
+        use std::ffi::c_void;
+
+        unsafe {
+            let ht = urcu_ht_new(64, 64, 0, 1);
+            assert!(!ht.is_null());
+            let thread = urcu_ht_thread_new(ht);
+
+            let key = |k: &'static [u8]| (k.as_ptr() as *const c_void, k.len());
+            let (k1, l1) = key(b"flow-1");
+            let (k2, l2) = key(b"flow-2");
+            assert_eq!(urcu_ht_insert(thread, k1, l1, b"one".as_ptr().cast(), 3), 0);
+            assert_eq!(
+                urcu_ht_insert_unique(thread, k1, l1, std::ptr::null(), 0),
+                -libc::EEXIST
+            );
+            assert_eq!(
+                urcu_ht_insert_unique(thread, k2, l2, std::ptr::null(), 0),
+                0
+            );
+
+            let read = urcu_ht_rdlock(thread);
+            let mut value = std::ptr::null();
+            let mut value_len = 0;
+            assert_eq!(urcu_ht_get(read, k1, l1, &mut value, &mut value_len), 0);
+            assert_eq!(
+                std::slice::from_raw_parts(value.cast::<u8>(), value_len),
+                b"one"
+            );
+
+            let keys: Vec<_> = (0..40).map(|i| if i % 2 == 0 { k1 } else { k2 }).collect();
+            let lens: Vec<_> = (0..40).map(|i| if i % 2 == 0 { l1 } else { l2 }).collect();
+            let mut values = vec![std::ptr::null(); 40];
+            let mut value_lens = vec![1; 40];
+            let found = urcu_ht_get_many(
+                read,
+                40,
+                keys.as_ptr(),
+                lens.as_ptr(),
+                values.as_mut_ptr(),
+                value_lens.as_mut_ptr(),
+            );
+            assert_eq!(found, 40);
+            assert_eq!(value_lens[0], 3);
+            assert_eq!(value_lens[1], 0);
+            urcu_ht_rdunlock(read);
+
+            assert_eq!(urcu_ht_remove(thread, k1, l1), 0);
+            assert_eq!(urcu_ht_remove(thread, k1, l1), -libc::ENOENT);
+            let read = urcu_ht_rdlock(thread);
+            assert_eq!(
+                urcu_ht_get(read, k1, l1, &mut value, &mut value_len),
+                -libc::ENOENT
+            );
+            urcu_ht_rdunlock(read);
+
+            // batched writes under a single write lock
+            let writer = urcu_ht_wrlock(thread);
+            assert!(!writer.is_null());
+            assert_eq!(
+                urcu_ht_writer_insert(writer, k1, l1, std::ptr::null(), 0),
+                0
+            );
+            assert_eq!(
+                urcu_ht_writer_insert_unique(writer, k1, l1, std::ptr::null(), 0),
+                -libc::EEXIST
+            );
+            assert_eq!(urcu_ht_writer_remove(writer, k2, l2), 0);
+            assert_eq!(urcu_ht_writer_remove(writer, k2, l2), -libc::ENOENT);
+            urcu_ht_wrunlock(writer);
+            let read = urcu_ht_rdlock(thread);
+            assert_eq!(urcu_ht_get(read, k1, l1, &mut value, &mut value_len), 0);
+            assert_eq!(value_len, 0);
+            urcu_ht_rdunlock(read);
+
+            urcu_ht_thread_free(thread);
+            urcu_ht_destroy(ht);
+
+            // a hashtable of Rust code, shared with C code
+            let ht = RcuHtBytes::new(64, 64, 0, true).unwrap();
+            ht.thread()
+                .writer()
+                .insert_or_replace(b"rust".to_vec().into(), b"yes".to_vec().into());
+            let thread = urcu_ht_thread_new(urcu_ht_from_rust(&ht));
+            let read = urcu_ht_rdlock(thread);
+            let (k, l) = key(b"rust");
+            assert_eq!(urcu_ht_get(read, k, l, &mut value, &mut value_len), 0);
+            assert_eq!(value_len, 3);
+            urcu_ht_rdunlock(read);
+            urcu_ht_thread_free(thread);
+        }
+    }
+
+    #[test]
+    fn arc_values() {
+        use crate::{DefaultFlavor, RcuArcHt, RcuFlavor};
+        use std::sync::Arc;
+
+        let ht: RcuArcHt<u32, String> = RcuArcHt::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        thread
+            .writer()
+            .insert_or_replace(1, Arc::new("first".to_string()));
+
+        let value = thread.rdlock().get_arc(&1).unwrap();
+        assert_eq!(Arc::strong_count(&value), 2);
+
+        // replaced, then released after a grace period: the handle keeps the old value alive
+        {
+            let mut writer = thread.wrlock().unwrap();
+            writer.insert_or_replace(1, Arc::new("second".to_string()));
+            writer.synchronize();
+        }
+        unsafe { DefaultFlavor::barrier() };
+        assert_eq!(*value, "first");
+        assert_eq!(Arc::strong_count(&value), 1);
+
+        let owned = thread.rdlock().get_owned(&1).unwrap();
+        assert_eq!(*owned, "second");
+        assert!(thread.rdlock().get_arc(&2).is_none());
+
+        // get_owned also clones plain values
+        let ht = RcuHt::<u32, u64>::new(64, 64, 0, true).unwrap();
+        let thread = ht.thread();
+        thread.writer().insert_or_replace(1, 10);
+        assert_eq!(thread.rdlock().get_owned(&1), Some(10));
+    }
+
+    #[test]
+    fn ttl() {
+        use crate::{RcuTtl, RcuTtlClock, RcuTtlSweeper};
+        use std::time::Duration;
+
+        let ht = RcuHt::<u32, RcuTtl<u32>>::new(16, 16, 0, true).unwrap();
+        let clock = RcuTtlClock::new(Duration::from_secs(1));
+        let thread = ht.thread();
+
+        {
+            let mut writer = thread.writer();
+            for i in 0..100 {
+                writer.insert_or_replace(i, RcuTtl::new(i, &clock));
+            }
+        }
+
+        // keys below 50 are accessed at tick 5
+        clock.set(5);
+        {
+            let rdlock = thread.rdlock();
+            for i in 0..50 {
+                assert_eq!(rdlock.get_and_touch(&i, &clock), Some(&i));
+            }
+            assert_eq!(rdlock.get(&0).unwrap().last_access(), 5);
+        }
+
+        // a pass over 100 objects takes 7 ticks, an extra tick starts the next pass
+        clock.set(12);
+        let mut sweeper = RcuTtlSweeper::new(10, 16);
+        let mut removed = 0;
+        for _ in 0..8 {
+            let mut writer = thread.writer();
+            let count = sweeper.tick(&clock, &mut writer);
+            assert!(count <= 16);
+            removed += count;
+        }
+        assert_eq!(removed, 50);
+
+        {
+            let rdlock = thread.rdlock();
+            assert_eq!(rdlock.iter().count(), 50);
+            assert!(rdlock.iter().all(|(k, _)| *k < 50));
+        }
+
+        clock.set(16);
+        let mut removed = 0;
+        for _ in 0..8 {
+            removed += sweeper.tick(&clock, &mut thread.writer());
+        }
+        assert_eq!(removed, 50);
+        assert_eq!(thread.rdlock().iter().count(), 0);
+    }
+
+    #[test]
+    fn offline() {
+        use std::sync::Arc;
+
+        let ht = Arc::new(RcuHt::<u32, u32>::new(64, 64, 0, false).unwrap());
+        let mut thread = ht.thread();
+        thread.wrlock().unwrap().insert_or_replace(1, 1);
+
+        // a writer waits for grace periods while this thread is blocked offline
+        let (tx, rx) = std::sync::mpsc::channel();
+        let writer = {
+            let ht = ht.clone();
+            std::thread::spawn(move || {
+                let thread = ht.thread();
+                let mut wrlock = thread.wrlock().unwrap();
+                wrlock.insert_or_replace(1, 2);
+                wrlock.synchronize();
+                drop(wrlock);
+                tx.send(()).unwrap();
+            })
+        };
+        assert_eq!(thread.offline(|| rx.recv()), Ok(()));
+        writer.join().unwrap();
+        assert_eq!(thread.rdlock().get(&1), Some(&2));
+
+        // a read lock of another handle must not be alive
+        if cfg!(debug_assertions) {
+            let other = ht.thread();
+            let rdlock = other.rdlock();
+            let result = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+                thread.offline(|| ());
+            }));
+            assert!(result.is_err());
+            drop(rdlock);
+        }
+        assert_eq!(thread.offline(|| 3), 3);
+    }
+
+    #[cfg(feature = "qsbr")]
+    #[test]
+    fn qsbr() {
+        use crate::flavor::Qsbr;
+        use crate::RcuHtBuilder;
+
+        let ht: RcuHt<u32, u32, _, Qsbr> = RcuHtBuilder::new().flavor::<Qsbr>().build().unwrap();
+        let mut thread = ht.thread();
+
+        {
+            let mut wrlock = thread.wrlock().unwrap();
+            wrlock.insert_or_replace(1, 1);
+            wrlock.insert_or_replace(1, 2);
+            wrlock.synchronize();
+        }
+
+        thread.quiescent_state();
+        assert_eq!(thread.rdlock().get(&1), Some(&2));
+
+        thread.thread_offline();
+        let result = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+            thread.rdlock();
+        }));
+        assert!(result.is_err());
+        thread.thread_online();
+
+        // a read lock of another handle prevents quiescent states
+        let other = ht.thread();
+        let rdlock = other.rdlock();
+        let result = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+            thread.quiescent_state();
+        }));
+        assert!(result.is_err());
+        drop(rdlock);
+        thread.quiescent_state();
+
+        // offline scope: another handle cannot take a read lock, the thread is online again after
+        let result = thread.offline(|| {
+            std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+                other.rdlock();
+            }))
+        });
+        assert!(result.is_err());
+        assert_eq!(thread.rdlock().get(&1), Some(&2));
+
+        // a nested scope does not bring the thread online
+        let mut guard = crate::RcuThreadGuard::<Qsbr>::with_flavor();
+        thread.offline(|| {
+            guard.offline(|| ());
+            let result = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+                other.rdlock();
+            }));
+            assert!(result.is_err());
+        });
+        assert_eq!(guard.rdlock().get(&ht, &1), Some(&2));
+    }
 }
@@ -0,0 +1,541 @@
+//! Ordered map with RCU readers: a skip list, for range and prefix lookups.
+//!
+//! lib urcu does not provide an ordered structure (its red-black tree was never released), so this
+//! skip list is implemented here on top of the same primitives as [`RcuHt`]: readers walk the list
+//! inside a read-side critical section, without lock nor atomic read-modify-write, and a writer
+//! (serialized by a mutex) links and unlinks nodes with release stores. Removed nodes are released
+//! by batches after a grace period, like the objects of a hashtable.
+//!
+//! Nodes are linked bottom-up and unlinked top-down, and a removed (or replaced) node keeps its next
+//! pointers: a reader standing on it still reaches the rest of the list.
+//!
+//! [`RcuHt`]: crate::RcuHt
+use std::borrow::Borrow;
+use std::marker::PhantomData;
+use std::ops::{Bound, RangeBounds};
+use std::sync::atomic::{AtomicPtr, AtomicUsize, Ordering};
+use std::sync::{Mutex, MutexGuard};
+
+use crate::{
+    urcu_thread_register, urcu_thread_unregister, DefaultFlavor, RcuError, RcuFlavor,
+    RcuReadSection,
+};
+
+/// Maximum height of a node: enough for 4^16 objects with a 1/4 probability per level.
+const URCU_SKIP_MAX_LEVEL: usize = 16;
+
+/// Number of removed nodes accumulated before a reclaim batch is given to call_rcu.
+const URCU_SKIP_RECLAIM_BATCH_SIZE: usize = 64;
+
+/// An object of the skip list, linked on `next.len()` levels.
+struct RcuSkipNode<K, V> {
+    key: K,
+    value: V,
+    next: Box<[AtomicPtr<RcuSkipNode<K, V>>]>,
+}
+
+/// Nodes removed together, released by a single RCU callback.
+#[repr(C)]
+struct RcuSkipReclaimBatch<K, V> {
+    /// data structure used for delayed free
+    head: urcu_sys::rcu_head,
+    nodes: Vec<*mut RcuSkipNode<K, V>>,
+}
+
+/// Callback function, called after a grace period, when it is time to free a batch of nodes.
+unsafe extern "C" fn urcu_skip_free_batch<K, V>(head: *mut urcu_sys::rcu_head) {
+    let offset = memoffset::offset_of!(RcuSkipReclaimBatch::<K, V>, head);
+    let batch = Box::from_raw(
+        head.cast::<u8>()
+            .sub(offset)
+            .cast::<RcuSkipReclaimBatch<K, V>>(),
+    );
+
+    for node in batch.nodes {
+        drop(Box::from_raw(node));
+    }
+}
+
+/// Returns true if `key` is before all keys of `bound` (a start bound).
+#[inline]
+fn urcu_skip_before<K, Q>(key: &K, bound: Bound<&Q>) -> bool
+where
+    K: Borrow<Q>,
+    Q: ?Sized + Ord,
+{
+    match bound {
+        Bound::Included(start) => key.borrow() < start,
+        Bound::Excluded(start) => key.borrow() <= start,
+        Bound::Unbounded => false,
+    }
+}
+
+/// Returns true if `key` is after all keys of `bound` (an end bound).
+#[inline]
+fn urcu_skip_after<K, Q>(key: &K, bound: Bound<&Q>) -> bool
+where
+    K: Borrow<Q>,
+    Q: ?Sized + Ord,
+{
+    match bound {
+        Bound::Included(end) => key.borrow() > end,
+        Bound::Excluded(end) => key.borrow() >= end,
+        Bound::Unbounded => false,
+    }
+}
+
+/// Writer state, protected by the write mutex.
+struct RcuOrderedMapState {
+    /// xorshift state, to pick the height of new nodes
+    rng: u64,
+}
+
+/// An ordered map (skip list): lookups and range scans by readers, without lock.
+///
+/// Same thread model as [`crate::RcuHt`]: each thread gets a handle with [`RcuOrderedMap::thread`],
+/// then read locks ([`RcuOrderedMapThread::rdlock`]) or the writer ([`RcuOrderedMapThread::wrlock`]).
+///
+/// ```
+/// use urcu_ht::RcuOrderedMap;
+///
+/// let map = RcuOrderedMap::new();
+/// let thread = map.thread();
+/// {
+///     let mut writer = thread.wrlock().unwrap();
+///     for port in [22u16, 80, 443, 8080] {
+///         writer.insert_or_replace(port, format!("port {port}"));
+///     }
+/// }
+///
+/// let rdlock = thread.rdlock();
+/// let ports: Vec<_> = rdlock.range(80..1024).map(|(port, _)| *port).collect();
+/// assert_eq!(ports, [80, 443]);
+/// ```
+pub struct RcuOrderedMap<K, V, R: RcuFlavor = DefaultFlavor> {
+    /// first node of each level
+    head: [AtomicPtr<RcuSkipNode<K, V>>; URCU_SKIP_MAX_LEVEL],
+    /// number of levels used (readers start their walk there)
+    levels: AtomicUsize,
+    len: AtomicUsize,
+    mutex: Mutex<RcuOrderedMapState>,
+    // nodes are owned through raw pointers, and released from call_rcu worker threads
+    _nodes: PhantomData<(*const RcuSkipNode<K, V>, R)>,
+}
+
+/// RcuOrderedMap can be shared between threads (under std::sync::Arc<>). Keys and values are read
+/// by all threads, and released by call_rcu worker threads.
+unsafe impl<K: Send + Sync, V: Send + Sync, R: RcuFlavor> Send for RcuOrderedMap<K, V, R> {}
+/// RcuOrderedMap can be shared between threads (under std::sync::Arc<>).
+unsafe impl<K: Send + Sync, V: Send + Sync, R: RcuFlavor> Sync for RcuOrderedMap<K, V, R> {}
+
+impl<K: Ord, V> RcuOrderedMap<K, V> {
+    /// An empty map, using the default flavor.
+    pub fn new() -> Self {
+        Self::with_flavor()
+    }
+}
+
+impl<K: Ord, V> Default for RcuOrderedMap<K, V> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<K: Ord, V, R: RcuFlavor> RcuOrderedMap<K, V, R> {
+    /// An empty map, using flavor `R` (see [`crate::flavor`]).
+    pub fn with_flavor() -> Self {
+        R::init();
+
+        RcuOrderedMap {
+            head: std::array::from_fn(|_| AtomicPtr::new(std::ptr::null_mut())),
+            levels: AtomicUsize::new(1),
+            len: AtomicUsize::new(0),
+            mutex: Mutex::new(RcuOrderedMapState {
+                rng: 0x9e37_79b9_7f4a_7c15,
+            }),
+            _nodes: PhantomData,
+        }
+    }
+
+    pub fn thread(&self) -> RcuOrderedMapThread<'_, K, V, R> {
+        RcuOrderedMapThread::new(self)
+    }
+
+    /// Number of objects (a relaxed load: it may not include the last writes of other threads).
+    pub fn len(&self) -> usize {
+        self.len.load(Ordering::Relaxed)
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Next pointers of a node, or of the head.
+    #[inline]
+    unsafe fn next_of(&self, node: *mut RcuSkipNode<K, V>) -> &[AtomicPtr<RcuSkipNode<K, V>>] {
+        if node.is_null() {
+            &self.head
+        } else {
+            &(*node).next
+        }
+    }
+
+    /// Walk down from the top level, and return the last node before `bound` at each level
+    /// (null: the head), and the first node not before `bound`.
+    ///
+    /// Must be called inside a read-side critical section, or by the writer.
+    #[inline]
+    unsafe fn seek<Q>(
+        &self,
+        bound: Bound<&Q>,
+        mut preds: Option<&mut [*mut RcuSkipNode<K, V>; URCU_SKIP_MAX_LEVEL]>,
+    ) -> *mut RcuSkipNode<K, V>
+    where
+        K: Borrow<Q>,
+        Q: ?Sized + Ord,
+    {
+        let mut pred: *mut RcuSkipNode<K, V> = std::ptr::null_mut();
+        let levels = self.levels.load(Ordering::Acquire);
+
+        for level in (0..levels).rev() {
+            loop {
+                let next = self.next_of(pred)[level].load(Ordering::Acquire);
+                if next.is_null() || !urcu_skip_before(&(*next).key, bound) {
+                    break;
+                }
+                pred = next;
+            }
+
+            if let Some(preds) = preds.as_deref_mut() {
+                preds[level] = pred;
+            }
+        }
+
+        self.next_of(pred)[0].load(Ordering::Acquire)
+    }
+}
+
+impl<K, V, R: RcuFlavor> Drop for RcuOrderedMap<K, V, R> {
+    fn drop(&mut self) {
+        // we have a mutable reference: no reader or writer can access this map anymore.
+        // Removed nodes waiting for a grace period are owned by their callbacks.
+        let mut node = *self.head[0].get_mut();
+        while !node.is_null() {
+            let boxed = unsafe { Box::from_raw(node) };
+            node = boxed.next[0].load(Ordering::Relaxed);
+        }
+    }
+}
+
+/// Per thread handle of a [`RcuOrderedMap`], see [`crate::RcuHtThread`].
+///
+/// It registers the current thread if needed, and unregisters it when no more handles are alive
+/// in this thread.
+pub struct RcuOrderedMapThread<'map, K, V, R: RcuFlavor = DefaultFlavor> {
+    map: &'map RcuOrderedMap<K, V, R>,
+    // registration belongs to the current thread
+    _not_send: PhantomData<*const ()>,
+}
+
+impl<'map, K: Ord, V, R: RcuFlavor> RcuOrderedMapThread<'map, K, V, R> {
+    pub fn new(map: &'map RcuOrderedMap<K, V, R>) -> Self {
+        urcu_thread_register::<R>();
+
+        RcuOrderedMapThread {
+            map,
+            _not_send: PhantomData,
+        }
+    }
+
+    pub fn rdlock(&self) -> RcuOrderedMapRead<'_, 'map, K, V, R> {
+        RcuOrderedMapRead {
+            map: self.map,
+            _rcu: RcuReadSection::new(),
+            _thread: PhantomData,
+        }
+    }
+
+    /// Take the write mutex: writers of a map are serialized. Returns None if it is poisoned.
+    pub fn wrlock(&self) -> Option<RcuOrderedMapWriter<'_, 'map, K, V, R>> {
+        match self.map.mutex.lock() {
+            Ok(guard) => Some(RcuOrderedMapWriter {
+                map: self.map,
+                guard,
+                retired: Vec::new(),
+                _thread: PhantomData,
+            }),
+            Err(_err) => None,
+        }
+    }
+}
+
+#[cfg(feature = "qsbr")]
+impl<'map, K, V> RcuOrderedMapThread<'map, K, V, crate::flavor::Qsbr> {
+    /// Announce a quiescent state (QSBR), see [`crate::RcuHtThread::quiescent_state`].
+    pub fn quiescent_state(&mut self) {
+        crate::flavor::Qsbr::quiescent_state();
+    }
+}
+
+impl<'map, K, V, R: RcuFlavor> Drop for RcuOrderedMapThread<'map, K, V, R> {
+    fn drop(&mut self) {
+        urcu_thread_unregister::<R>();
+    }
+}
+
+/// Read lock of a [`RcuOrderedMap`]: references returned are valid until it is released.
+pub struct RcuOrderedMapRead<'thread, 'map, K, V, R: RcuFlavor = DefaultFlavor> {
+    map: &'map RcuOrderedMap<K, V, R>,
+    _rcu: RcuReadSection<R>,
+    _thread: PhantomData<&'thread RcuOrderedMapThread<'map, K, V, R>>,
+}
+
+impl<'rdlock, 'thread, 'map, K: Ord, V, R: RcuFlavor> RcuOrderedMapRead<'thread, 'map, K, V, R> {
+    pub fn get<Q: ?Sized>(&'rdlock self, key: &Q) -> Option<&'rdlock V>
+    where
+        K: Borrow<Q>,
+        Q: Ord,
+    {
+        unsafe {
+            let node = self.map.seek(Bound::Included(key), None);
+            if node.is_null() || (*node).key.borrow() != key {
+                None
+            } else {
+                Some(&(*node).value)
+            }
+        }
+    }
+
+    pub fn contains_key<Q: ?Sized>(&'rdlock self, key: &Q) -> bool
+    where
+        K: Borrow<Q>,
+        Q: Ord,
+    {
+        self.get(key).is_some()
+    }
+
+    /// Object with the smallest key.
+    pub fn first(&'rdlock self) -> Option<(&'rdlock K, &'rdlock V)> {
+        self.iter().next()
+    }
+
+    /// Iterate over all objects, by ascending key.
+    pub fn iter(&'rdlock self) -> RcuOrderedMapRange<'rdlock, K, V, std::ops::RangeFull, K> {
+        self.range(..)
+    }
+
+    /// Iterate over the objects of a range of keys, by ascending key.
+    ///
+    /// Finding the start of the range takes O(log n), then each object costs a pointer load.
+    /// Objects added or removed by a writer during the scan may be visited or not.
+    pub fn range<Q: ?Sized, B>(&'rdlock self, range: B) -> RcuOrderedMapRange<'rdlock, K, V, B, Q>
+    where
+        K: Borrow<Q>,
+        Q: Ord,
+        B: RangeBounds<Q>,
+    {
+        let node = unsafe { self.map.seek(range.start_bound(), None) };
+
+        RcuOrderedMapRange {
+            node,
+            range,
+            _rdlock: PhantomData,
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.map.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.map.is_empty()
+    }
+}
+
+/// Iterator over a range of keys of a [`RcuOrderedMap`], see [`RcuOrderedMapRead::range`].
+pub struct RcuOrderedMapRange<'rdlock, K, V, B, Q: ?Sized> {
+    node: *mut RcuSkipNode<K, V>,
+    range: B,
+    _rdlock: PhantomData<(&'rdlock RcuSkipNode<K, V>, fn(&Q))>,
+}
+
+impl<'rdlock, K, V, B, Q> Iterator for RcuOrderedMapRange<'rdlock, K, V, B, Q>
+where
+    K: Borrow<Q> + 'rdlock,
+    V: 'rdlock,
+    Q: ?Sized + Ord,
+    B: RangeBounds<Q>,
+{
+    type Item = (&'rdlock K, &'rdlock V);
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.node.is_null() {
+            return None;
+        }
+
+        // the read lock is held as long as 'rdlock: nodes cannot be released
+        unsafe {
+            let node = &*self.node;
+            if urcu_skip_after(&node.key, self.range.end_bound()) {
+                self.node = std::ptr::null_mut();
+                return None;
+            }
+
+            self.node = node.next[0].load(Ordering::Acquire);
+            Some((&node.key, &node.value))
+        }
+    }
+}
+
+/// Writer of a [`RcuOrderedMap`], holding its write mutex.
+///
+/// Removed (or replaced) objects are released by batches after a grace period, when a batch is full
+/// and when the writer is dropped.
+pub struct RcuOrderedMapWriter<'thread, 'map, K, V, R: RcuFlavor = DefaultFlavor> {
+    map: &'map RcuOrderedMap<K, V, R>,
+    guard: MutexGuard<'map, RcuOrderedMapState>,
+    retired: Vec<*mut RcuSkipNode<K, V>>,
+    _thread: PhantomData<&'thread RcuOrderedMapThread<'map, K, V, R>>,
+}
+
+impl<'thread, 'map, K: Ord, V, R: RcuFlavor> RcuOrderedMapWriter<'thread, 'map, K, V, R> {
+    /// Height of a new node: level `n` is used with probability 1/4^n.
+    fn random_height(&mut self) -> usize {
+        let state = &mut self.guard.rng;
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+
+        (1 + state.trailing_zeros() as usize / 2).min(URCU_SKIP_MAX_LEVEL)
+    }
+
+    /// Insert an object, or replace the value of an existing key.
+    pub fn insert_or_replace(&mut self, key: K, value: V) {
+        let map = self.map;
+        let mut preds = [std::ptr::null_mut(); URCU_SKIP_MAX_LEVEL];
+
+        unsafe {
+            let found = map.seek(Bound::Included(&key), Some(&mut preds));
+
+            if !found.is_null() && (*found).key == key {
+                // same height: the new node takes the place of the old one at each level
+                let next = (*found)
+                    .next
+                    .iter()
+                    .map(|next| AtomicPtr::new(next.load(Ordering::Relaxed)))
+                    .collect();
+                let node = Box::into_raw(Box::new(RcuSkipNode { key, value, next }));
+
+                for (level, pred) in preds.iter().enumerate().take((&(*node).next).len()) {
+                    map.next_of(*pred)[level].store(node, Ordering::Release);
+                }
+
+                self.retire(found);
+                return;
+            }
+
+            let height = self.random_height();
+            let levels = map.levels.load(Ordering::Relaxed);
+
+            // levels above the current ones start at the head (their preds are still null)
+            let next = (0..height)
+                .map(|level| {
+                    AtomicPtr::new(map.next_of(preds[level])[level].load(Ordering::Relaxed))
+                })
+                .collect();
+            let node = Box::into_raw(Box::new(RcuSkipNode { key, value, next }));
+
+            // bottom-up: a reader reaching the node at some level finds it at lower levels too
+            for (level, pred) in preds.iter().enumerate().take(height) {
+                map.next_of(*pred)[level].store(node, Ordering::Release);
+            }
+
+            if height > levels {
+                map.levels.store(height, Ordering::Release);
+            }
+        }
+
+        self.map.len.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Remove an object. Returns [`RcuError::NotFound`] if the key is not found.
+    pub fn remove<Q: ?Sized>(&mut self, key: &Q) -> Result<(), RcuError>
+    where
+        K: Borrow<Q>,
+        Q: Ord,
+    {
+        let map = self.map;
+        let mut preds = [std::ptr::null_mut(); URCU_SKIP_MAX_LEVEL];
+
+        unsafe {
+            let found = map.seek(Bound::Included(key), Some(&mut preds));
+            if found.is_null() || (*found).key.borrow() != key {
+                return Err(RcuError::NotFound);
+            }
+
+            // top-down: the node stays reachable at lower levels until it is unlinked from all of them
+            for level in (0..(&(*found).next).len()).rev() {
+                let next = (*found).next[level].load(Ordering::Relaxed);
+                map.next_of(preds[level])[level].store(next, Ordering::Release);
+            }
+
+            self.retire(found);
+        }
+
+        self.map.len.fetch_sub(1, Ordering::Relaxed);
+        Ok(())
+    }
+
+    /// Get a value. No other writer can remove it while this writer is alive.
+    pub fn get<Q: ?Sized>(&self, key: &Q) -> Option<&V>
+    where
+        K: Borrow<Q>,
+        Q: Ord,
+    {
+        unsafe {
+            let node = self.map.seek(Bound::Included(key), None);
+            if node.is_null() || (*node).key.borrow() != key {
+                None
+            } else {
+                Some(&(*node).value)
+            }
+        }
+    }
+
+    /// Queue an unlinked node, released after a grace period.
+    fn retire(&mut self, node: *mut RcuSkipNode<K, V>) {
+        self.retired.push(node);
+        if self.retired.len() >= URCU_SKIP_RECLAIM_BATCH_SIZE {
+            self.flush();
+        }
+    }
+
+    /// Give removed nodes to call_rcu now, instead of waiting for a full batch or for the end
+    /// of this writer.
+    pub fn flush(&mut self) {
+        urcu_skip_queue_batch::<K, V, R>(&mut self.retired);
+    }
+}
+
+/// Give `retired` nodes to call_rcu, as a single batch.
+fn urcu_skip_queue_batch<K, V, R: RcuFlavor>(retired: &mut Vec<*mut RcuSkipNode<K, V>>) {
+    if retired.is_empty() {
+        return;
+    }
+
+    let batch = Box::into_raw(Box::new(RcuSkipReclaimBatch {
+        head: unsafe { std::mem::zeroed() },
+        nodes: std::mem::take(retired),
+    }));
+
+    unsafe {
+        R::call_rcu(&mut (*batch).head, urcu_skip_free_batch::<K, V>);
+    }
+}
+
+impl<'thread, 'map, K, V, R: RcuFlavor> Drop for RcuOrderedMapWriter<'thread, 'map, K, V, R> {
+    /// Queue nodes removed by this writer before releasing the write mutex.
+    fn drop(&mut self) {
+        urcu_skip_queue_batch::<K, V, R>(&mut self.retired);
+    }
+}
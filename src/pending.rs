@@ -0,0 +1,85 @@
+//! Queue of deferred write operations.
+//!
+//! Any thread can push operations without taking the write mutex (a compare-and-swap loop on a
+//! Treiber stack, no lock, no allocation besides the operation itself). A writer applies them later, all at once
+//! (see [`crate::RcuHtWriter::apply_pending`]): latency-sensitive threads can delegate their rare
+//! writes instead of waiting for the write mutex.
+use std::ptr;
+use std::sync::atomic::{AtomicPtr, Ordering};
+
+/// A write operation deferred with [`crate::RcuHt::defer`].
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum RcuHtOp<K, V> {
+    /// Same as [`crate::RcuHtWriter::insert_or_replace`].
+    InsertOrReplace(K, V),
+    /// Same as [`crate::RcuHtWriter::remove`]. Removing a key not found is not an error.
+    Remove(K),
+}
+
+struct RcuHtPendingNode<K, V> {
+    op: RcuHtOp<K, V>,
+    next: *mut RcuHtPendingNode<K, V>,
+}
+
+/// Lock-free multi producer / single consumer queue: producers push on a stack,
+/// the consumer takes the whole stack at once and reverses it.
+pub(crate) struct RcuHtPending<K, V> {
+    head: AtomicPtr<RcuHtPendingNode<K, V>>,
+}
+
+impl<K, V> RcuHtPending<K, V> {
+    pub(crate) fn new() -> Self {
+        RcuHtPending {
+            head: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    pub(crate) fn push(&self, op: RcuHtOp<K, V>) {
+        let node = Box::into_raw(Box::new(RcuHtPendingNode {
+            op,
+            next: ptr::null_mut(),
+        }));
+
+        let mut head = self.head.load(Ordering::Relaxed);
+        loop {
+            unsafe {
+                (*node).next = head;
+            }
+
+            match self
+                .head
+                .compare_exchange_weak(head, node, Ordering::Release, Ordering::Relaxed)
+            {
+                Ok(_) => return,
+                Err(current) => head = current,
+            }
+        }
+    }
+
+    /// Returns true if no operation is queued (it may change right after).
+    pub(crate) fn is_empty(&self) -> bool {
+        self.head.load(Ordering::Relaxed).is_null()
+    }
+
+    /// Take all queued operations, in the order they were pushed
+    /// (only ordered per producer thread: producers race with each other).
+    pub(crate) fn take(&self) -> Vec<RcuHtOp<K, V>> {
+        let mut node = self.head.swap(ptr::null_mut(), Ordering::Acquire);
+        let mut ops = Vec::new();
+
+        while !node.is_null() {
+            let boxed = unsafe { Box::from_raw(node) };
+            node = boxed.next;
+            ops.push(boxed.op);
+        }
+
+        ops.reverse();
+        ops
+    }
+}
+
+impl<K, V> Drop for RcuHtPending<K, V> {
+    fn drop(&mut self) {
+        self.take();
+    }
+}
@@ -0,0 +1,246 @@
+//! Optional slab allocator for hashtable nodes.
+//!
+//! Without a pool, every insertion allocates a node with the global allocator, and the node is
+//! released by the call_rcu worker thread: allocation and free always happen on different threads.
+//! With a pool, nodes are carved out of large slabs. The writer keeps a private free list (it lives in
+//! the writer guard, under the write mutex), and RCU callbacks give released nodes back by batches
+//! through a single shared list.
+use std::alloc::Layout;
+use std::sync::Mutex;
+
+/// Configuration of a per hashtable node pool (see [`crate::RcuHt::with_node_pool`]).
+#[derive(Clone, Copy, Debug)]
+pub struct RcuNodePoolConfig {
+    /// Number of nodes allocated at once in a single slab.
+    pub slab_nodes: usize,
+    /// Maximum memory (in bytes) kept in slabs.
+    /// Once reached, new nodes are allocated (and released) one by one with the global allocator.
+    pub max_bytes: usize,
+    /// Place nodes so that none of them is split across two cache lines.
+    ///
+    /// Node size is rounded up to the next power of two (up to a cache line), or to a multiple of
+    /// a cache line for larger nodes, and slabs are aligned on a cache line. A lookup of a small
+    /// key/value then touches a single cache line per node, at the cost of some padding.
+    pub cache_line_aligned: bool,
+    /// Bind slab memory to this NUMA node (Linux only, best effort: ignored if the kernel refuses it).
+    ///
+    /// Slabs are then page aligned, so the memory of a node is never shared with another allocation.
+    pub numa_node: Option<usize>,
+}
+
+impl Default for RcuNodePoolConfig {
+    fn default() -> Self {
+        RcuNodePoolConfig {
+            slab_nodes: 1024,
+            max_bytes: 64 * 1024 * 1024,
+            cache_line_aligned: false,
+            numa_node: None,
+        }
+    }
+}
+
+/// Cache line size assumed for node placement.
+const CACHE_LINE_SIZE: usize = 64;
+
+/// Layout of a node padded and aligned so that it never crosses a cache line boundary
+/// (when it fits in a single cache line).
+fn cache_line_layout(layout: Layout) -> Option<Layout> {
+    let size = if layout.size() <= CACHE_LINE_SIZE {
+        layout.size().next_power_of_two()
+    } else {
+        layout.size().checked_add(CACHE_LINE_SIZE - 1)? & !(CACHE_LINE_SIZE - 1)
+    };
+    let align = size.min(CACHE_LINE_SIZE).max(layout.align());
+
+    Layout::from_size_align(size, align).ok()
+}
+
+/// Page size assumed for slabs bound to a NUMA node.
+const PAGE_SIZE: usize = 4096;
+
+/// Bind memory to a NUMA node (mbind with MPOL_BIND), moving pages already touched.
+#[cfg(target_os = "linux")]
+unsafe fn bind_to_numa_node(ptr: *mut u8, len: usize, node: usize) {
+    const MPOL_BIND: libc::c_long = 2;
+    const MPOL_MF_MOVE: libc::c_long = 1 << 1;
+
+    let mut nodemask = [0 as libc::c_ulong; 16];
+    let bits = libc::c_ulong::BITS as usize;
+    if node >= nodemask.len() * bits {
+        return;
+    }
+    nodemask[node / bits] |= 1 << (node % bits);
+
+    // errors are ignored: memory is still usable, only its placement is not guaranteed
+    libc::syscall(
+        libc::SYS_mbind,
+        ptr,
+        len,
+        MPOL_BIND,
+        nodemask.as_ptr(),
+        nodemask.len() * bits + 1,
+        MPOL_MF_MOVE,
+    );
+}
+
+#[cfg(not(target_os = "linux"))]
+unsafe fn bind_to_numa_node(_ptr: *mut u8, _len: usize, _node: usize) {}
+
+/// A slab is a single allocation containing `slab_nodes` nodes.
+struct RcuSlab {
+    ptr: *mut u8,
+    layout: Layout,
+}
+
+/// Type erased node allocator: it only knows about the layout of a node.
+pub(crate) struct RcuNodePool {
+    /// layout of a single node (including padding, if any)
+    layout: Layout,
+    config: RcuNodePoolConfig,
+    /// all slabs allocated so far, sorted by address. Slabs are only released with the pool.
+    slabs: Mutex<Vec<RcuSlab>>,
+    /// nodes given back by RCU callbacks, waiting to be taken by the writer
+    returned: Mutex<Vec<*mut u8>>,
+}
+
+impl RcuNodePool {
+    pub(crate) fn new(layout: Layout, config: RcuNodePoolConfig) -> Result<Self, crate::RcuError> {
+        if config.slab_nodes == 0 || layout.size() == 0 {
+            return Err(crate::RcuError::InvalidParameters);
+        }
+
+        let layout = match config.cache_line_aligned {
+            true => cache_line_layout(layout).ok_or(crate::RcuError::InvalidParameters)?,
+            false => layout,
+        };
+
+        Ok(RcuNodePool {
+            layout,
+            config,
+            slabs: Mutex::new(Vec::new()),
+            returned: Mutex::new(Vec::new()),
+        })
+    }
+
+    /// Get memory for a new node.
+    ///
+    /// `local` is the writer private free list. It is refilled (from nodes returned by RCU callbacks,
+    /// or from a new slab) only when empty, so the shared lock is taken once per batch of nodes.
+    pub(crate) unsafe fn alloc(&self, local: &mut Vec<*mut u8>) -> *mut u8 {
+        if local.is_empty() {
+            std::mem::swap(local, &mut *self.returned.lock().unwrap());
+        }
+
+        if local.is_empty() {
+            self.grow(local);
+        }
+
+        match local.pop() {
+            Some(ptr) => ptr,
+            None => {
+                // slab memory limit reached: fallback to global allocator
+                let ptr = std::alloc::alloc(self.layout);
+                if ptr.is_null() {
+                    std::alloc::handle_alloc_error(self.layout);
+                }
+                ptr
+            }
+        }
+    }
+
+    /// Allocate a new slab and push all its nodes in `local`, unless the memory limit is reached.
+    unsafe fn grow(&self, local: &mut Vec<*mut u8>) {
+        let mut size = self.layout.size() * self.config.slab_nodes;
+        let mut align = self.layout.align();
+        if self.config.numa_node.is_some() {
+            size = (size + PAGE_SIZE - 1) & !(PAGE_SIZE - 1);
+            align = align.max(PAGE_SIZE);
+        }
+
+        let mut slabs = self.slabs.lock().unwrap();
+
+        if (slabs.len() + 1) * size > self.config.max_bytes {
+            return;
+        }
+
+        let layout = match Layout::from_size_align(size, align) {
+            Ok(layout) => layout,
+            Err(_) => return,
+        };
+
+        let ptr = std::alloc::alloc(layout);
+        if ptr.is_null() {
+            std::alloc::handle_alloc_error(layout);
+        }
+
+        if let Some(node) = self.config.numa_node {
+            bind_to_numa_node(ptr, size, node);
+        }
+
+        let pos = slabs.partition_point(|slab| slab.ptr < ptr);
+        slabs.insert(pos, RcuSlab { ptr, layout });
+
+        local.reserve(self.config.slab_nodes);
+        // push in reverse order so nodes are used in ascending address order
+        for i in (0..self.config.slab_nodes).rev() {
+            local.push(ptr.add(i * self.layout.size()));
+        }
+    }
+
+    /// Give back unused nodes of a writer private free list.
+    pub(crate) fn give_back(&self, local: &mut Vec<*mut u8>) {
+        if !local.is_empty() {
+            self.returned.lock().unwrap().append(local);
+        }
+    }
+
+    /// Give back a batch of nodes. Called from RCU callbacks, after a grace period.
+    /// Node contents must already be dropped.
+    pub(crate) unsafe fn free<I>(&self, nodes: I)
+    where
+        I: Iterator<Item = *mut u8>,
+    {
+        let slabs = self.slabs.lock().unwrap();
+        let mut returned = self.returned.lock().unwrap();
+
+        for ptr in nodes {
+            if urcu_slabs_contain(&slabs, ptr) {
+                returned.push(ptr);
+            } else {
+                std::alloc::dealloc(ptr, self.layout);
+            }
+        }
+    }
+
+    /// Give back a node which was never published (no grace period needed) to the writer private
+    /// free list `local`, or to the global allocator if it was allocated there.
+    /// Node contents must already be dropped.
+    pub(crate) unsafe fn free_unpublished(&self, ptr: *mut u8, local: &mut Vec<*mut u8>) {
+        if urcu_slabs_contain(&self.slabs.lock().unwrap(), ptr) {
+            local.push(ptr);
+        } else {
+            std::alloc::dealloc(ptr, self.layout);
+        }
+    }
+}
+
+/// Returns true if `ptr` is a node of one of `slabs` (sorted by address).
+unsafe fn urcu_slabs_contain(slabs: &[RcuSlab], ptr: *mut u8) -> bool {
+    // look for the last slab starting before this node
+    let pos = slabs.partition_point(|slab| slab.ptr <= ptr);
+    pos > 0 && {
+        let slab = &slabs[pos - 1];
+        ptr < slab.ptr.add(slab.layout.size())
+    }
+}
+
+impl Drop for RcuNodePool {
+    /// Release all slabs. No node of this pool must be reachable anymore.
+    fn drop(&mut self) {
+        for slab in self.slabs.get_mut().unwrap().drain(..) {
+            unsafe {
+                std::alloc::dealloc(slab.ptr, slab.layout);
+            }
+        }
+    }
+}
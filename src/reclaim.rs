@@ -0,0 +1,158 @@
+//! Accounting of removed objects not released yet, writer back-pressure and call_rcu workers.
+//!
+//! Writers give removed (or replaced) objects to call_rcu by batches, and a call_rcu worker thread
+//! releases them after a grace period. If writers retire objects faster than the worker releases
+//! them, callbacks pile up and memory grows without limit. Every hashtable counts objects queued
+//! this way, and above a high-water mark (see [`crate::RcuHtBuilder::reclaim_high_water`]),
+//! writers slow down until the backlog is released.
+//!
+//! A writer cannot wait for a grace period while its thread holds a read lock: it then gives its
+//! objects to call_rcu without slowing down, and counts it in
+//! [`RcuReclaimBacklog::backpressure_skipped`].
+//!
+//! By default, all hashtables share the call_rcu worker of lib urcu. A hashtable can get its own
+//! worker (see [`crate::RcuHtBuilder::call_rcu_worker`]), and lib urcu can start one worker per
+//! CPU (see [`create_per_cpu_call_rcu_workers`]).
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::Arc;
+
+use crate::{RcuError, RcuFlavor};
+
+/// What a writer does when the reclaim backlog of its hashtable is above the high-water mark.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum RcuBackpressure {
+    /// Wait for a grace period before each write operation (synchronize_rcu), and release
+    /// the objects retired by this writer from the current thread instead of using call_rcu.
+    Synchronize,
+    /// Wait until all queued call_rcu callbacks of the flavor are done (rcu_barrier).
+    Block,
+}
+
+/// Objects removed (or replaced) from a hashtable and not released yet (see [`crate::RcuHt::reclaim_backlog`]).
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct RcuReclaimBacklog {
+    /// objects given to call_rcu, waiting for a grace period
+    pub nodes: usize,
+    /// memory of these objects, in bytes (only node size: memory owned by keys and values is not known)
+    pub bytes: usize,
+    /// write operations above the high-water mark which did not slow down, because a read lock
+    /// of the writer thread was alive (the backlog keeps growing meanwhile)
+    pub backpressure_skipped: u64,
+}
+
+/// Reclaim settings and backlog of a hashtable.
+pub(crate) struct RcuReclaim {
+    /// objects given to call_rcu and not released yet (shared with queued batches)
+    pub(crate) queued: Arc<AtomicUsize>,
+    /// size of a node, in bytes
+    node_size: usize,
+    /// backlog above which writers slow down (usize::MAX: never)
+    high_water: usize,
+    pub(crate) backpressure: RcuBackpressure,
+    /// write operations which could not slow down (read lock alive)
+    skipped: AtomicU64,
+    /// dedicated call_rcu worker of this hashtable (null: worker of the thread, of the CPU, or default one)
+    crdp: *mut urcu_sys::call_rcu_data,
+}
+
+impl RcuReclaim {
+    pub(crate) fn new(
+        node_size: usize,
+        high_water: Option<(usize, RcuBackpressure)>,
+        crdp: *mut urcu_sys::call_rcu_data,
+    ) -> Self {
+        let (high_water, backpressure) = high_water.unwrap_or((usize::MAX, RcuBackpressure::Block));
+
+        RcuReclaim {
+            queued: Arc::new(AtomicUsize::new(0)),
+            node_size,
+            high_water,
+            backpressure,
+            skipped: AtomicU64::new(0),
+            crdp,
+        }
+    }
+
+    pub(crate) fn backlog(&self) -> RcuReclaimBacklog {
+        let nodes = self.queued.load(Ordering::Relaxed);
+
+        RcuReclaimBacklog {
+            nodes,
+            bytes: nodes.saturating_mul(self.node_size),
+            backpressure_skipped: self.skipped.load(Ordering::Relaxed),
+        }
+    }
+
+    /// Count a write operation above the high-water mark which could not slow down.
+    pub(crate) fn backpressure_skipped(&self) {
+        self.skipped.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Returns true if writers must slow down, with `retired` objects not given to call_rcu yet.
+    #[inline]
+    pub(crate) fn over_high_water(&self, retired: usize) -> bool {
+        self.high_water != usize::MAX
+            && self.queued.load(Ordering::Relaxed).saturating_add(retired) > self.high_water
+    }
+
+    /// Queue a batch of `count` objects: call_rcu on the worker of this hashtable if any.
+    pub(crate) unsafe fn call_rcu<R: RcuFlavor>(
+        &self,
+        head: *mut urcu_sys::rcu_head,
+        func: unsafe extern "C" fn(head: *mut urcu_sys::rcu_head),
+        count: usize,
+    ) {
+        self.queued.fetch_add(count, Ordering::Relaxed);
+
+        if self.crdp.is_null() {
+            R::call_rcu(head, func);
+        } else {
+            // call_rcu uses the worker of the current thread first
+            let previous = R::get_thread_call_rcu_data();
+            R::set_thread_call_rcu_data(self.crdp);
+            R::call_rcu(head, func);
+            R::set_thread_call_rcu_data(previous);
+        }
+    }
+
+    /// Stop the dedicated worker, if any: its pending callbacks move to the default worker.
+    pub(crate) unsafe fn free_worker<R: RcuFlavor>(&mut self) {
+        if !self.crdp.is_null() {
+            R::call_rcu_data_free(self.crdp);
+            self.crdp = std::ptr::null_mut();
+        }
+    }
+}
+
+/// Start a call_rcu worker thread for a single hashtable, pinned to `cpu` if any.
+pub(crate) fn urcu_create_call_rcu_worker<R: RcuFlavor>(
+    cpu: Option<usize>,
+) -> Result<*mut urcu_sys::call_rcu_data, RcuError> {
+    let cpu_affinity = match cpu {
+        Some(cpu) => libc::c_int::try_from(cpu).map_err(|_| RcuError::InvalidParameters)?,
+        None => -1,
+    };
+
+    let crdp = unsafe { R::create_call_rcu_data(0, cpu_affinity) };
+    if crdp.is_null() {
+        return Err(RcuError::InvalidParameters);
+    }
+
+    Ok(crdp)
+}
+
+/// Start one call_rcu worker thread per CPU, pinned to its CPU, for flavor `R`
+/// (lib urcu `create_all_cpu_call_rcu_data`).
+///
+/// Callbacks queued by a thread are then run by the worker of the CPU this thread runs on
+/// (unless its hashtable has its own worker), instead of a single worker for the whole process.
+/// Workers run until the end of the process. Fails if per CPU workers are not supported, or
+/// if they already exist.
+pub fn create_per_cpu_call_rcu_workers<R: RcuFlavor>() -> Result<(), RcuError> {
+    R::init();
+
+    match unsafe { R::create_all_cpu_call_rcu_data(0) } {
+        0 => Ok(()),
+        _ => Err(RcuError::InvalidParameters),
+    }
+}
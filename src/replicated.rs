@@ -0,0 +1,329 @@
+//! Read-mostly hashtable replicated on each NUMA node.
+//!
+//! There is one [`RcuHt`] replica per NUMA node. Every write is applied to all replicas
+//! (under the write lock of every replica), and readers only use the replica of their own node:
+//! a lookup never touches memory of another socket.
+//!
+//! Replica memory is placed on its node:
+//! - the bucket table is allocated (and first touched) by a thread running on the node.
+//!   Resizes done later by lib urcu worker threads may allocate memory elsewhere:
+//!   size the replicas up front (see [`RcuHtBuilder::init_size`]).
+//! - objects are allocated from a node pool whose slabs are bound to the node
+//!   (see [`RcuNodePoolConfig::numa_node`]).
+use std::borrow::Borrow;
+use std::hash::{BuildHasher, Hash};
+
+use crate::{
+    urcu_key_hash, DefaultFlavor, DefaultHashBuilder, RcuError, RcuFlavor, RcuHt, RcuHtBuilder,
+    RcuHtRead, RcuHtThread, RcuHtWriter, RcuNodePoolConfig,
+};
+
+/// NUMA nodes of the machine, and their CPUs.
+#[derive(Clone, Debug)]
+pub(crate) struct NumaTopology {
+    /// NUMA node id of each replica
+    nodes: Vec<usize>,
+    /// replica index of each CPU (indexed by CPU id)
+    cpu_replica: Vec<usize>,
+    /// CPUs of each replica
+    cpus: Vec<Vec<usize>>,
+}
+
+/// Parse a Linux cpu/node list ("0-3,8,10-11").
+fn parse_list(list: &str) -> Vec<usize> {
+    let mut ids = Vec::new();
+
+    for range in list.trim().split(',').filter(|range| !range.is_empty()) {
+        let (first, last) = match range.split_once('-') {
+            Some((first, last)) => (first.parse::<usize>(), last.parse::<usize>()),
+            None => (range.parse::<usize>(), range.parse::<usize>()),
+        };
+
+        if let (Ok(first), Ok(last)) = (first, last) {
+            ids.extend(first..=last);
+        }
+    }
+
+    ids
+}
+
+impl NumaTopology {
+    /// Read the topology from sysfs. Without NUMA information, all CPUs are on a single node.
+    pub(crate) fn detect() -> Self {
+        let read = |path: &str| std::fs::read_to_string(path).ok();
+
+        let nodes = read("/sys/devices/system/node/online")
+            .map(|list| parse_list(&list))
+            .unwrap_or_default();
+
+        if nodes.is_empty() {
+            return Self::new(vec![0], vec![Vec::new()]);
+        }
+
+        let cpus: Vec<Vec<usize>> = nodes
+            .iter()
+            .map(|node| {
+                read(&format!("/sys/devices/system/node/node{}/cpulist", node))
+                    .map(|list| parse_list(&list))
+                    .unwrap_or_default()
+            })
+            .collect();
+
+        Self::new(nodes, cpus)
+    }
+
+    /// `cpus[i]` are the CPUs of NUMA node `nodes[i]`.
+    pub(crate) fn new(nodes: Vec<usize>, cpus: Vec<Vec<usize>>) -> Self {
+        let max_cpu = cpus.iter().flatten().copied().max().unwrap_or(0);
+        let mut cpu_replica = vec![0; max_cpu + 1];
+
+        for (replica, cpus) in cpus.iter().enumerate() {
+            for cpu in cpus {
+                cpu_replica[*cpu] = replica;
+            }
+        }
+
+        NumaTopology {
+            nodes,
+            cpu_replica,
+            cpus,
+        }
+    }
+
+    /// Replica index of the CPU the current thread is running on.
+    fn current_replica(&self) -> usize {
+        #[cfg(target_os = "linux")]
+        let cpu = unsafe { libc::sched_getcpu() };
+        #[cfg(not(target_os = "linux"))]
+        let cpu = -1;
+
+        usize::try_from(cpu)
+            .ok()
+            .and_then(|cpu| self.cpu_replica.get(cpu).copied())
+            .unwrap_or(0)
+    }
+}
+
+/// Run the current thread on these CPUs only (best effort).
+#[cfg(target_os = "linux")]
+fn bind_current_thread(cpus: &[usize]) {
+    if cpus.is_empty() {
+        return;
+    }
+
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        for cpu in cpus.iter().filter(|cpu| **cpu < libc::CPU_SETSIZE as usize) {
+            libc::CPU_SET(*cpu, &mut set);
+        }
+        libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set);
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn bind_current_thread(_cpus: &[usize]) {}
+
+/// A hashtable with one [`RcuHt`] replica per NUMA node.
+///
+/// Writes are applied to every replica, so keys and values must be Clone.
+/// Best suited for small, read-mostly tables read by every socket.
+///
+/// ```
+/// use urcu_ht::{RcuHtBuilder, ReplicatedRcuHt};
+///
+/// let ht = ReplicatedRcuHt::<u32, u32>::with_builder(RcuHtBuilder::new()).unwrap();
+/// let thread = ht.thread();
+/// thread.wrlock().unwrap().insert_or_replace(1, 10);
+///
+/// let read = thread.rdlock();
+/// assert_eq!(read.get(&1), Some(&10));
+/// ```
+pub struct ReplicatedRcuHt<K, V, S = DefaultHashBuilder, R: RcuFlavor = DefaultFlavor> {
+    replicas: Vec<RcuHt<K, V, S, R>>,
+    topology: NumaTopology,
+}
+
+impl<K, V, S, R> ReplicatedRcuHt<K, V, S, R>
+where
+    K: Hash + Eq + Send,
+    V: Send,
+    S: BuildHasher + Clone + Send,
+    R: RcuFlavor,
+{
+    /// Allocate one replica per NUMA node, each of them built by `builder`.
+    ///
+    /// Replicas always use a node pool (the default one if `builder` has none), bound to their node.
+    pub fn with_builder(builder: RcuHtBuilder<S, R>) -> Result<Self, RcuError> {
+        Self::with_topology(builder, NumaTopology::detect())
+    }
+
+    pub(crate) fn with_topology(
+        builder: RcuHtBuilder<S, R>,
+        topology: NumaTopology,
+    ) -> Result<Self, RcuError> {
+        if topology.nodes.is_empty() {
+            return Err(RcuError::InvalidParameters);
+        }
+
+        let replicas = std::thread::scope(|scope| {
+            let threads: Vec<_> = topology
+                .nodes
+                .iter()
+                .zip(&topology.cpus)
+                .map(|(node, cpus)| {
+                    let pool = RcuNodePoolConfig {
+                        numa_node: Some(*node),
+                        ..builder.pool.unwrap_or_default()
+                    };
+                    let builder = builder.clone().node_pool(pool);
+
+                    // buckets are first touched by a thread running on the node
+                    scope.spawn(move || {
+                        bind_current_thread(cpus);
+                        builder.build::<K, V>()
+                    })
+                })
+                .collect();
+
+            threads
+                .into_iter()
+                .map(|thread| thread.join().unwrap())
+                .collect::<Result<Vec<_>, _>>()
+        })?;
+
+        Ok(ReplicatedRcuHt { replicas, topology })
+    }
+}
+
+impl<K, V, S, R> ReplicatedRcuHt<K, V, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Get a per thread handle, bound to the replica of the NUMA node the thread is running on.
+    ///
+    /// The replica is chosen once, when this handle is created: reader threads should be pinned
+    /// to a node (or to a CPU), otherwise they may read a remote replica after a migration.
+    pub fn thread(&self) -> ReplicatedRcuHtThread<'_, K, V, S, R> {
+        ReplicatedRcuHtThread {
+            local: self.topology.current_replica(),
+            threads: self
+                .replicas
+                .iter()
+                .map(|replica| replica.thread())
+                .collect(),
+        }
+    }
+
+    /// Number of replicas (NUMA nodes).
+    pub fn replica_count(&self) -> usize {
+        self.replicas.len()
+    }
+
+    /// Resize every replica to `new_size` buckets, one replica after the other
+    /// (see [`RcuHt::resize`]).
+    pub fn resize(&self, new_size: u64) -> Result<(), RcuError> {
+        self.replicas
+            .iter()
+            .try_for_each(|replica| replica.resize(new_size))
+    }
+}
+
+/// Per thread handle of a [`ReplicatedRcuHt`].
+pub struct ReplicatedRcuHtThread<'ht, K, V, S = DefaultHashBuilder, R: RcuFlavor = DefaultFlavor> {
+    /// replica of the NUMA node of this thread
+    local: usize,
+    threads: Vec<RcuHtThread<'ht, K, V, S, R>>,
+}
+
+impl<'ht, K, V, S, R> ReplicatedRcuHtThread<'ht, K, V, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Take a read lock on the local replica.
+    pub fn rdlock(&self) -> RcuHtRead<'_, '_, K, V, S, R> {
+        self.threads[self.local].rdlock()
+    }
+
+    /// Index of the replica used by this thread.
+    pub fn local_replica(&self) -> usize {
+        self.local
+    }
+
+    /// Take a read lock on replica `index` instead of the local one (see
+    /// [`ReplicatedRcuHt::replica_count`]).
+    pub fn replica_rdlock(&self, index: usize) -> RcuHtRead<'_, '_, K, V, S, R> {
+        self.threads[index].rdlock()
+    }
+
+    /// Take the write lock of every replica (always in the same order).
+    pub fn wrlock(&self) -> Option<ReplicatedRcuHtWriter<'_, K, V, S, R>> {
+        let writers = self
+            .threads
+            .iter()
+            .map(|thread| thread.wrlock())
+            .collect::<Option<Vec<_>>>()?;
+
+        Some(ReplicatedRcuHtWriter { writers })
+    }
+}
+
+/// Writer of a [`ReplicatedRcuHt`]: every operation is applied to all replicas.
+///
+/// Replicas are updated one after the other: readers of different nodes may see a change
+/// at slightly different times.
+pub struct ReplicatedRcuHtWriter<
+    'thread,
+    K,
+    V,
+    S = DefaultHashBuilder,
+    R: RcuFlavor = DefaultFlavor,
+> {
+    writers: Vec<RcuHtWriter<'thread, 'thread, 'thread, K, V, S, R>>,
+}
+
+impl<'thread, K, V, S, R> ReplicatedRcuHtWriter<'thread, K, V, S, R>
+where
+    K: Hash + Eq + Clone,
+    V: Clone,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Add a key/value in every replica, or replace the value of an existing key.
+    pub fn insert_or_replace(&mut self, key: K, value: V) {
+        let h = urcu_key_hash(self.writers[0].hash_builder, &key);
+
+        // the last replica gets the original key and value
+        let (last, others) = self.writers.split_last_mut().unwrap();
+        for writer in others {
+            writer.insert_or_replace_with_hash(h, key.clone(), value.clone());
+        }
+        last.insert_or_replace_with_hash(h, key, value);
+    }
+
+    /// Remove a key from every replica.
+    pub fn remove<Q: ?Sized>(&mut self, key: &Q) -> Result<(), RcuError>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        let h = urcu_key_hash(self.writers[0].hash_builder, key);
+
+        let (first, others) = self.writers.split_first_mut().unwrap();
+        let removed = first.remove_with_hash(h, key);
+        for writer in others {
+            // all replicas hold the same keys: a different result is a bug
+            let other = writer.remove_with_hash(h, key);
+            debug_assert_eq!(
+                other.is_ok(),
+                removed.is_ok(),
+                "replicas of a ReplicatedRcuHt diverged"
+            );
+        }
+
+        removed
+    }
+}
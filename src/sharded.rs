@@ -0,0 +1,381 @@
+//! Hashtable split in N independent shards.
+//!
+//! Each shard is a complete [`RcuHt`]: it has its own bucket table (so a resize only touches
+//! one shard) and its own write mutex (so writers of different shards never wait for each other).
+//! A key is routed to a shard with the high bits of its hash value: lib urcu uses the low bits
+//! to select a bucket, so keys of a shard stay well spread over its buckets.
+use std::borrow::Borrow;
+use std::hash::{BuildHasher, Hash};
+use std::marker::PhantomData;
+
+use crate::{
+    urcu_cds_lfht_node_to_rust_type, urcu_count_nodes, urcu_get_node_with_hash, urcu_key_hash,
+    DefaultFlavor, DefaultHashBuilder, RcuError, RcuFlavor, RcuHt, RcuHtBuilder, RcuHtThread,
+    RcuHtWriter, RcuReadSection,
+};
+
+/// A hashtable made of `N` [`RcuHt`] shards.
+///
+/// ```
+/// use urcu_ht::ShardedRcuHt;
+///
+/// let ht = ShardedRcuHt::<u32, u32, 8>::new(64, 64, 0, true).expect("Cannot create hashtable");
+/// let thread = ht.thread();
+/// thread.writers().insert_or_replace(1, 10);
+///
+/// let read = thread.rdlock();
+/// assert_eq!(read.get(&1), Some(&10));
+/// ```
+pub struct ShardedRcuHt<K, V, const N: usize, S = DefaultHashBuilder, R: RcuFlavor = DefaultFlavor>
+{
+    shards: [RcuHt<K, V, S, R>; N],
+    /// used to compute hash of keys (each shard has its own copy)
+    hash_builder: S,
+}
+
+impl<K, V, const N: usize> ShardedRcuHt<K, V, N, DefaultHashBuilder>
+where
+    K: Hash + Eq,
+{
+    /// Allocate `N` shards, using the default hashing algorithm.
+    ///
+    /// Parameters are the same than [`RcuHt::new`], for each shard.
+    pub fn new(
+        init_size: u64,
+        min_nr_alloc_buckets: u64,
+        max_nr_buckets: u64,
+        autoresize: bool,
+    ) -> Result<Self, RcuError> {
+        Self::with_builder(
+            RcuHtBuilder::new()
+                .init_size(init_size)
+                .min_nr_alloc_buckets(min_nr_alloc_buckets)
+                .max_nr_buckets(max_nr_buckets)
+                .auto_resize(autoresize)
+                .accounting(false),
+        )
+    }
+}
+
+impl<K, V, const N: usize, S, R> ShardedRcuHt<K, V, N, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher + Clone,
+    R: RcuFlavor,
+{
+    /// Allocate `N` shards, each of them built by `builder`.
+    ///
+    /// Sizes given to the builder apply to each shard.
+    pub fn with_builder(builder: RcuHtBuilder<S, R>) -> Result<Self, RcuError> {
+        if N == 0 {
+            return Err(RcuError::InvalidParameters);
+        }
+
+        let hash_builder = builder.hash_builder.clone();
+        let shards = (0..N)
+            .map(|_| builder.clone().build())
+            .collect::<Result<Vec<_>, _>>()?;
+
+        let shards = match shards.try_into() {
+            Ok(shards) => shards,
+            Err(_) => unreachable!("exactly N shards were built"),
+        };
+
+        Ok(ShardedRcuHt {
+            shards,
+            hash_builder,
+        })
+    }
+}
+
+impl<K, V, const N: usize, S, R> ShardedRcuHt<K, V, N, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Get a per thread handle. Will be used for read/write operations.
+    pub fn thread(&self) -> ShardedRcuHtThread<'_, K, V, N, S, R> {
+        ShardedRcuHtThread {
+            ht: self,
+            threads: std::array::from_fn(|i| self.shards[i].thread()),
+        }
+    }
+
+    /// Returns a reference to the hashtable's BuildHasher.
+    pub fn hasher(&self) -> &S {
+        &self.hash_builder
+    }
+
+    /// Get a shard, for instance to resize it or to get its objects count.
+    pub fn shard(&self, index: usize) -> &RcuHt<K, V, S, R> {
+        &self.shards[index]
+    }
+
+    /// Index of the shard storing `key`.
+    pub fn shard_index<Q: ?Sized + Hash>(&self, key: &Q) -> usize
+    where
+        K: Borrow<Q>,
+    {
+        Self::shard_index_with_hash(urcu_key_hash(&self.hash_builder, key))
+    }
+
+    /// Index of the shard storing keys with hash value `hash`.
+    pub fn shard_index_with_hash(hash: u64) -> usize {
+        // map the 32 high bits of the hash to [0, N) without a division
+        (((hash >> 32) * N as u64) >> 32) as usize
+    }
+
+    /// Resize every shard to `new_size` buckets, one shard after the other (see [`RcuHt::resize`]).
+    pub fn resize(&self, new_size: u64) -> Result<(), RcuError> {
+        self.shards
+            .iter()
+            .try_for_each(|shard| shard.resize(new_size))
+    }
+}
+
+/// Per thread handle of a [`ShardedRcuHt`].
+///
+/// It registers the current thread in urcu lib (once for all shards).
+pub struct ShardedRcuHtThread<
+    'ht,
+    K,
+    V,
+    const N: usize,
+    S = DefaultHashBuilder,
+    R: RcuFlavor = DefaultFlavor,
+> {
+    ht: &'ht ShardedRcuHt<K, V, N, S, R>,
+    threads: [RcuHtThread<'ht, K, V, S, R>; N],
+}
+
+impl<'ht, K, V, const N: usize, S, R> ShardedRcuHtThread<'ht, K, V, N, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Take a read lock. A single read-side critical section covers all shards.
+    pub fn rdlock(&self) -> ShardedRcuHtRead<'_, 'ht, K, V, N, S, R> {
+        ShardedRcuHtRead {
+            ht: self.ht,
+            _rcu: RcuReadSection::new(),
+            _thread: PhantomData,
+        }
+    }
+
+    /// Take the write lock of shard `index` (see [`ShardedRcuHt::shard_index`]).
+    ///
+    /// Writers of different shards do not wait for each other. Only keys of this shard can be
+    /// written: other keys would never be found by readers, so the writer panics.
+    pub fn wrlock(
+        &self,
+        index: usize,
+    ) -> Option<ShardedRcuHtShardWriter<'_, '_, '_, K, V, N, S, R>> {
+        self.threads[index]
+            .wrlock()
+            .map(|writer| ShardedRcuHtShardWriter {
+                ht: self.ht,
+                index,
+                writer,
+            })
+    }
+
+    /// Get a concurrent writer of shard `index` (see [`RcuHtThread::writer`]).
+    ///
+    /// Same as [`ShardedRcuHtThread::wrlock`]: it panics if a key of another shard is written.
+    pub fn writer(&self, index: usize) -> ShardedRcuHtShardWriter<'ht, '_, 'ht, K, V, N, S, R> {
+        ShardedRcuHtShardWriter {
+            ht: self.ht,
+            index,
+            writer: self.threads[index].writer(),
+        }
+    }
+
+    /// Get a concurrent writer of every shard, routing each operation to the shard of its key.
+    ///
+    /// Keep it for a sequence of operations: objects it removes or replaces are given to call_rcu
+    /// by batches, when a batch is full, on [`ShardedRcuHtWriter::flush`] and when it is dropped.
+    pub fn writers(&self) -> ShardedRcuHtWriter<'_, 'ht, K, V, N, S, R> {
+        ShardedRcuHtWriter {
+            ht: self.ht,
+            writers: std::array::from_fn(|index| self.threads[index].writer()),
+        }
+    }
+}
+
+/// Concurrent writers of all shards of a [`ShardedRcuHt`], see [`ShardedRcuHtThread::writers`].
+///
+/// Operations do not take the shard write locks (see [`RcuHtThread::writer`]).
+pub struct ShardedRcuHtWriter<
+    'thread,
+    'ht,
+    K,
+    V,
+    const N: usize,
+    S = DefaultHashBuilder,
+    R: RcuFlavor = DefaultFlavor,
+> {
+    ht: &'ht ShardedRcuHt<K, V, N, S, R>,
+    writers: [RcuHtWriter<'ht, 'thread, 'ht, K, V, S, R>; N],
+}
+
+impl<'thread, 'ht, K, V, const N: usize, S, R> ShardedRcuHtWriter<'thread, 'ht, K, V, N, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Add a key/value, or replace the value of an existing key.
+    pub fn insert_or_replace(&mut self, key: K, value: V) {
+        let h = urcu_key_hash(&self.ht.hash_builder, &key);
+        let index = ShardedRcuHt::<K, V, N, S, R>::shard_index_with_hash(h);
+
+        self.writers[index].insert_or_replace_with_hash(h, key, value);
+    }
+
+    /// Remove a key.
+    pub fn remove<Q: ?Sized>(&mut self, key: &Q) -> Result<(), RcuError>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        let h = urcu_key_hash(&self.ht.hash_builder, key);
+        let index = ShardedRcuHt::<K, V, N, S, R>::shard_index_with_hash(h);
+
+        self.writers[index].remove_with_hash(h, key)
+    }
+
+    /// Give objects removed or replaced so far to call_rcu, for all shards.
+    pub fn flush(&mut self) {
+        for writer in self.writers.iter_mut() {
+            writer.flush();
+        }
+    }
+}
+
+/// Writer of a single shard of a [`ShardedRcuHt`], see [`ShardedRcuHtThread::wrlock`].
+///
+/// Every operation checks its key belongs to this shard.
+pub struct ShardedRcuHtShardWriter<
+    'guard,
+    'thread,
+    'ht,
+    K,
+    V,
+    const N: usize,
+    S = DefaultHashBuilder,
+    R: RcuFlavor = DefaultFlavor,
+> {
+    ht: &'ht ShardedRcuHt<K, V, N, S, R>,
+    index: usize,
+    writer: RcuHtWriter<'guard, 'thread, 'ht, K, V, S, R>,
+}
+
+impl<'guard, 'thread, 'ht, K, V, const N: usize, S, R>
+    ShardedRcuHtShardWriter<'guard, 'thread, 'ht, K, V, N, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Hash of a key, which must belong to this shard.
+    fn shard_hash<Q: ?Sized + Hash>(&self, key: &Q) -> u64 {
+        let h = urcu_key_hash(&self.ht.hash_builder, key);
+        assert_eq!(
+            ShardedRcuHt::<K, V, N, S, R>::shard_index_with_hash(h),
+            self.index,
+            "key written in another shard than its own (see ShardedRcuHt::shard_index)"
+        );
+        h
+    }
+
+    /// Add a key/value, or replace the value of an existing key. Panics if `key` belongs to
+    /// another shard.
+    pub fn insert_or_replace(&mut self, key: K, value: V) {
+        let h = self.shard_hash(&key);
+        self.writer.insert_or_replace_with_hash(h, key, value);
+    }
+
+    /// Remove a key. Panics if `key` belongs to another shard.
+    pub fn remove<Q: ?Sized>(&mut self, key: &Q) -> Result<(), RcuError>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        let h = self.shard_hash(key);
+        self.writer.remove_with_hash(h, key)
+    }
+
+    /// Give objects removed or replaced so far to call_rcu (see [`RcuHtWriter::flush`]).
+    pub fn flush(&mut self) {
+        self.writer.flush();
+    }
+}
+
+/// Read lock over all shards of a [`ShardedRcuHt`]. Same API than [`crate::RcuHtRead`].
+pub struct ShardedRcuHtRead<
+    'thread,
+    'ht,
+    K,
+    V,
+    const N: usize,
+    S = DefaultHashBuilder,
+    R: RcuFlavor = DefaultFlavor,
+> {
+    ht: &'ht ShardedRcuHt<K, V, N, S, R>,
+    _rcu: RcuReadSection<R>,
+    _thread: PhantomData<&'thread ShardedRcuHtThread<'ht, K, V, N, S, R>>,
+}
+
+impl<'rdlock, 'thread, 'ht, K, V, const N: usize, S, R>
+    ShardedRcuHtRead<'thread, 'ht, K, V, N, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Get a reference to the value of a key.
+    pub fn get<Q: ?Sized>(&'rdlock self, key: &Q) -> Option<&'rdlock V>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        self.get_with_hash(urcu_key_hash(&self.ht.hash_builder, key), key)
+    }
+
+    /// Same as [`ShardedRcuHtRead::get`], using a hash value already computed by the caller.
+    pub fn get_with_hash<Q: ?Sized>(&'rdlock self, hash: u64, key: &Q) -> Option<&'rdlock V>
+    where
+        K: Borrow<Q>,
+        Q: Eq,
+    {
+        let shard = &self.ht.shards[ShardedRcuHt::<K, V, N, S, R>::shard_index_with_hash(hash)];
+
+        let timer = shard.stats.lookup_start();
+
+        let ret = unsafe {
+            let found_node = urcu_get_node_with_hash::<Q, K, V>(shard.urcuht, hash, key);
+
+            if found_node.is_null() {
+                None
+            } else {
+                let node = urcu_cds_lfht_node_to_rust_type::<K, V>(found_node);
+                Some(&(*node).data)
+            }
+        };
+
+        shard.stats.lookup_end(timer, ret.is_some());
+        ret
+    }
+
+    /// Objects count of all shards (see [`crate::RcuHtRead::count_nodes`]).
+    pub fn count_nodes(&self) -> u64 {
+        (0..N).map(|index| self.shard_count_nodes(index)).sum()
+    }
+
+    /// Objects count of shard `index`.
+    pub fn shard_count_nodes(&self, index: usize) -> u64 {
+        unsafe { urcu_count_nodes(self.ht.shards[index].urcuht) }
+    }
+}
@@ -0,0 +1,329 @@
+//! Snapshot of a hashtable to a binary file, and warm restart from it.
+//!
+//! Only available on Unix: snapshots are loaded with mmap.
+//!
+//! Keys and values must be plain data ([`RcuSnapshotPod`]): they are written as raw bytes, in the
+//! native byte order, and a snapshot is loaded by the same program (same types) on the same
+//! architecture. The file is a 64 bytes header, fixed-size records, and the number of records:
+//!
+//! | offset                | content                                                          |
+//! |-----------------------|------------------------------------------------------------------|
+//! | 0                     | magic `URCUHTS\0`, version, byte order, key and value layout      |
+//! | 64                    | records: key, padding, value, padding (`stride` bytes each)      |
+//! | 64 + count * stride   | number of records (u64)                                          |
+//!
+//! The loader maps the file in memory (mmap) and copies records straight from the mapped pages
+//! into hashtable nodes, from many threads (see [`RcuHtBuilder::build_from_parts`]): there is no
+//! decoding step nor intermediate buffer.
+//!
+//! ```
+//! use urcu_ht::RcuHt;
+//!
+//! let ht = RcuHt::from_iter_with_capacity((0..1000u64).map(|i| (i, [i; 2])), 1000).unwrap();
+//!
+//! let path = std::env::temp_dir().join(format!("urcu-ht-doc-{}.snap", std::process::id()));
+//! ht.snapshot_to(std::fs::File::create(&path).unwrap()).unwrap();
+//!
+//! let restored = RcuHt::<u64, [u64; 2]>::load_snapshot(&path).unwrap();
+//! assert_eq!(restored.thread().rdlock().get(&7), Some(&[7, 7]));
+//! # std::fs::remove_file(&path).unwrap();
+//! ```
+use std::hash::{BuildHasher, Hash};
+use std::io::{self, Write};
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+
+use crate::{DefaultHashBuilder, RcuFlavor, RcuHt, RcuHtBuilder, RcuHtCursor};
+
+/// Plain data types, which can be written to (and read from) a snapshot as raw bytes.
+///
+/// # Safety
+///
+/// The type must not have padding bytes, and every bit pattern of its size must be a valid value
+/// (integers, floats, arrays of them, or `#[repr(C)]` structs of them without padding).
+/// It must not own memory nor point to it.
+pub unsafe trait RcuSnapshotPod: Copy + Send + Sync + 'static {}
+
+macro_rules! urcu_snapshot_pod {
+    ($($t:ty),*) => {
+        $(unsafe impl RcuSnapshotPod for $t {})*
+    };
+}
+
+urcu_snapshot_pod!(u8, u16, u32, u64, u128, usize, i8, i16, i32, i64, i128, isize, f32, f64);
+
+unsafe impl<T: RcuSnapshotPod, const N: usize> RcuSnapshotPod for [T; N] {}
+
+const URCU_SNAPSHOT_MAGIC: [u8; 8] = *b"URCUHTS\0";
+const URCU_SNAPSHOT_VERSION: u32 = 1;
+// written in native byte order: read back differently on a machine of another byte order
+const URCU_SNAPSHOT_BYTE_ORDER: u32 = 0x0102_0304;
+const URCU_SNAPSHOT_HEADER_SIZE: usize = 64;
+const URCU_SNAPSHOT_FOOTER_SIZE: usize = 8;
+
+/// Number of objects copied under a single read lock by [`RcuHt::snapshot_to`].
+const URCU_SNAPSHOT_CHUNK_SIZE: usize = 4096;
+/// Minimum number of objects loaded by each thread.
+const URCU_SNAPSHOT_LOAD_PART_SIZE: usize = 64 * 1024;
+
+/// Layout of a record: key at offset 0, value at `value_offset`.
+struct RcuSnapshotLayout {
+    key_size: usize,
+    value_offset: usize,
+    value_size: usize,
+    stride: usize,
+}
+
+impl RcuSnapshotLayout {
+    fn new<K, V>() -> Self {
+        let round_up = |n: usize, align: usize| (n + align - 1) / align * align;
+        let key_size = std::mem::size_of::<K>();
+        let value_size = std::mem::size_of::<V>();
+        let value_offset = round_up(key_size, std::mem::align_of::<V>());
+        let align = std::mem::align_of::<K>().max(std::mem::align_of::<V>());
+
+        RcuSnapshotLayout {
+            key_size,
+            value_offset,
+            value_size,
+            // at least one byte: records of zero-sized types are still counted
+            stride: round_up(value_offset + value_size, align).max(1),
+        }
+    }
+
+    fn header<K, V>(&self) -> [u8; URCU_SNAPSHOT_HEADER_SIZE] {
+        let mut header = [0u8; URCU_SNAPSHOT_HEADER_SIZE];
+        header[0..8].copy_from_slice(&URCU_SNAPSHOT_MAGIC);
+
+        let fields = [
+            URCU_SNAPSHOT_VERSION,
+            URCU_SNAPSHOT_BYTE_ORDER,
+            self.key_size as u32,
+            std::mem::align_of::<K>() as u32,
+            self.value_size as u32,
+            std::mem::align_of::<V>() as u32,
+            self.value_offset as u32,
+            self.stride as u32,
+        ];
+        for (i, field) in fields.iter().enumerate() {
+            header[8 + i * 4..12 + i * 4].copy_from_slice(&field.to_ne_bytes());
+        }
+
+        header
+    }
+
+    /// Append a record to `buffer` (padding bytes are zeroed).
+    fn write<K: RcuSnapshotPod, V: RcuSnapshotPod>(
+        &self,
+        buffer: &mut Vec<u8>,
+        key: &K,
+        value: &V,
+    ) {
+        let start = buffer.len();
+        buffer.resize(start + self.stride, 0);
+
+        // no padding in plain data types: all their bytes are initialized
+        unsafe {
+            std::ptr::copy_nonoverlapping(
+                key as *const K as *const u8,
+                buffer.as_mut_ptr().add(start),
+                self.key_size,
+            );
+            std::ptr::copy_nonoverlapping(
+                value as *const V as *const u8,
+                buffer.as_mut_ptr().add(start + self.value_offset),
+                self.value_size,
+            );
+        }
+    }
+
+    /// Read a record (`record` is `stride` bytes long).
+    #[inline]
+    fn read<K: RcuSnapshotPod, V: RcuSnapshotPod>(&self, record: &[u8]) -> (K, V) {
+        debug_assert_eq!(record.len(), self.stride);
+
+        // any bit pattern is a valid plain data value. Records are aligned in the mapping (page
+        // aligned, 64 bytes header), but unaligned reads do not cost more on common architectures.
+        unsafe {
+            (
+                std::ptr::read_unaligned(record.as_ptr() as *const K),
+                std::ptr::read_unaligned(record.as_ptr().add(self.value_offset) as *const V),
+            )
+        }
+    }
+}
+
+fn urcu_snapshot_invalid(reason: &str) -> io::Error {
+    io::Error::new(
+        io::ErrorKind::InvalidData,
+        format!("invalid snapshot: {reason}"),
+    )
+}
+
+/// A read-only memory mapping of a whole file.
+struct RcuSnapshotMap {
+    addr: *mut libc::c_void,
+    len: usize,
+}
+
+impl RcuSnapshotMap {
+    fn open(path: &Path) -> io::Result<Self> {
+        let file = std::fs::File::open(path)?;
+        let len = usize::try_from(file.metadata()?.len())
+            .map_err(|_| urcu_snapshot_invalid("file too large"))?;
+        if len < URCU_SNAPSHOT_HEADER_SIZE + URCU_SNAPSHOT_FOOTER_SIZE {
+            return Err(urcu_snapshot_invalid("file too short"));
+        }
+
+        // the mapping stays valid once the file is closed
+        let addr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if addr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        // records are read once, in order (in each part): ask for an aggressive read ahead
+        unsafe {
+            libc::madvise(addr, len, libc::MADV_SEQUENTIAL);
+            libc::madvise(addr, len, libc::MADV_WILLNEED);
+        }
+
+        Ok(RcuSnapshotMap { addr, len })
+    }
+
+    fn bytes(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.addr as *const u8, self.len) }
+    }
+}
+
+impl Drop for RcuSnapshotMap {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.addr, self.len);
+        }
+    }
+}
+
+impl<K, V, S, R> RcuHt<K, V, S, R>
+where
+    K: RcuSnapshotPod + Hash + Eq,
+    V: RcuSnapshotPod,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Write all objects of the hashtable to `writer`, and return the number of objects written.
+    ///
+    /// Objects are copied by chunks, each under its own read lock (see [`crate::RcuHtRead::scan`]),
+    /// so grace periods are not delayed by a long snapshot. Each object is consistent, but writers
+    /// can update the hashtable while it is written: an object added, replaced or removed meanwhile
+    /// may be in the snapshot or not (and may be there twice: the loader keeps one of them).
+    ///
+    /// `writer` is not buffered (each chunk is written by a single `write_all`).
+    pub fn snapshot_to<W: Write>(&self, mut writer: W) -> io::Result<u64> {
+        let layout = RcuSnapshotLayout::new::<K, V>();
+        writer.write_all(&layout.header::<K, V>())?;
+
+        let thread = self.thread();
+        let mut cursor = RcuHtCursor::new();
+        let mut buffer = Vec::with_capacity(URCU_SNAPSHOT_CHUNK_SIZE * layout.stride);
+        let mut count = 0u64;
+
+        while !cursor.is_done() {
+            buffer.clear();
+
+            {
+                let rdlock = thread.rdlock();
+                count += rdlock.scan(&mut cursor, URCU_SNAPSHOT_CHUNK_SIZE, |key, value| {
+                    layout.write(&mut buffer, key, value)
+                }) as u64;
+            }
+
+            writer.write_all(&buffer)?;
+        }
+
+        writer.write_all(&count.to_ne_bytes())?;
+        writer.flush()?;
+
+        Ok(count)
+    }
+}
+
+impl<K, V> RcuHt<K, V, DefaultHashBuilder>
+where
+    K: RcuSnapshotPod + Hash + Eq,
+    V: RcuSnapshotPod,
+{
+    /// Allocate a new hashtable with default parameters, filled with the objects of the snapshot
+    /// file at `path` (written by [`RcuHt::snapshot_to`]). See [`RcuHtBuilder::build_from_snapshot`].
+    pub fn load_snapshot<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+        RcuHtBuilder::new().build_from_snapshot(path)
+    }
+}
+
+impl<S, R> RcuHtBuilder<S, R> {
+    /// Allocate the hashtable and fill it with the objects of the snapshot file at `path`
+    /// (written by [`RcuHt::snapshot_to`]).
+    ///
+    /// Buckets are allocated for the number of objects of the snapshot (this overrides
+    /// [`RcuHtBuilder::init_size`]). The file is mapped in memory, and loaded by up to one thread
+    /// per CPU (see [`RcuHtBuilder::build_from_parts`]).
+    ///
+    /// Fails if the file is not a snapshot, or if its key or value layout (size and alignment) does
+    /// not match `K` and `V`. Types are not checked further: a snapshot must be loaded with the types
+    /// it was written with.
+    pub fn build_from_snapshot<K, V, P>(self, path: P) -> io::Result<RcuHt<K, V, S, R>>
+    where
+        K: RcuSnapshotPod + Hash + Eq,
+        V: RcuSnapshotPod,
+        S: BuildHasher + Sync,
+        R: RcuFlavor,
+        P: AsRef<Path>,
+    {
+        let layout = RcuSnapshotLayout::new::<K, V>();
+        let map = RcuSnapshotMap::open(path.as_ref())?;
+        let bytes = map.bytes();
+
+        let (header, bytes) = bytes.split_at(URCU_SNAPSHOT_HEADER_SIZE);
+        if header[0..8] != URCU_SNAPSHOT_MAGIC {
+            return Err(urcu_snapshot_invalid("bad magic"));
+        }
+        if header != layout.header::<K, V>() {
+            return Err(urcu_snapshot_invalid(
+                "version, byte order or key/value layout mismatch",
+            ));
+        }
+
+        let (records, footer) = bytes.split_at(bytes.len() - URCU_SNAPSHOT_FOOTER_SIZE);
+        let count = u64::from_ne_bytes(footer.try_into().unwrap());
+        if (records.len() / layout.stride) as u64 != count || records.len() % layout.stride != 0 {
+            return Err(urcu_snapshot_invalid("truncated file"));
+        }
+
+        // split into parts of whole records, one per thread
+        let count = count as usize;
+        let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+        let per_part = (count / threads)
+            .max(URCU_SNAPSHOT_LOAD_PART_SIZE)
+            .min(count.max(1));
+        let layout = &layout;
+        let parts = records.chunks(per_part * layout.stride).map(|part| {
+            part.chunks_exact(layout.stride)
+                .map(|r| layout.read::<K, V>(r))
+        });
+
+        let ht = self
+            .capacity(count)
+            .build_from_parts(parts)
+            .map_err(|err| io::Error::new(io::ErrorKind::Other, format!("{err:?}")))?;
+
+        Ok(ht)
+    }
+}
@@ -0,0 +1,337 @@
+//! Hashtable statistics (`stats` feature).
+//!
+//! Counters are striped: each thread updates one slot (given round robin), a cache line (or more)
+//! each. There is one slot per CPU (rounded up to a power of two, at most `URCU_STATS_MAX_SLOTS`),
+//! so threads do not share counters as long as there are less threads than slots.
+//! Updates are relaxed atomic additions on the slot of the thread, and a snapshot sums all slots.
+//! Lookup latency is only measured for one lookup out of `URCU_STATS_SAMPLE_RATE`.
+//!
+//! Without the `stats` feature, all functions of this module do nothing.
+#[cfg(feature = "stats")]
+use std::cell::Cell;
+#[cfg(feature = "stats")]
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+#[cfg(feature = "stats")]
+use std::time::Instant;
+
+/// Number of lookup latency histogram buckets: bucket `i` counts latencies in `[2^i, 2^(i+1))` ns.
+#[cfg(feature = "stats")]
+pub const URCU_STATS_LATENCY_BUCKETS: usize = 32;
+
+/// Snapshot of the statistics of a hashtable (see [`crate::RcuHt::stats`]).
+///
+/// Values are read while other threads update them: they are consistent individually,
+/// but not with each other.
+#[cfg(feature = "stats")]
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct RcuHtStatsSnapshot {
+    /// lookups done by readers (hits + misses)
+    pub lookups: u64,
+    /// lookups which found their key
+    pub hits: u64,
+    /// lookups which did not find their key
+    pub misses: u64,
+    /// objects added (key not present yet)
+    pub inserts: u64,
+    /// objects replaced (key already present)
+    pub replaces: u64,
+    /// objects removed
+    pub removes: u64,
+    /// batches of removed objects given to call_rcu
+    pub call_rcu: u64,
+    /// latency histogram of sampled lookups, see [`URCU_STATS_LATENCY_BUCKETS`]
+    pub lookup_latency: [u64; URCU_STATS_LATENCY_BUCKETS],
+    /// write locks taken (RcuHtThread::wrlock, and RcuHtThread::try_wrlock which does not wait)
+    pub writer_locks: u64,
+    /// total time spent waiting for the write mutex, in ns
+    pub writer_wait_ns: u64,
+    /// grace periods waited for by writers (RcuHtWriter::synchronize)
+    pub grace_periods: u64,
+    /// total time spent waiting for grace periods, in ns
+    pub grace_period_ns: u64,
+    /// objects count (cds_lfht_count_nodes), only set by [`crate::RcuHtRead::stats`]
+    pub nodes: Option<u64>,
+}
+
+#[cfg(feature = "stats")]
+impl RcuHtStatsSnapshot {
+    /// Upper bound (in ns) of the latency of `percentile`% of sampled lookups, if any was sampled.
+    pub fn lookup_latency_percentile(&self, percentile: f64) -> Option<u64> {
+        let total: u64 = self.lookup_latency.iter().sum();
+        if total == 0 {
+            return None;
+        }
+
+        let target = ((total as f64) * percentile / 100.0).ceil().max(1.0) as u64;
+        let mut seen = 0;
+
+        for (bucket, count) in self.lookup_latency.iter().enumerate() {
+            seen += count;
+            if seen >= target {
+                return Some(1u64 << (bucket + 1));
+            }
+        }
+
+        Some(u64::MAX)
+    }
+}
+
+/// Maximum number of counter slots of a hashtable.
+#[cfg(feature = "stats")]
+const URCU_STATS_MAX_SLOTS: usize = 64;
+
+/// One lookup out of URCU_STATS_SAMPLE_RATE is timed.
+#[cfg(feature = "stats")]
+const URCU_STATS_SAMPLE_RATE: u32 = 64;
+
+#[cfg(feature = "stats")]
+static URCU_STATS_NEXT_SLOT: AtomicUsize = AtomicUsize::new(0);
+// number of slots, computed once (0: not computed yet)
+#[cfg(feature = "stats")]
+static URCU_STATS_SLOTS: AtomicUsize = AtomicUsize::new(0);
+
+#[cfg(feature = "stats")]
+thread_local! {
+    // slot used by this thread, for all hashtables (reduced to the number of slots)
+    static URCU_STATS_SLOT: usize = URCU_STATS_NEXT_SLOT.fetch_add(1, Ordering::Relaxed);
+    // lookups done by this thread since its last timed lookup
+    static URCU_STATS_SAMPLE: Cell<u32> = Cell::new(0);
+}
+
+/// Number of slots: the number of CPUs, rounded up to a power of two.
+#[cfg(feature = "stats")]
+fn urcu_stats_slots() -> usize {
+    let slots = URCU_STATS_SLOTS.load(Ordering::Relaxed);
+    if slots != 0 {
+        return slots;
+    }
+
+    let slots = std::thread::available_parallelism()
+        .map_or(1, |n| n.get())
+        .next_power_of_two()
+        .min(URCU_STATS_MAX_SLOTS);
+    URCU_STATS_SLOTS.store(slots, Ordering::Relaxed);
+    slots
+}
+
+/// Counters updated by a group of threads.
+#[cfg(feature = "stats")]
+#[repr(align(64))]
+#[derive(Default)]
+struct RcuHtStatsSlot {
+    hits: AtomicU64,
+    misses: AtomicU64,
+    inserts: AtomicU64,
+    replaces: AtomicU64,
+    removes: AtomicU64,
+    call_rcu: AtomicU64,
+    lookup_latency: [AtomicU64; URCU_STATS_LATENCY_BUCKETS],
+}
+
+/// Counters of writers: they are serialized by the write mutex (or pay a grace period anyway).
+#[cfg(feature = "stats")]
+#[repr(align(64))]
+#[derive(Default)]
+struct RcuHtWriterStats {
+    writer_locks: AtomicU64,
+    writer_wait_ns: AtomicU64,
+    grace_periods: AtomicU64,
+    grace_period_ns: AtomicU64,
+}
+
+#[cfg(feature = "stats")]
+pub(crate) struct RcuHtStats {
+    slots: Box<[RcuHtStatsSlot]>,
+    writers: RcuHtWriterStats,
+}
+
+/// Start time of a measure (or nothing if it is not measured).
+#[cfg(feature = "stats")]
+pub(crate) struct RcuHtTimer(Option<Instant>);
+
+#[cfg(feature = "stats")]
+fn elapsed_ns(start: Instant) -> u64 {
+    start.elapsed().as_nanos().min(u64::MAX as u128) as u64
+}
+
+#[cfg(feature = "stats")]
+impl RcuHtStats {
+    pub(crate) fn new() -> Self {
+        RcuHtStats {
+            slots: (0..urcu_stats_slots())
+                .map(|_| Default::default())
+                .collect(),
+            writers: Default::default(),
+        }
+    }
+
+    #[inline]
+    fn slot(&self) -> &RcuHtStatsSlot {
+        &self.slots[URCU_STATS_SLOT.with(|slot| *slot) & (self.slots.len() - 1)]
+    }
+
+    /// Called before a lookup: the lookup is timed once every URCU_STATS_SAMPLE_RATE calls.
+    #[inline]
+    pub(crate) fn lookup_start(&self) -> RcuHtTimer {
+        let sampled = URCU_STATS_SAMPLE.with(|count| {
+            let value = count.get() + 1;
+            if value == URCU_STATS_SAMPLE_RATE {
+                count.set(0);
+                true
+            } else {
+                count.set(value);
+                false
+            }
+        });
+
+        RcuHtTimer(if sampled { Some(Instant::now()) } else { None })
+    }
+
+    #[inline]
+    pub(crate) fn lookup_end(&self, timer: RcuHtTimer, hit: bool) {
+        let slot = self.slot();
+
+        if hit {
+            slot.hits.fetch_add(1, Ordering::Relaxed);
+        } else {
+            slot.misses.fetch_add(1, Ordering::Relaxed);
+        }
+
+        if let RcuHtTimer(Some(start)) = timer {
+            let ns = elapsed_ns(start).max(1);
+            let bucket = (63 - ns.leading_zeros() as usize).min(URCU_STATS_LATENCY_BUCKETS - 1);
+            slot.lookup_latency[bucket].fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Count a batch of lookups (not timed).
+    #[inline]
+    pub(crate) fn lookups(&self, hits: u64, misses: u64) {
+        let slot = self.slot();
+        slot.hits.fetch_add(hits, Ordering::Relaxed);
+        slot.misses.fetch_add(misses, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub(crate) fn insert(&self) {
+        self.slot().inserts.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub(crate) fn replace(&self) {
+        self.slot().replaces.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub(crate) fn remove(&self) {
+        self.slot().removes.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub(crate) fn call_rcu(&self) {
+        self.slot().call_rcu.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn timer(&self) -> RcuHtTimer {
+        RcuHtTimer(Some(Instant::now()))
+    }
+
+    pub(crate) fn writer_locked(&self, timer: RcuHtTimer) {
+        if let RcuHtTimer(Some(start)) = timer {
+            self.writers
+                .writer_wait_ns
+                .fetch_add(elapsed_ns(start), Ordering::Relaxed);
+        }
+        self.writers.writer_locks.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn writer_locked_without_wait(&self) {
+        self.writers.writer_locks.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn grace_period_done(&self, timer: RcuHtTimer) {
+        if let RcuHtTimer(Some(start)) = timer {
+            self.writers
+                .grace_period_ns
+                .fetch_add(elapsed_ns(start), Ordering::Relaxed);
+        }
+        self.writers.grace_periods.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn snapshot(&self) -> RcuHtStatsSnapshot {
+        let mut snapshot = RcuHtStatsSnapshot::default();
+        let load = |counter: &AtomicU64| counter.load(Ordering::Relaxed);
+
+        for slot in self.slots.iter() {
+            snapshot.hits += load(&slot.hits);
+            snapshot.misses += load(&slot.misses);
+            snapshot.inserts += load(&slot.inserts);
+            snapshot.replaces += load(&slot.replaces);
+            snapshot.removes += load(&slot.removes);
+            snapshot.call_rcu += load(&slot.call_rcu);
+
+            for (total, count) in snapshot.lookup_latency.iter_mut().zip(&slot.lookup_latency) {
+                *total += load(count);
+            }
+        }
+
+        snapshot.lookups = snapshot.hits + snapshot.misses;
+        snapshot.writer_locks = load(&self.writers.writer_locks);
+        snapshot.writer_wait_ns = load(&self.writers.writer_wait_ns);
+        snapshot.grace_periods = load(&self.writers.grace_periods);
+        snapshot.grace_period_ns = load(&self.writers.grace_period_ns);
+
+        snapshot
+    }
+}
+
+/// Statistics are disabled: nothing is stored, nothing is measured.
+#[cfg(not(feature = "stats"))]
+pub(crate) struct RcuHtStats;
+
+#[cfg(not(feature = "stats"))]
+pub(crate) struct RcuHtTimer;
+
+#[cfg(not(feature = "stats"))]
+impl RcuHtStats {
+    pub(crate) fn new() -> Self {
+        RcuHtStats
+    }
+
+    #[inline(always)]
+    pub(crate) fn lookup_start(&self) -> RcuHtTimer {
+        RcuHtTimer
+    }
+
+    #[inline(always)]
+    pub(crate) fn lookup_end(&self, _timer: RcuHtTimer, _hit: bool) {}
+
+    #[inline(always)]
+    pub(crate) fn lookups(&self, _hits: u64, _misses: u64) {}
+
+    #[inline(always)]
+    pub(crate) fn insert(&self) {}
+
+    #[inline(always)]
+    pub(crate) fn replace(&self) {}
+
+    #[inline(always)]
+    pub(crate) fn remove(&self) {}
+
+    #[inline(always)]
+    pub(crate) fn call_rcu(&self) {}
+
+    #[inline(always)]
+    pub(crate) fn timer(&self) -> RcuHtTimer {
+        RcuHtTimer
+    }
+
+    #[inline(always)]
+    pub(crate) fn writer_locked(&self, _timer: RcuHtTimer) {}
+
+    #[inline(always)]
+    pub(crate) fn writer_locked_without_wait(&self) {}
+
+    #[inline(always)]
+    pub(crate) fn grace_period_done(&self, _timer: RcuHtTimer) {}
+}
@@ -0,0 +1,281 @@
+//! Objects expiring after some idle time, and an incremental sweeper removing them.
+//!
+//! Values are wrapped in [`RcuTtl`], which keeps the tick of their last access. Ticks come from a
+//! coarse [`RcuTtlClock`] advanced by a single thread (usually the sweeper thread): readers only
+//! load it, and refresh an object with a relaxed store, at most once per tick.
+//!
+//! A [`RcuTtlSweeper`] walks a bounded number of objects at each tick (cds_lfht_next, resuming
+//! where the previous tick stopped), and removes expired ones: the aging cost is spread evenly
+//! over time instead of arriving in bursts.
+//!
+//! ```
+//! use std::time::Duration;
+//! use urcu_ht::{RcuHt, RcuTtl, RcuTtlClock, RcuTtlSweeper};
+//!
+//! let ht = RcuHt::<u32, RcuTtl<&str>>::new(64, 64, 0, true).unwrap();
+//! let clock = RcuTtlClock::new(Duration::from_secs(1));
+//! // objects idle for more than 30 ticks expire, 1000 objects are checked per tick
+//! let mut sweeper = RcuTtlSweeper::new(30, 1000);
+//!
+//! let thread = ht.thread();
+//! thread.writer().insert_or_replace(1, RcuTtl::new("flow", &clock));
+//! assert_eq!(thread.rdlock().get_and_touch(&1, &clock), Some(&"flow"));
+//!
+//! // in the sweeper thread, every tick:
+//! clock.advance();
+//! sweeper.tick(&clock, &mut thread.writer());
+//! ```
+use std::borrow::Borrow;
+use std::hash::{BuildHasher, Hash};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::time::{Duration, Instant};
+
+use crate::iter::{urcu_node_reverse_hash, urcu_scan_position};
+use crate::{
+    urcu_cds_lfht_node_to_rust_type, RcuFlavor, RcuHtCursor, RcuHtRead, RcuHtWriter, RcuReadSection,
+};
+
+/// Coarse clock of objects with a TTL, in ticks.
+pub struct RcuTtlClock {
+    start: Instant,
+    resolution: Duration,
+    ticks: AtomicU32,
+}
+
+impl RcuTtlClock {
+    /// A clock starting at tick 0, advanced by one tick every `resolution` (see [`RcuTtlClock::advance`]).
+    pub fn new(resolution: Duration) -> Self {
+        assert!(!resolution.is_zero(), "clock resolution must not be zero");
+
+        RcuTtlClock {
+            start: Instant::now(),
+            resolution,
+            ticks: AtomicU32::new(0),
+        }
+    }
+
+    /// Current tick (a relaxed load).
+    #[inline]
+    pub fn now(&self) -> u32 {
+        self.ticks.load(Ordering::Relaxed)
+    }
+
+    /// Update the current tick from the elapsed time, and return it.
+    pub fn advance(&self) -> u32 {
+        let ticks = (self.start.elapsed().as_nanos() / self.resolution.as_nanos()) as u32;
+        self.set(ticks);
+        ticks
+    }
+
+    /// Set the current tick, for instance from another time source (packet timestamps...).
+    pub fn set(&self, ticks: u32) {
+        self.ticks.store(ticks, Ordering::Relaxed);
+    }
+}
+
+/// A value with the tick of its last access.
+pub struct RcuTtl<V> {
+    value: V,
+    last_access: AtomicU32,
+}
+
+impl<V> RcuTtl<V> {
+    /// Wrap `value`, last accessed now.
+    pub fn new(value: V, clock: &RcuTtlClock) -> Self {
+        RcuTtl {
+            value,
+            last_access: AtomicU32::new(clock.now()),
+        }
+    }
+
+    /// Mark this object accessed now. The shared cache line is only written once per tick.
+    #[inline]
+    pub fn touch(&self, clock: &RcuTtlClock) {
+        let now = clock.now();
+        if self.last_access.load(Ordering::Relaxed) != now {
+            self.last_access.store(now, Ordering::Relaxed);
+        }
+    }
+
+    /// Tick of the last access.
+    pub fn last_access(&self) -> u32 {
+        self.last_access.load(Ordering::Relaxed)
+    }
+
+    /// Returns true if this object was not accessed for more than `ttl` ticks.
+    #[inline]
+    pub fn is_expired(&self, now: u32, ttl: u32) -> bool {
+        now.wrapping_sub(self.last_access()) > ttl
+    }
+
+    /// Wrapped value (also reachable through Deref).
+    pub fn value(&self) -> &V {
+        &self.value
+    }
+}
+
+impl<V> std::ops::Deref for RcuTtl<V> {
+    type Target = V;
+
+    fn deref(&self) -> &V {
+        &self.value
+    }
+}
+
+impl<V: std::fmt::Debug> std::fmt::Debug for RcuTtl<V> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("RcuTtl")
+            .field("value", &self.value)
+            .field("last_access", &self.last_access())
+            .finish()
+    }
+}
+
+/// Incremental removal of expired objects: each tick checks the next objects of the hashtable.
+pub struct RcuTtlSweeper<K> {
+    cursor: RcuHtCursor<K>,
+    ttl: u32,
+    objects_per_tick: usize,
+}
+
+impl<K> RcuTtlSweeper<K> {
+    /// Remove objects idle for more than `ttl` ticks, checking `objects_per_tick` objects per tick.
+    ///
+    /// A tick walks through at most `objects_per_tick` objects, including the ones walked through
+    /// to find its position again when the last object kept by the previous tick was removed in the
+    /// meantime (the walk starts over at the beginning of the hashtable, and can take many ticks).
+    /// Without such removals, a whole pass over `n` objects takes `n / objects_per_tick` ticks: an
+    /// object is removed at most this delay after its expiration.
+    pub fn new(ttl: u32, objects_per_tick: usize) -> Self {
+        RcuTtlSweeper {
+            cursor: RcuHtCursor::new(),
+            ttl,
+            objects_per_tick,
+        }
+    }
+
+    /// Check the next objects, starting over at the beginning of the hashtable after a whole pass,
+    /// and return the number of expired objects removed.
+    ///
+    /// Objects are removed by `writer` (a concurrent writer does not block other writers, see
+    /// [`crate::RcuHtThread::writer`]), and released by batches after a grace period.
+    pub fn tick<V, S, R>(
+        &mut self,
+        clock: &RcuTtlClock,
+        writer: &mut RcuHtWriter<'_, '_, '_, K, RcuTtl<V>, S, R>,
+    ) -> usize
+    where
+        K: Hash + Eq + Clone,
+        S: BuildHasher,
+        R: RcuFlavor,
+    {
+        if self.cursor.is_done() {
+            self.cursor = RcuHtCursor::new();
+        }
+
+        writer.remove_expired(
+            &mut self.cursor,
+            self.objects_per_tick,
+            clock.now(),
+            self.ttl,
+        )
+    }
+}
+
+impl<'rdlock, 'thread, 'ht, K, V, S, R> RcuHtRead<'thread, 'ht, K, RcuTtl<V>, S, R>
+where
+    K: Hash + Eq,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Get a reference to the value of a key, and mark it accessed now (see [`RcuTtl::touch`]).
+    pub fn get_and_touch<Q: ?Sized>(
+        &'rdlock self,
+        key: &Q,
+        clock: &RcuTtlClock,
+    ) -> Option<&'rdlock V>
+    where
+        K: Borrow<Q>,
+        Q: Hash + Eq,
+    {
+        self.get(key).map(|entry| {
+            entry.touch(clock);
+            &entry.value
+        })
+    }
+}
+
+impl<'guard, 'thread, 'ht, K, V, S, R> RcuHtWriter<'guard, 'thread, 'ht, K, RcuTtl<V>, S, R>
+where
+    K: Hash + Eq + Clone,
+    S: BuildHasher,
+    R: RcuFlavor,
+{
+    /// Check at most `max` objects from `cursor` position, and remove the expired ones.
+    /// Objects walked through to find this position again are counted in `max`.
+    fn remove_expired(
+        &mut self,
+        cursor: &mut RcuHtCursor<K>,
+        max: usize,
+        now: u32,
+        ttl: u32,
+    ) -> usize {
+        if cursor.done || max == 0 {
+            return 0;
+        }
+
+        // objects are retired like removed ones: slow down if too many wait for release
+        self.backpressure();
+
+        let mut visited = 0;
+        let mut removed = 0;
+        // the cursor restarts after the last object kept: a removed key cannot be found again
+        let mut last_kept = None;
+
+        unsafe {
+            let _rcu = RcuReadSection::<R>::new();
+            let mut budget = max;
+            let mut iter =
+                match urcu_scan_position::<K, RcuTtl<V>>(self.urcuht, cursor, &mut budget) {
+                    Some(iter) => iter,
+                    None => return 0,
+                };
+
+            loop {
+                let found_node = urcu_sys::cds_lfht_iter_get_node(&mut iter);
+                if found_node.is_null() || urcu_node_reverse_hash(found_node) > cursor.end {
+                    cursor.done = true;
+                    break;
+                }
+
+                if visited == budget {
+                    break;
+                }
+                visited += 1;
+
+                // move to the next object before removing this one
+                urcu_sys::cds_lfht_next(self.urcuht, &mut iter);
+
+                let node = urcu_cds_lfht_node_to_rust_type::<K, RcuTtl<V>>(found_node);
+
+                // a concurrent writer may remove it first: only the one which removed it releases it
+                if (*node).data.is_expired(now, ttl)
+                    && urcu_sys::cds_lfht_del(self.urcuht, found_node) == 0
+                {
+                    self.stats.remove();
+                    self.guard
+                        .retire_node::<R>(self.pool, self.stats, self.reclaim, node);
+                    removed += 1;
+                } else {
+                    last_kept = Some((urcu_node_reverse_hash(found_node), (*node).key.clone()));
+                }
+            }
+        }
+
+        if last_kept.is_some() {
+            cursor.last = last_kept;
+        }
+
+        removed
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * Test of the C API of urcu-ht (include/urcu_ht.h), linked with the static library built by
+ * "cargo rustc --release --lib --features ffi --crate-type staticlib". Exits with a non zero
+ * status on failure.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "urcu_ht.h"
+
+#define OBJECTS 1000
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #cond);                                                    \
+            exit(1);                                                           \
+        }                                                                      \
+    } while (0)
+
+static void check_value(urcu_ht_thread *thread, const char *key, const char *expected)
+{
+    urcu_ht_read *read = urcu_ht_rdlock(thread);
+    const void *value;
+    size_t value_len;
+    int ret = urcu_ht_get(read, key, strlen(key), &value, &value_len);
+
+    if (expected == NULL) {
+        CHECK(ret == -ENOENT);
+    } else {
+        CHECK(ret == 0);
+        CHECK(value_len == strlen(expected));
+        CHECK(memcmp(value, expected, value_len) == 0);
+    }
+    urcu_ht_rdunlock(read);
+}
+
+int main(void) {
+    urcu_ht *ht = urcu_ht_new(64, 64, 0, 1);
+    CHECK(ht != NULL);
+    urcu_ht_thread *thread = urcu_ht_thread_new(ht);
+    CHECK(thread != NULL);
+
+    /* single writes */
+    CHECK(urcu_ht_insert(thread, "flow-1", 6, "one", 3) == 0);
+    CHECK(urcu_ht_insert_unique(thread, "flow-1", 6, "other", 5) == -EEXIST);
+    CHECK(urcu_ht_insert_unique(thread, "flow-2", 6, "two", 3) == 0);
+    check_value(thread, "flow-1", "one");
+    CHECK(urcu_ht_remove(thread, "flow-2", 6) == 0);
+    CHECK(urcu_ht_remove(thread, "flow-2", 6) == -ENOENT);
+    check_value(thread, "flow-2", NULL);
+
+    /* batched writes under one write lock */
+    char keys[OBJECTS][16];
+    size_t key_lens[OBJECTS];
+    const void *key_ptrs[OBJECTS];
+    urcu_ht_writer *writer = urcu_ht_wrlock(thread);
+    CHECK(writer != NULL);
+    for (int i = 0; i < OBJECTS; i++) {
+        key_lens[i] = snprintf(keys[i], sizeof(keys[i]), "key-%d", i);
+        key_ptrs[i] = keys[i];
+        CHECK(urcu_ht_writer_insert(writer, keys[i], key_lens[i], &i, sizeof(i)) == 0);
+    }
+    CHECK(urcu_ht_writer_insert_unique(writer, keys[0], key_lens[0], NULL, 0) == -EEXIST);
+    CHECK(urcu_ht_writer_remove(writer, "flow-1", 6) == 0);
+    urcu_ht_wrunlock(writer);
+    check_value(thread, "flow-1", NULL);
+
+    /* batched lookups */
+    const void *values[OBJECTS];
+    size_t value_lens[OBJECTS];
+    urcu_ht_read *read = urcu_ht_rdlock(thread);
+    CHECK(urcu_ht_get_many(read, OBJECTS, key_ptrs, key_lens, values, value_lens) == OBJECTS);
+    for (int i = 0; i < OBJECTS; i++) {
+        int value;
+        CHECK(value_lens[i] == sizeof(value));
+        memcpy(&value, values[i], sizeof(value));
+        CHECK(value == i);
+    }
+    urcu_ht_rdunlock(read);
+
+    urcu_ht_thread_free(thread);
+    urcu_ht_destroy(ht);
+
+    printf("urcu-ht C API: ok\n");
+    return 0;
+}
@@ -4,19 +4,61 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <sys/time.h>
 #include <getopt.h>
 #include <numa.h>
 #include <sys/stat.h>
 #include "jhash.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS_UNIT "cycles"
+static inline uint64_t ticks(void) { return __rdtsc(); }
+#else
+#include <time.h>
+#define TICKS_UNIT "ns"
+static inline uint64_t ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
 #define _LGPL_SOURCE
 #include <urcu.h>
 #include <urcu/rculfhash.h>	/* RCU Lock-free hash table */
 
 
 #define GLOBAL_HASH_SEED 1234
+#define CACHE_LINE_SIZE 64
+
+/* one get out of LATENCY_SAMPLE_RATE is timed in latency mode */
+#define LATENCY_SAMPLE_RATE 64
+/* keys looked up by a reader are taken in a precomputed sequence of this size */
+#define KEY_SEQUENCE_SIZE (1 << 16)
+
+/* log-linear histogram: 8 sub-buckets per power of two (12.5% precision) */
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS (64 << HISTOGRAM_SUB_BITS)
+
+struct histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+enum distribution {
+    DISTRIBUTION_UNIFORM,
+    DISTRIBUTION_ZIPF,
+};
+
+/* reader options */
+static int keys = 1;
+static enum distribution distribution = DISTRIBUTION_UNIFORM;
+static double theta = 0.99;
+static int latency = 0;
 
 static struct cds_lfht *global_ht = NULL;
 
@@ -27,18 +69,150 @@ struct mynode {
     int value;			        /* Node content */
 };
 
+/* each reader has its own cache line(s): the structure is aligned and allocated aligned */
 struct thread_data {
     uint64_t key_not_found;
     uint64_t key_found;
     uint64_t core_id;
 
-    /* align to 64 bytes = x86 cache line */
-    uint64_t pad32;
-    uint64_t pad40;
-    uint64_t pad48;
-    uint64_t pad56;
-    uint64_t pad64;
-} ;
+    /* sampled get latency (latency mode only) */
+    struct histogram latency;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static unsigned int histogram_index(uint64_t value)
+{
+    if (value < (1 << HISTOGRAM_SUB_BITS)) {
+        return value;
+    }
+
+    unsigned int msb = 63 - __builtin_clzll(value);
+    uint64_t sub = (value >> (msb - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+/* highest value of a bucket */
+static uint64_t histogram_bucket_max(unsigned int index)
+{
+    unsigned int sub_count = 1 << HISTOGRAM_SUB_BITS;
+
+    if (index < sub_count) {
+        return index;
+    }
+
+    unsigned int shift = index / sub_count - 1;
+    uint64_t sub = index % sub_count;
+    return ((sub_count + sub + 1) << shift) - 1;
+}
+
+static inline void histogram_record(struct histogram *h, uint64_t value)
+{
+    h->buckets[histogram_index(value)]++;
+}
+
+static uint64_t histogram_count(const struct histogram *h)
+{
+    uint64_t count = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        count += h->buckets[i];
+    }
+    return count;
+}
+
+/* upper bound of the percentile% lowest values */
+static uint64_t histogram_percentile(const struct histogram *h, double percentile)
+{
+    uint64_t target = ceil(histogram_count(h) * percentile / 100.0);
+    uint64_t seen = 0;
+
+    if (target < 1) {
+        target = 1;
+    }
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            return histogram_bucket_max(i);
+        }
+    }
+    return 0;
+}
+
+static void histogram_print(const struct histogram *h, const char *name)
+{
+    uint64_t count = histogram_count(h);
+
+    if (count == 0) {
+        printf("%s latency: no sample\n", name);
+        return;
+    }
+
+    printf("%s latency (" TICKS_UNIT "): p50 %lu p99 %lu p999 %lu (%lu samples)\n",
+           name,
+           histogram_percentile(h, 50.0),
+           histogram_percentile(h, 99.0),
+           histogram_percentile(h, 99.9),
+           count);
+}
+
+/* splitmix64 pseudo random generator (fixed seed: runs are reproducible) */
+static uint64_t rng_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static double zeta(int n)
+{
+    double sum = 0;
+
+    for (int i = 1; i <= n; i++) {
+        sum += pow(i, -theta);
+    }
+    return sum;
+}
+
+/* generate count keys in [0, keys), zipf distribution from Gray et al. (key 0 is the most frequent) */
+static int *generate_keys(int count, uint64_t seed)
+{
+    int *sequence = malloc(count * sizeof(*sequence));
+    uint64_t state = seed;
+
+    if (!sequence) {
+        return NULL;
+    }
+
+    if (distribution == DISTRIBUTION_UNIFORM) {
+        for (int i = 0; i < count; i++) {
+            sequence[i] = rng_next(&state) % keys;
+        }
+        return sequence;
+    }
+
+    double zetan = zeta(keys);
+    double alpha = 1.0 / (1.0 - theta);
+    double eta = (1.0 - pow(2.0 / keys, 1.0 - theta)) / (1.0 - zeta(2) / zetan);
+
+    for (int i = 0; i < count; i++) {
+        double u = (rng_next(&state) >> 11) / (double)(1ull << 53);
+        double uz = u * zetan;
+        int key;
+
+        if (uz < 1.0) {
+            key = 0;
+        } else if (uz < 1.0 + pow(0.5, theta)) {
+            key = 1;
+        } else {
+            key = keys * pow(eta * u - eta + 1.0, alpha);
+        }
+
+        sequence[i] = key < keys ? key : keys - 1;
+    }
+
+    return sequence;
+}
 
 static int set_affinity(int core_id)
 {
@@ -72,31 +246,48 @@ void free_node_rcu(struct rcu_head *head)
 void * read_rcu(void *data)
 {
     struct thread_data *thread_data = data;
-    int key = 0;
+    int *sequence = generate_keys(KEY_SEQUENCE_SIZE, thread_data->core_id);
+    uint64_t count = 0;
+
+    if (!sequence) {
+        printf("Error allocating key sequence\n");
+        pthread_exit(NULL);
+    }
 
     set_affinity(thread_data->core_id);
 
     rcu_register_thread();
 
     while(1) {
-        struct cds_lfht_iter iter;	/* For iteration on hash table */
+        for (int i = 0; i < KEY_SEQUENCE_SIZE; i++) {
+            struct cds_lfht_iter iter;	/* For iteration on hash table */
+            int key = sequence[i];
+            int sampled = latency && (count++ % LATENCY_SAMPLE_RATE) == 0;
+            uint64_t start = sampled ? ticks() : 0;
 
-        unsigned long hash = jhash(&key, sizeof(key), GLOBAL_HASH_SEED);
+            unsigned long hash = jhash(&key, sizeof(key), GLOBAL_HASH_SEED);
 
-        urcu_memb_read_lock();
+            urcu_memb_read_lock();
 
-        cds_lfht_lookup(global_ht, hash, match_cb, &key, &iter);
+            cds_lfht_lookup(global_ht, hash, match_cb, &key, &iter);
 
-        struct cds_lfht_node *ht_node = cds_lfht_iter_get_node(&iter);
-        if (ht_node) {
-            thread_data->key_found += 1;
-        } else {
-            thread_data->key_not_found += 1;
-        }
+            struct cds_lfht_node *ht_node = cds_lfht_iter_get_node(&iter);
+            if (ht_node) {
+                thread_data->key_found += 1;
+            } else {
+                thread_data->key_not_found += 1;
+            }
+
+            urcu_memb_read_unlock();
 
-        urcu_memb_read_unlock();
+            if (sampled) {
+                histogram_record(&thread_data->latency, ticks() - start);
+            }
+        }
     }
 
+    free(sequence);
+
     rcu_unregister_thread();
 
     pthread_exit(NULL);
@@ -155,10 +346,14 @@ int main(int argc, char **argv) {
         {"core",     required_argument, 0,  'c' },
         {"seconds",  required_argument, 0,  's' },
         {"objects",  required_argument, 0,  'o' },
+        {"keys",     required_argument, 0,  'k' },
+        {"distribution", required_argument, 0,  'd' },
+        {"theta",    required_argument, 0,  't' },
+        {"latency",  no_argument,       0,  'l' },
         {0,         0,                 0,  0 }
     };
 
-    while((option = getopt_long(argc, argv, "c:s:o:", long_options, &option_index)) != -1) { //get option from the getopt() method
+    while((option = getopt_long(argc, argv, "c:s:o:k:d:t:l", long_options, &option_index)) != -1) { //get option from the getopt() method
         switch(option) {
         //For option i, r, l, print that these are options
         case 'c':
@@ -170,6 +365,25 @@ int main(int argc, char **argv) {
         case 's':
             seconds = atoi(optarg);
             break;
+        case 'k':
+            keys = atoi(optarg);
+            break;
+        case 'd':
+            if (strcmp(optarg, "zipf") == 0) {
+                distribution = DISTRIBUTION_ZIPF;
+            } else if (strcmp(optarg, "uniform") == 0) {
+                distribution = DISTRIBUTION_UNIFORM;
+            } else {
+                printf("unknown distribution: %s (uniform or zipf)\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            theta = atof(optarg);
+            break;
+        case 'l':
+            latency = 1;
+            break;
         case '?': //used for some unknown options
             printf("unknown option: %c\n", optopt);
             break;
@@ -218,6 +432,16 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (keys < 1) {
+        printf("readers must look up at least 1 key\n");
+        return 1;
+    }
+
+    if (distribution == DISTRIBUTION_ZIPF && (theta <= 0.0 || theta == 1.0)) {
+        printf("zipf exponent must be positive and different from 1\n");
+        return 1;
+    }
+
     printf("%u cores used and %u objects changed every 1ms.\n", core_nb, objects);
 
     rcu_init();
@@ -240,8 +464,24 @@ int main(int argc, char **argv) {
     int master_core = core_list[--core_nb];
 
     pthread_t *threads = calloc(core_nb, sizeof(pthread_t));
-    struct thread_data *thread_data = calloc(core_nb, sizeof(struct thread_data));
+    /* calloc only guarantees 16 bytes alignment: readers could share a cache line */
+    struct thread_data *thread_data = aligned_alloc(CACHE_LINE_SIZE, core_nb * sizeof(struct thread_data));
     struct thread_data *old_thread_data = calloc(core_nb, sizeof(struct thread_data));
+    struct histogram *insert_latency = calloc(1, sizeof(struct histogram));
+    struct histogram *remove_latency = calloc(1, sizeof(struct histogram));
+
+    if (!threads || !thread_data || !old_thread_data || !insert_latency || !remove_latency) {
+        printf("Error allocating thread data\n");
+        return 1;
+    }
+    memset(thread_data, 0, core_nb * sizeof(struct thread_data));
+
+    /* keys which are never removed */
+    rcu_register_thread();
+    for (int i = objects; i < keys; i++) {
+        add_node(global_ht, i, 0);
+    }
+    rcu_unregister_thread();
 
     /* we wait for a new second to limit complex computation in main loop */
     __time_t tv_lastsec = 0;
@@ -271,7 +511,11 @@ int main(int argc, char **argv) {
 
     while (1) {
         for (int i = 0; i < objects; i++) {
+            uint64_t start = ticks();
             add_node(global_ht, i, 0);
+            if (latency) {
+                histogram_record(insert_latency, ticks() - start);
+            }
         }
 
         usleep(1000);
@@ -300,7 +544,11 @@ int main(int argc, char **argv) {
         }
 
         for (int i = 0; i < objects; i++) {
+            uint64_t start = ticks();
             del_node(global_ht, i);
+            if (latency) {
+                histogram_record(remove_latency, ticks() - start);
+            }
         }
     }
 
@@ -310,9 +558,15 @@ int main(int argc, char **argv) {
     uint64_t key_found = 0;
     uint64_t key_not_found = 0;
 
+    struct histogram *get_latency = calloc(1, sizeof(struct histogram));
+
     for (int i = 0; i < core_nb; i++) {
         key_found += thread_data[i].key_found;
         key_not_found += thread_data[i].key_not_found;
+
+        for (int j = 0; j < HISTOGRAM_BUCKETS && get_latency; j++) {
+            get_latency->buckets[j] += thread_data[i].latency.buckets[j];
+        }
     }
 
     printf(
@@ -322,5 +576,11 @@ int main(int argc, char **argv) {
         key_found / seconds
     );
 
+    if (latency && get_latency) {
+        histogram_print(get_latency, "get");
+        histogram_print(insert_latency, "insert");
+        histogram_print(remove_latency, "remove");
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::Arc;
 
 extern crate clap;
@@ -7,40 +8,91 @@ use clap::{App, Arg};
 use core_affinity::CoreId;
 use urcu_ht::RcuHt;
 
+mod stats;
+use stats::{generate_keys, ticks, Histogram, KeyDistribution};
+
+/// One `get` out of LATENCY_SAMPLE_RATE is timed in latency mode.
+const LATENCY_SAMPLE_RATE: u64 = 64;
+
+/// Keys looked up by a reader are taken in a precomputed sequence of this size.
+const KEY_SEQUENCE_SIZE: usize = 1 << 16;
+
+/// Counters of a reader thread. Each reader has its own cache line(s): readers updating their
+/// counters do not invalidate the counters of other readers (only the main thread reads them).
+#[repr(align(64))]
 struct ThreadData {
-    key_found: u64,
-    key_not_found: u64,
+    key_found: AtomicU64,
+    key_not_found: AtomicU64,
+    // sampled get latency (latency mode only)
+    latency: Histogram,
 }
 
 impl ThreadData {
     fn new() -> Self {
         ThreadData {
-            key_found: 0,
-            key_not_found: 0,
+            key_found: AtomicU64::new(0),
+            key_not_found: AtomicU64::new(0),
+            latency: Histogram::new(),
         }
     }
 }
 
-static mut GLOBAL_THREAD_DATA: Vec<ThreadData> = Vec::new();
+/// Options of reader threads.
+#[derive(Clone, Copy)]
+struct ReadConfig {
+    // keys looked up are in [0, keys)
+    keys: u32,
+    distribution: KeyDistribution,
+    latency: bool,
+}
 
-fn read_rcu(ht: Arc<RcuHt<u32, u32>>, id: usize) {
-    let thread = ht.thread();
+/// Increment a counter only updated by the current thread (no atomic read-modify-write needed).
+#[inline(always)]
+fn incr(counter: &AtomicU64) {
+    counter.store(counter.load(Ordering::Relaxed) + 1, Ordering::Relaxed);
+}
 
-    let thread_data = unsafe {
-        let v = &mut GLOBAL_THREAD_DATA;
-        &mut v[id]
-    };
+fn read_rcu(
+    ht: Arc<RcuHt<u32, u32>>,
+    thread_data: Arc<Vec<ThreadData>>,
+    id: usize,
+    config: ReadConfig,
+) {
+    #[allow(unused_mut)]
+    let mut thread = ht.thread();
+
+    let thread_data = &thread_data[id];
+    let keys = generate_keys(
+        config.keys,
+        config.distribution,
+        KEY_SEQUENCE_SIZE,
+        id as u64,
+    );
+    let mut count = 0u64;
 
     loop {
-        let rdlock = thread.rdlock();
-        let val = rdlock.get(&0);
-        match val {
-            Some(_) => thread_data.key_found += 1,
-            None => thread_data.key_not_found += 1,
-        }
+        for key in &keys {
+            let sampled = config.latency && count % LATENCY_SAMPLE_RATE == 0;
+            count += 1;
+
+            let start = if sampled { ticks() } else { 0 };
+            let found = {
+                let rdlock = thread.rdlock();
+                rdlock.get(key).is_some()
+            };
+            if sampled {
+                thread_data.latency.record(ticks().wrapping_sub(start));
+            }
 
-        #[cfg(feature = "qsbr")]
-        thread.quiescent_state();
+            if found {
+                incr(&thread_data.key_found);
+            } else {
+                incr(&thread_data.key_not_found);
+            }
+
+            #[cfg(feature = "qsbr")]
+            thread.quiescent_state();
+        }
     }
 }
 
@@ -76,6 +128,36 @@ fn main() {
                 .help("Sets a custom run time in seconds")
                 .takes_value(true),
         )
+        .arg(
+            Arg::new("keys")
+                .short('k')
+                .long("keys")
+                .value_name("KEYS")
+                .help("Sets the number of keys looked up by readers (keys above OBJECTS are never removed)")
+                .takes_value(true),
+        )
+        .arg(
+            Arg::new("distribution")
+                .short('d')
+                .long("distribution")
+                .value_name("DISTRIBUTION")
+                .help("Sets the distribution of keys looked up by readers")
+                .possible_values(&["uniform", "zipf"])
+                .takes_value(true),
+        )
+        .arg(
+            Arg::new("theta")
+                .long("theta")
+                .value_name("THETA")
+                .help("Sets the exponent of the zipf distribution")
+                .takes_value(true),
+        )
+        .arg(
+            Arg::new("latency")
+                .short('l')
+                .long("latency")
+                .help("Measures get, insert and remove latencies"),
+        )
         .get_matches();
 
     // use "cores" option or take all available cores
@@ -103,6 +185,22 @@ fn main() {
         .parse::<u64>()
         .unwrap();
 
+    let keys = matches
+        .value_of("keys")
+        .unwrap_or("1")
+        .parse::<u32>()
+        .unwrap();
+    let theta = matches
+        .value_of("theta")
+        .unwrap_or("0.99")
+        .parse::<f64>()
+        .unwrap();
+    let distribution = match matches.value_of("distribution").unwrap_or("uniform") {
+        "zipf" => KeyDistribution::Zipf(theta),
+        _ => KeyDistribution::Uniform,
+    };
+    let latency = matches.is_present("latency");
+
     if cores.len() < 2 {
         println!("There must be at least 2 cores to run this test");
         return;
@@ -118,11 +216,27 @@ fn main() {
         return;
     }
 
-    println!("{} cores used and {objects} objects changed every 1ms.", cores.len());
+    if keys < 1 {
+        println!("readers must look up at least 1 key");
+        return;
+    }
+
+    if let KeyDistribution::Zipf(theta) = distribution {
+        if theta <= 0.0 || theta == 1.0 {
+            println!("zipf exponent must be positive and different from 1");
+            return;
+        }
+    }
+
+    println!(
+        "{} cores used and {objects} objects changed every 1ms.",
+        cores.len()
+    );
 
     let ht = RcuHt::new(64, 64, 64, false).expect("Cannot allocate RCU hashtable");
     let ht = Arc::new(ht);
-    let mut old_thread_data: Vec<ThreadData> = Vec::new();
+    let mut old_thread_data: Vec<(u64, u64)> = Vec::new();
+    let mut thread_data: Vec<ThreadData> = Vec::new();
 
     let mut max_core_id = 0;
     cores.iter().for_each(|c| {
@@ -131,24 +245,38 @@ fn main() {
         }
     });
     for _i in 0..max_core_id + 1 {
-        old_thread_data.push(ThreadData::new());
-        unsafe {
-            GLOBAL_THREAD_DATA.push(ThreadData::new());
-        }
+        old_thread_data.push((0, 0));
+        thread_data.push(ThreadData::new());
     }
+    let thread_data = Arc::new(thread_data);
 
     let master_core_id = cores.pop().unwrap();
 
+    let thread = ht.thread();
+    let mut ht_write = thread.wrlock().unwrap();
+
+    // keys which are never removed
+    for i in objects..keys {
+        ht_write.insert_or_replace(i, 0);
+    }
+
+    let config = ReadConfig {
+        keys,
+        distribution,
+        latency,
+    };
+
     let thread_cores = cores.clone();
     for i in thread_cores {
         core_affinity::set_for_current(CoreId { id: i });
         // Spin up another thread
         let ht = ht.clone();
+        let thread_data = thread_data.clone();
         children.push(
             std::thread::Builder::new()
                 .stack_size(32 * 1024 * 1024)
                 .spawn(move || {
-                    read_rcu(ht, i);
+                    read_rcu(ht, thread_data, i, config);
                 })
                 .unwrap(),
         );
@@ -156,14 +284,18 @@ fn main() {
 
     core_affinity::set_for_current(CoreId { id: master_core_id });
 
-    let thread = ht.thread();
-    let mut ht_write = thread.wrlock().unwrap();
+    let insert_latency = Histogram::new();
+    let remove_latency = Histogram::new();
     let mut now = std::time::Instant::now();
 
     let mut remaining_time = seconds;
     loop {
         for i in 0..objects {
+            let start = ticks();
             ht_write.insert_or_replace(i, 0);
+            if latency {
+                insert_latency.record(ticks().wrapping_sub(start));
+            }
         }
 
         std::thread::sleep(std::time::Duration::from_millis(1));
@@ -173,23 +305,21 @@ fn main() {
 
             print!("read: ");
             for i in &cores {
-                let old = &mut old_thread_data[*i as usize];
-                let thread_data = unsafe {
-                    let v = &GLOBAL_THREAD_DATA;
-                    &v[*i as usize]
-                };
+                let (old_found, old_not_found) = &mut old_thread_data[*i as usize];
+                let key_found = thread_data[*i as usize].key_found.load(Ordering::Relaxed);
+                let key_not_found = thread_data[*i as usize]
+                    .key_not_found
+                    .load(Ordering::Relaxed);
 
                 print!(
                     "{} [{} + {}] ",
-                    thread_data.key_found + thread_data.key_not_found
-                        - old.key_found
-                        - old.key_not_found,
-                    thread_data.key_not_found - old.key_not_found,
-                    thread_data.key_found - old.key_found
+                    key_found + key_not_found - *old_found - *old_not_found,
+                    key_not_found - *old_not_found,
+                    key_found - *old_found
                 );
 
-                old.key_found = thread_data.key_found;
-                old.key_not_found = thread_data.key_not_found;
+                *old_found = key_found;
+                *old_not_found = key_not_found;
             }
             println!();
 
@@ -200,22 +330,25 @@ fn main() {
         }
 
         for i in 0..objects {
+            let start = ticks();
             ht_write.remove(&i).expect("Cannot remove key");
+            if latency {
+                remove_latency.record(ticks().wrapping_sub(start));
+            }
         }
     }
 
     /* final computation */
     let mut key_found = 0u64;
     let mut key_not_found = 0u64;
+    let get_latency = Histogram::new();
 
     for i in &cores {
-        let thread_data = unsafe {
-            let v = &GLOBAL_THREAD_DATA;
-            &v[*i as usize]
-        };
+        let thread_data = &thread_data[*i as usize];
 
-        key_found += thread_data.key_found;
-        key_not_found += thread_data.key_not_found;
+        key_found += thread_data.key_found.load(Ordering::Relaxed);
+        key_not_found += thread_data.key_not_found.load(Ordering::Relaxed);
+        get_latency.add(&thread_data.latency);
     }
 
     println!(
@@ -224,4 +357,10 @@ fn main() {
         key_not_found / seconds,
         key_found / seconds
     );
+
+    if latency {
+        get_latency.print("get");
+        insert_latency.print("insert");
+        remove_latency.print("remove");
+    }
 }
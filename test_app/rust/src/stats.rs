@@ -0,0 +1,180 @@
+//! Latency histograms and key generators of the test application.
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// Sub-buckets per power of two: latencies are recorded with a 12.5% precision.
+const SUB_BUCKET_BITS: u32 = 3;
+const BUCKETS: usize = (64 << SUB_BUCKET_BITS) as usize;
+
+/// Current time, in CPU cycles (rdtsc) on x86_64, in ns elsewhere.
+#[inline(always)]
+pub fn ticks() -> u64 {
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        std::arch::x86_64::_rdtsc()
+    }
+
+    #[cfg(not(target_arch = "x86_64"))]
+    {
+        use std::time::Instant;
+        thread_local! {
+            static START: Instant = Instant::now();
+        }
+        START.with(|start| start.elapsed().as_nanos() as u64)
+    }
+}
+
+/// Unit of values returned by ticks().
+pub const TICKS_UNIT: &str = if cfg!(target_arch = "x86_64") {
+    "cycles"
+} else {
+    "ns"
+};
+
+/// Log-linear latency histogram. Updated by a single thread, read by any thread.
+pub struct Histogram {
+    buckets: Vec<AtomicU64>,
+}
+
+fn bucket_index(value: u64) -> usize {
+    if value < (1 << SUB_BUCKET_BITS) {
+        return value as usize;
+    }
+
+    let msb = 63 - value.leading_zeros();
+    let sub = (value >> (msb - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1);
+    (((msb - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) as u64 + sub) as usize
+}
+
+/// Highest value of a bucket.
+fn bucket_max(index: usize) -> u64 {
+    let sub_count = 1usize << SUB_BUCKET_BITS;
+    if index < sub_count {
+        return index as u64;
+    }
+
+    let shift = (index / sub_count - 1) as u32;
+    let sub = (index % sub_count) as u64;
+    (((sub_count as u64) + sub + 1) << shift) - 1
+}
+
+impl Histogram {
+    pub fn new() -> Self {
+        Histogram {
+            buckets: (0..BUCKETS).map(|_| AtomicU64::new(0)).collect(),
+        }
+    }
+
+    /// Record a value (single writer: no atomic read-modify-write needed).
+    #[inline]
+    pub fn record(&self, value: u64) {
+        let bucket = &self.buckets[bucket_index(value)];
+        bucket.store(bucket.load(Ordering::Relaxed) + 1, Ordering::Relaxed);
+    }
+
+    pub fn add(&self, other: &Histogram) {
+        for (bucket, other) in self.buckets.iter().zip(&other.buckets) {
+            bucket.fetch_add(other.load(Ordering::Relaxed), Ordering::Relaxed);
+        }
+    }
+
+    pub fn count(&self) -> u64 {
+        self.buckets.iter().map(|b| b.load(Ordering::Relaxed)).sum()
+    }
+
+    /// Upper bound of the `percentile`% lowest values.
+    pub fn percentile(&self, percentile: f64) -> u64 {
+        let target = ((self.count() as f64) * percentile / 100.0).ceil().max(1.0) as u64;
+        let mut seen = 0;
+
+        for (index, bucket) in self.buckets.iter().enumerate() {
+            seen += bucket.load(Ordering::Relaxed);
+            if seen >= target {
+                return bucket_max(index);
+            }
+        }
+
+        0
+    }
+
+    pub fn print(&self, name: &str) {
+        if self.count() == 0 {
+            println!("{name} latency: no sample");
+            return;
+        }
+
+        println!(
+            "{name} latency ({TICKS_UNIT}): p50 {} p99 {} p999 {} ({} samples)",
+            self.percentile(50.0),
+            self.percentile(99.0),
+            self.percentile(99.9),
+            self.count()
+        );
+    }
+}
+
+/// splitmix64 pseudo random generator (fixed seed: runs are reproducible).
+pub struct Rng(u64);
+
+impl Rng {
+    pub fn new(seed: u64) -> Self {
+        Rng(seed)
+    }
+
+    pub fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e3779b97f4a7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d049bb133111eb);
+        z ^ (z >> 31)
+    }
+
+    fn next_f64(&mut self) -> f64 {
+        (self.next() >> 11) as f64 / (1u64 << 53) as f64
+    }
+}
+
+/// Distribution of the keys looked up by readers.
+#[derive(Clone, Copy, Debug)]
+pub enum KeyDistribution {
+    Uniform,
+    /// Zipfian distribution with this exponent (Gray et al.): key 0 is the most frequent one.
+    Zipf(f64),
+}
+
+/// Generate `count` keys in [0, keys).
+pub fn generate_keys(
+    keys: u32,
+    distribution: KeyDistribution,
+    count: usize,
+    seed: u64,
+) -> Vec<u32> {
+    let mut rng = Rng::new(seed);
+    let n = keys as f64;
+
+    match distribution {
+        KeyDistribution::Uniform => (0..count)
+            .map(|_| (rng.next() % keys as u64) as u32)
+            .collect(),
+        KeyDistribution::Zipf(theta) => {
+            let zeta = |n: u32| (1..=n).map(|i| (i as f64).powf(-theta)).sum::<f64>();
+            let zetan = zeta(keys);
+            let alpha = 1.0 / (1.0 - theta);
+            let eta = (1.0 - (2.0 / n).powf(1.0 - theta)) / (1.0 - zeta(2) / zetan);
+
+            (0..count)
+                .map(|_| {
+                    let u = rng.next_f64();
+                    let uz = u * zetan;
+
+                    if uz < 1.0 {
+                        0
+                    } else if uz < 1.0 + 0.5f64.powf(theta) {
+                        1.min(keys - 1)
+                    } else {
+                        ((n * (eta * u - eta + 1.0).powf(alpha)) as u32).min(keys - 1)
+                    }
+                })
+                .collect()
+        }
+    }
+}
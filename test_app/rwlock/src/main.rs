@@ -6,6 +6,8 @@ use std::{
 use clap::{App, Arg};
 use core_affinity::CoreId;
 
+/// Counters of a reader thread, on their own cache line (no false sharing between readers).
+#[repr(align(64))]
 struct ThreadData {
     key_found: u64,
     key_not_found: u64,